@@ -26,59 +26,1287 @@ extern "C" {
 #include <limits.h>
 #include <locale.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include <wchar.h>
 
+#ifdef HAVE_GETRUSAGE
+#include <sys/resource.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#define CLI_MMAP 1
+#endif
+
 #define OPTPARSE_IMPLEMENTATION
 #include "optparse.h"
 
-#ifndef CLI_DEFAULT_LIMIT
-#define CLI_DEFAULT_LIMIT 16384
-#endif
+#ifndef CLI_DEFAULT_LIMIT
+#define CLI_DEFAULT_LIMIT 16384
+#endif
+
+/* Number of bytes read at once from input which cannot be mapped */
+#define CLI_BLOCK 65536
+
+#include <wcjson-document.h>
+
+int ascii = 0;
+int report = 0;
+int report_json = 0;
+int stream = 0;
+bool in_ascii = false;
+bool in_utf8 = false;
+bool out_utf8 = false;
+
+enum phase {
+	PHASE_DECODE,
+	PHASE_VALUES,
+	PHASE_STRINGS,
+	PHASE_MBSTRINGS,
+	PHASE_SERIALIZE,
+	PHASE_NITEMS,
+};
+
+static const char *const phase_names[PHASE_NITEMS] = {
+	"decode",
+	"values",
+	"strings",
+	"mbstrings",
+	"serialize",
+};
+
+struct report {
+	char in_locale[64];
+	char out_locale[64];
+	size_t in_bytes;
+	size_t in_nitems;
+	size_t v_nitems;
+	size_t s_nitems;
+	size_t mb_nitems;
+	size_t o_nitems;
+	size_t free_bytes;
+	size_t peak_rss;
+	unsigned long runs;
+	unsigned long timed;
+	double secs[PHASE_NITEMS];
+};
+
+static void
+fail(struct wcjson *ctx)
+{
+	int ret = 3;
+
+	switch (ctx->status) {
+	case WCJSON_ABORT_INVALID:
+		fputws(L"wcjson: Invalid JSON text\n", stderr);
+		ret = 1;
+		break;
+	case WCJSON_ABORT_END_OF_INPUT:
+		fputws(L"wcjson: Unexpected end of input\n", stderr);
+		ret = 2;
+		break;
+	case WCJSON_ABORT_ERROR:
+		errno = ctx->errnum;
+		perror("wcjson");
+		break;
+	default:
+		break;
+	}
+
+	exit(ret);
+}
+
+static void
+usage(void)
+{
+#ifdef HAVE_SETLOCALE
+	fprintf(stderr,
+	    "usage: wcjson [-i file] [-o file] [-d locale] [-e locale] "
+	    "[-a] [-s] [-q pointer] [-r] [-j] [-n count] [-m bytes]\n");
+#else
+	fprintf(stderr,
+	    "usage: wcjson [-i file] [-o file] [-a] [-s] [-q pointer] [-r] "
+	    "[-j] [-n count] [-m bytes]\n");
+#endif
+	exit(3);
+}
+
+static double
+now(void)
+{
+#if defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) == 0)
+		return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+#endif
+	const clock_t c = clock();
+
+	return (double)c / CLOCKS_PER_SEC;
+}
+
+/* Accounts the time elapsed since t to phase p unless warming up. */
+static double
+lap(struct report *rep, enum phase p, double t, unsigned long run)
+{
+	const double n = now();
+
+	if (run > 0 || rep->runs == 1)
+		rep->secs[p] += n - t;
+
+	return n;
+}
+
+static void
+report_print(FILE *f, struct report *rep)
+{
+	const size_t v_bytes = rep->v_nitems * sizeof(struct wcjson_value);
+	const size_t in_bytes = rep->in_nitems * sizeof(wchar_t);
+	const size_t s_bytes = rep->s_nitems * sizeof(wchar_t);
+	const size_t o_bytes = rep->o_nitems * sizeof(wchar_t);
+	const size_t total = in_bytes + v_bytes + s_bytes + rep->mb_nitems +
+	    o_bytes;
+
+#ifdef HAVE_GETRUSAGE
+	struct rusage ru;
+
+	if (getrusage(RUSAGE_SELF, &ru) == 0)
+#ifdef __APPLE__
+		rep->peak_rss = (size_t)ru.ru_maxrss;
+#else
+		rep->peak_rss = (size_t)ru.ru_maxrss * 1024;
+#endif
+#endif
+
+	if (report_json) {
+		fprintf(f, "{\n");
+#ifdef HAVE_SETLOCALE
+		fprintf(f, "  \"input_locale\": \"%s\",\n", rep->in_locale);
+		fprintf(f, "  \"output_locale\": \"%s\",\n", rep->out_locale);
+#endif
+		fprintf(f, "  \"input_bytes\": %zu,\n", rep->in_bytes);
+		fprintf(f, "  \"input_characters\": %zu,\n", rep->in_nitems);
+		fprintf(f, "  \"values\": %zu,\n", rep->v_nitems);
+		fprintf(f, "  \"wide_string_characters\": %zu,\n",
+		    rep->s_nitems);
+
+		fprintf(f, "  \"multibyte_string_characters\": %zu,\n",
+		    rep->mb_nitems);
+
+		fprintf(f, "  \"output_characters\": %zu,\n", rep->o_nitems);
+		fprintf(f, "  \"free_memory\": %zu,\n", rep->free_bytes);
+		fprintf(f, "  \"peak_rss\": %zu,\n", rep->peak_rss);
+		fprintf(f, "  \"total_bytes\": %zu,\n", total);
+		fprintf(f, "  \"runs\": %lu,\n", rep->runs);
+		fprintf(f, "  \"phases\": {\n");
+	}
+#ifdef HAVE_SETLOCALE
+	else {
+		fprintf(f, "Input locale: %s\n", rep->in_locale);
+		fprintf(f, "Output locale: %s\n", rep->out_locale);
+	}
+#endif
+
+	if (!report_json) {
+		fprintf(f, "Input bytes: %zu\n", rep->in_bytes);
+		fprintf(f, "Input characters: %zu\n", rep->in_nitems);
+		fprintf(f, "Input characters (byte): %zu\n", in_bytes);
+		fprintf(f, "Values: %zu\n", rep->v_nitems);
+		fprintf(f, "Values (byte): %zu\n", v_bytes);
+		fprintf(f, "Wide string characters: %zu\n", rep->s_nitems);
+		fprintf(f, "Wide string characters (byte): %zu\n", s_bytes);
+		fprintf(f, "Multibyte string characters: %zu\n",
+		    rep->mb_nitems);
+
+		fprintf(f, "Multibyte string  characters (byte): %zu\n",
+		    rep->mb_nitems * sizeof(char));
+
+		fprintf(f, "Output characters: %zu\n", rep->o_nitems);
+		fprintf(f, "Output characters (byte): %zu\n", o_bytes);
+		fprintf(f, "Free memory (byte): %zu\n", rep->free_bytes);
+		fprintf(f, "Runs: %lu\n", rep->runs);
+	}
+
+	for (int p = 0; p < PHASE_NITEMS; p++) {
+		// Input is decoded once, all other phases are averaged
+		const double secs = p == PHASE_DECODE ? rep->secs[p] :
+		    rep->secs[p] / (double)rep->timed;
+		const double mbs = secs > 0 ?
+		    (double)rep->in_bytes / secs / 1e6 : 0;
+
+		if (report_json)
+			fprintf(f, "    \"%s\": { \"seconds\": %.6f, "
+			    "\"mb_per_second\": %.3f }%s\n", phase_names[p],
+			    secs, mbs, p + 1 < PHASE_NITEMS ? "," : "");
+		else {
+			fprintf(f, "Time %s (s): %.6f\n", phase_names[p], secs);
+			fprintf(f, "Throughput %s (MB/s): %.3f\n",
+			    phase_names[p], mbs);
+		}
+	}
+
+	if (report_json)
+		fprintf(f, "  }\n}\n");
+	else {
+		fprintf(f, "Peak RSS (byte): %zu\n", rep->peak_rss);
+		fprintf(f, "Total bytes: %zu\n", total);
+	}
+}
+
+static void
+out_init(void)
+{
+	static const wchar_t samples[] = { L'A', 0xe4, 0x20ac };
+	char b[MB_LEN_MAX], u[4];
+	mbstate_t mbs;
+
+	memset(&mbs, 0, sizeof(mbs));
+	out_utf8 = true;
+
+	// Locales encoding like UTF-8 allow using the locale independent encoder
+	for (size_t i = 0; i < sizeof(samples) / sizeof(samples[0]); i++) {
+		size_t u_len = sizeof(u);
+		const size_t n = wcrtomb(b, samples[i], &mbs);
+
+		if (n == (size_t)-1 || wctoutf8s(&samples[i], 1, u, &u_len) < 0 ||
+		    n != u_len || memcmp(b, u, n) != 0) {
+			out_utf8 = false;
+			break;
+		}
+	}
+}
+
+static void
+in_init(void)
+{
+	mbstate_t mbs;
+	wchar_t wc;
+
+	memset(&mbs, 0, sizeof(mbs));
+	in_ascii = true;
+
+	// ASCII bytes decoding to themselves allow skipping mbrtowc
+	for (int c = 1; c < 0x80; c++) {
+		const char b = (char)c;
+
+		if (mbrtowc(&wc, &b, 1, &mbs) != 1 || wc != (wchar_t)c ||
+		    !mbsinit(&mbs)) {
+			in_ascii = false;
+			break;
+		}
+	}
+
+#if defined(WCHAR_T_UTF32) || defined(WCHAR_T_UTF16)
+	static const char *const samples[] = { "\xc3\xa4", "\xe2\x82\xac" };
+	static const wchar_t decoded[] = { 0xe4, 0x20ac };
+
+	in_utf8 = in_ascii;
+
+	// Locales decoding like UTF-8 allow parsing the input bytes directly
+	for (size_t i = 0; i < sizeof(decoded) / sizeof(decoded[0]); i++) {
+		const size_t n = strlen(samples[i]);
+
+		if (mbrtowc(&wc, samples[i], n, &mbs) != n ||
+		    wc != decoded[i]) {
+			in_utf8 = false;
+			break;
+		}
+	}
+#endif
+}
+
+static size_t
+in_decode(const char *b, const size_t b_len, mbstate_t *mbs, wchar_t *d,
+    const size_t d_len, size_t *d_posp)
+{
+	size_t i = 0, j = *d_posp;
+
+	while (i < b_len && j < d_len) {
+		if (in_ascii && (unsigned char)b[i] < 0x80 && mbsinit(mbs)) {
+			const size_t n = i + (b_len - i < d_len - j ?
+			    b_len - i : d_len - j);
+
+			while (i < n && (unsigned char)b[i] < 0x80)
+				d[j++] = (wchar_t)b[i++];
+
+			continue;
+		}
+
+		wchar_t wc;
+		const size_t n = mbrtowc(&wc, &b[i], b_len - i, mbs);
+
+		if (n == (size_t)-1)
+			return n;
+
+		if (n == (size_t)-2) {
+			// Incomplete sequence kept in mbs
+			i = b_len;
+			break;
+		}
+
+		d[j++] = wc;
+		i += n == 0 ? 1 : n;
+	}
+
+	*d_posp = j;
+	return i;
+}
+
+/*
+ * Maps the regular file in if the locale decodes it like UTF-8, so that it can
+ * be parsed without decoding it into memory first.
+ */
+static char *
+in_map(FILE *in, size_t *sizep)
+{
+#ifdef CLI_MMAP
+	struct stat st;
+
+	in_init();
+
+	if (!in_utf8 || fstat(fileno(in), &st) < 0 || !S_ISREG(st.st_mode) ||
+	    st.st_size <= 0 || (uintmax_t)st.st_size > SIZE_MAX)
+		return NULL;
+
+	char *b = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE,
+	    fileno(in), 0);
+
+	if (b == MAP_FAILED)
+		return NULL;
+
+	*sizep = (size_t)st.st_size;
+	return b;
+#else
+	return NULL;
+#endif
+}
+
+static void
+in_unmap(char *b, size_t size)
+{
+#ifdef CLI_MMAP
+	if (b != NULL)
+		munmap(b, size);
+#endif
+}
+
+static wchar_t *
+in_read(FILE *in, struct wcjson_arena *arena, size_t *lenp, size_t *bytesp)
+{
+	mbstate_t mbs;
+	wchar_t *json;
+	size_t json_len, len = 0;
+
+	memset(&mbs, 0, sizeof(mbs));
+	in_init();
+
+#ifdef CLI_MMAP
+	struct stat st;
+
+	if (fstat(fileno(in), &st) == 0 && S_ISREG(st.st_mode) &&
+	    st.st_size > 0 && (uintmax_t)st.st_size <= SIZE_MAX) {
+		const size_t size = (size_t)st.st_size;
+		char *b = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fileno(in),
+		    0);
+
+		if (b != MAP_FAILED) {
+			// Never more characters than bytes
+			json = wcjson_arena_alloc(arena, size, sizeof(wchar_t));
+
+			const size_t n = json == NULL ? 0 :
+			    in_decode(b, size, &mbs, json, size, &len);
+
+			munmap(b, size);
+
+			if (json == NULL || n == (size_t)-1)
+				return NULL;
+
+			if (!mbsinit(&mbs))
+				goto err_ilseq;
+
+			if (wcjson_arena_shrink(arena, json, len,
+			    sizeof(wchar_t)) < 0)
+				return NULL;
+
+			*lenp = len;
+			*bytesp = size;
+			return json;
+		}
+	}
+#endif
+	char b[CLI_BLOCK];
+	size_t b_len, bytes = 0;
+
+	json = wcjson_arena_tail(arena, sizeof(wchar_t), &json_len);
+
+	if (json == NULL)
+		return NULL;
+
+	while ((b_len = fread(b, sizeof(char), sizeof(b), in)) > 0) {
+		const size_t n = in_decode(b, b_len, &mbs, json, json_len,
+		    &len);
+
+		if (n == (size_t)-1)
+			return NULL;
+
+		if (n < b_len)
+			goto err_nomem;
+
+		bytes += b_len;
+	}
+
+	if (ferror(in))
+		return NULL;
+
+	if (!mbsinit(&mbs))
+		goto err_ilseq;
+
+	if (wcjson_arena_shrink(arena, json, len, sizeof(wchar_t)) < 0)
+		return NULL;
+
+	*lenp = len;
+	*bytesp = bytes;
+	return json;
+err_nomem:
+	errno = ENOMEM;
+	return NULL;
+err_ilseq:
+	errno = EILSEQ;
+	return NULL;
+}
+
+/* Number of wide characters buffered by the streaming writer */
+#define STREAM_NITEMS 4096
+
+/* Maximum number of queries */
+#define QUERY_MAX 32
+
+struct query_token {
+	const wchar_t *s;
+	size_t len;
+	size_t index;
+	bool is_index;
+};
+
+struct query {
+	struct query_token *tokens;
+	size_t t_nitems;
+};
+
+struct stream_frame {
+	bool object;
+	bool first;
+	bool key;
+	uint32_t match;
+	uint32_t next;
+	size_t index;
+};
+
+enum stream_action {
+	STREAM_WRITE,
+	STREAM_DESCEND,
+	STREAM_SKIP,
+};
+
+struct stream {
+	FILE *f;
+	mbstate_t mbs;
+	struct stream_frame *frames;
+	size_t f_nitems;
+	size_t depth;
+	size_t pos;
+	const struct query *queries;
+	size_t q_nitems;
+	size_t base;
+	uint32_t match;
+	bool selected;
+	size_t k_off[QUERY_MAX];
+	wchar_t buf[STREAM_NITEMS + 1];
+	wchar_t scratch[STREAM_NITEMS];
+	wchar_t wide[STREAM_NITEMS];
+};
+
+/*
+ * Decodes complete UTF-8 sequences of b into d starting at *d_posp while they
+ * fit into d_len wide characters. Returns the number of bytes decoded.
+ */
+static size_t
+stream_utf8_decode(const char *b, const size_t b_len, wchar_t *d,
+    const size_t d_len, size_t *d_posp)
+{
+	const unsigned char *u = (const unsigned char *)b;
+	size_t i = 0, j = *d_posp;
+
+	while (i < b_len && j < d_len) {
+		uint32_t c = u[i];
+		size_t n = 1;
+
+		if (c >= 0x80) {
+			uint32_t min;
+
+			if (c >= 0xc2 && c <= 0xdf)
+				n = 2, c &= 0x1f, min = 0x80;
+			else if (c >= 0xe0 && c <= 0xef)
+				n = 3, c &= 0x0f, min = 0x800;
+			else if (c >= 0xf0 && c <= 0xf4)
+				n = 4, c &= 0x07, min = 0x10000;
+			else
+				goto err_ilseq;
+
+			if (n > b_len - i)
+				goto err_ilseq;
+
+			for (size_t k = 1; k < n; k++) {
+				if ((u[i + k] & 0xc0) != 0x80)
+					goto err_ilseq;
+
+				c = (c << 6) | (u[i + k] & 0x3f);
+			}
+
+			if (c < min || c > 0x10ffff ||
+			    (c >= 0xd800 && c <= 0xdfff))
+				goto err_ilseq;
+		}
+
+#if defined(WCHAR_T_UTF16)
+		if (c >= 0x10000) {
+			if (d_len - j < 2)
+				break;
+
+			c -= 0x10000;
+			d[j++] = (wchar_t)(0xd800 + (c >> 10));
+			c = 0xdc00 + (c & 0x3ff);
+		}
+#endif
+		d[j++] = (wchar_t)c;
+		i += n;
+	}
+
+	*d_posp = j;
+	return i;
+err_ilseq:
+	errno = EILSEQ;
+	return (size_t)-1;
+}
+
+static int
+stream_flush(struct stream *s)
+{
+	const wchar_t *p = s->buf;
+	char b[CLI_BLOCK];
+
+	if (out_utf8) {
+		size_t b_len = sizeof(b);
+
+		if (wctoutf8s(s->buf, s->pos, b, &b_len) < 0)
+			return -1;
+
+		s->pos = 0;
+		return fwrite(b, sizeof(char), b_len, s->f) == b_len ? 0 : -1;
+	}
+
+	s->buf[s->pos] = L'\0';
+	s->pos = 0;
+
+	while (p != NULL) {
+		const size_t b_len = wcsrtombs(b, &p, sizeof(b), &s->mbs);
+
+		if (b_len == (size_t)-1)
+			return -1;
+
+		if (fwrite(b, sizeof(char), b_len, s->f) != b_len)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+stream_put(struct stream *s, const wchar_t *w, size_t len)
+{
+	if (STREAM_NITEMS - s->pos < len && stream_flush(s) < 0)
+		return -1;
+
+	// Only numbers may exceed the buffer
+	while (len > STREAM_NITEMS - s->pos) {
+		const size_t n = STREAM_NITEMS - s->pos;
+
+		wmemcpy(&s->buf[s->pos], w, n);
+		s->pos += n;
+
+		if (stream_flush(s) < 0)
+			return -1;
+
+		w += n;
+		len -= n;
+	}
+
+	wmemcpy(&s->buf[s->pos], w, len);
+	s->pos += len;
+	return 0;
+}
+
+/*
+ * Number of characters out of the first n of w to process at once without
+ * splitting a character encoded by multiple wide characters.
+ */
+static size_t
+stream_slice(const wchar_t *w, const size_t w_len, size_t n)
+{
+	if (n >= w_len)
+		return w_len;
+
+#if defined(WCHAR_T_UTF16)
+	if (w[n - 1] >= 0xd800 && w[n - 1] <= 0xdbff)
+		n = n > 1 ? n - 1 : n + 1;
+#elif defined(WCHAR_T_UTF8)
+	size_t m = n;
+
+	while (m > 0 && (w[m] & 0xc0) == 0x80)
+		m--;
+
+	if (m == 0) {
+		while (n < w_len && (w[n] & 0xc0) == 0x80)
+			n++;
+	} else
+		n = m;
+#endif
+	return n;
+}
+
+/*
+ * Number of characters out of the first n of the escaped string w to unescape
+ * at once without splitting an escape sequence or a surrogate pair.
+ */
+static size_t
+stream_unescape_slice(const wchar_t *w, const size_t w_len, size_t n)
+{
+	size_t i = 0, e;
+
+	n = stream_slice(w, w_len, n);
+
+	while (i < n) {
+		if (w[i] != L'\\') {
+			i++;
+			continue;
+		}
+
+		e = i + 1 < w_len && w[i + 1] == L'u' ? 6 : 2;
+
+		if (e == 6 && i + 12 <= w_len && (w[i + 2] == L'd' ||
+		    w[i + 2] == L'D') && wcschr(L"89abAB", w[i + 3]) != NULL &&
+		    w[i + 6] == L'\\' && w[i + 7] == L'u')
+			e = 12;
+
+		if (i + e > n)
+			return i > 0 ? i : e;
+
+		i += e;
+	}
+
+	return i;
+}
+
+static int
+stream_esc(struct stream *s, const wchar_t *w, size_t w_len)
+{
+	while (w_len > 0) {
+		if (STREAM_NITEMS - s->pos < WCJSON_ESCAPE_MAX &&
+		    stream_flush(s) < 0)
+			return -1;
+
+		size_t e_len = STREAM_NITEMS - s->pos;
+		const size_t n = stream_slice(w, w_len,
+		    e_len / WCJSON_ESCAPE_MAX);
+
+		if (ascii) {
+			if (wctoascjsons(w, n, &s->buf[s->pos], &e_len) < 0)
+				return -1;
+		} else {
+			if (wctowcjsons(w, n, &s->buf[s->pos], &e_len) < 0)
+				return -1;
+		}
+
+		s->pos += e_len;
+		w += n;
+		w_len -= n;
+	}
+
+	return 0;
+}
+
+static int
+stream_string(struct stream *s, const wchar_t *w, size_t w_len, bool escaped)
+{
+	if (!escaped)
+		return stream_esc(s, w, w_len);
+
+	// Unescapes in slices so that no string is ever held as a whole
+	while (w_len > 0) {
+		size_t u_len = STREAM_NITEMS;
+		const size_t n = stream_unescape_slice(w, w_len, STREAM_NITEMS);
+
+		if (wcjsonstowc(w, n, s->scratch, &u_len) < 0)
+			return -1;
+
+		if (stream_esc(s, s->scratch, u_len) < 0)
+			return -1;
+
+		w += n;
+		w_len -= n;
+	}
+
+	return 0;
+}
+
+/* Writes the separator preceding the next value or key of the container. */
+static int
+stream_sep(struct stream *s)
+{
+	if (s->depth <= s->base)
+		return 0;
+
+	struct stream_frame *fr = &s->frames[s->depth - 1];
+
+	if (fr->object && !fr->key)
+		return 0;
+
+	if (!fr->first && stream_put(s, L",", 1) < 0)
+		return -1;
+
+	fr->first = false;
+	return 0;
+}
+
+/* Starts matching the key of a member of the current object. */
+static void
+stream_key_start(struct stream *s)
+{
+	struct stream_frame *fr = &s->frames[s->depth - 1];
+
+	fr->next = fr->match;
+
+	for (size_t i = 0; i < s->q_nitems; i++)
+		s->k_off[i] = 0;
+}
+
+/*
+ * Matches the next slice w of the key of a member against the query tokens
+ * still matching the key.
+ */
+static void
+stream_key_part(struct stream *s, const wchar_t *w, size_t w_len,
+    bool escaped)
+{
+	struct stream_frame *fr = &s->frames[s->depth - 1];
+
+	while (w_len > 0 && fr->next != 0) {
+		const wchar_t *u = w;
+		size_t u_len = w_len, n = w_len;
+
+		if (escaped) {
+			u_len = STREAM_NITEMS;
+			n = stream_unescape_slice(w, w_len, STREAM_NITEMS);
+			u = s->scratch;
+
+			if (wcjsonstowc(w, n, s->scratch, &u_len) < 0) {
+				fr->next = 0;
+				return;
+			}
+		}
+
+		for (size_t i = 0; i < s->q_nitems; i++) {
+			const struct query_token *t =
+			    &s->queries[i].tokens[s->depth - 1];
+
+			if (!(fr->next & (UINT32_C(1) << i)))
+				continue;
+
+			if (u_len > t->len - s->k_off[i] ||
+			    wmemcmp(&t->s[s->k_off[i]], u, u_len) != 0)
+				fr->next &= ~(UINT32_C(1) << i);
+			else
+				s->k_off[i] += u_len;
+		}
+
+		w += n;
+		w_len -= n;
+	}
+}
+
+/* Records the queries matching the complete key of the member. */
+static void
+stream_key_end(struct stream *s)
+{
+	struct stream_frame *fr = &s->frames[s->depth - 1];
+
+	for (size_t i = 0; i < s->q_nitems; i++)
+		if (s->k_off[i] != s->queries[i].tokens[s->depth - 1].len)
+			fr->next &= ~(UINT32_C(1) << i);
+}
+
+/*
+ * Decides whether the next value is written, descended into looking for
+ * selected values or skipped, and writes its separator if needed.
+ */
+static int
+stream_value(struct stream *s, enum stream_action *actp)
+{
+	uint32_t match;
+
+	*actp = STREAM_WRITE;
+
+	if (s->selected)
+		return stream_sep(s);
+
+	if (s->depth == 0)
+		match = (uint32_t)((UINT64_C(1) << s->q_nitems) - 1);
+	else {
+		struct stream_frame *fr = &s->frames[s->depth - 1];
+		const size_t index = fr->index++;
+
+		if (fr->object)
+			match = fr->next;
+		else {
+			match = 0;
+
+			for (size_t i = 0; i < s->q_nitems; i++) {
+				const struct query_token *t =
+				    &s->queries[i].tokens[s->depth - 1];
+
+				if ((fr->match & (UINT32_C(1) << i)) &&
+				    t->is_index && t->index == index)
+					match |= UINT32_C(1) << i;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < s->q_nitems; i++)
+		if ((match & (UINT32_C(1) << i)) &&
+		    s->queries[i].t_nitems == s->depth) {
+			s->selected = true;
+			s->base = s->depth;
+			return 0;
+		}
+
+	s->match = match;
+	*actp = match != 0 ? STREAM_DESCEND : STREAM_SKIP;
+	return 0;
+}
+
+/* Terminates a selected value once written completely. */
+static int
+stream_done(struct stream *s)
+{
+	if (s->q_nitems == 0 || !s->selected || s->depth != s->base)
+		return 0;
+
+	s->selected = false;
+	return stream_put(s, L"\n", 1);
+}
+
+static void *
+stream_err(struct wcjson *ctx, struct stream *s)
+{
+	const int saved_errno = errno;
+
+	if (ctx->status == WCJSON_OK) {
+		ctx->status = WCJSON_ABORT_ERROR;
+		ctx->errnum = errno;
+	}
+
+	errno = saved_errno;
+	return s;
+}
+
+static void *
+stream_start(struct wcjson *ctx, struct stream *s, bool object)
+{
+	enum stream_action act;
+
+	if (s->depth == s->f_nitems) {
+		errno = ENOMEM;
+		return stream_err(ctx, s);
+	}
+
+	if (stream_value(s, &act) < 0)
+		return stream_err(ctx, s);
+
+	if (act == STREAM_SKIP)
+		return WCJSON_SKIP;
+
+	if (act == STREAM_WRITE && stream_put(s, object ? L"{" : L"[", 1) < 0)
+		return stream_err(ctx, s);
+
+	struct stream_frame *fr = &s->frames[s->depth++];
+
+	fr->object = object;
+	fr->first = true;
+	fr->key = object;
+	fr->match = s->match;
+	fr->next = 0;
+	fr->index = 0;
+	return s;
+}
 
-#include <wcjson-document.h>
+static void
+stream_end(struct wcjson *ctx, struct stream *s, bool object)
+{
+	s->depth--;
 
-int ascii = 0;
-int report = 0;
+	if (!s->selected)
+		return;
+
+	if (stream_put(s, object ? L"}" : L"]", 1) < 0 || stream_done(s) < 0)
+		stream_err(ctx, s);
+}
+
+static void *
+stream_object_start(struct wcjson *ctx, void *doc, void *parent)
+{
+	return stream_start(ctx, doc, true);
+}
 
 static void
-fail(struct wcjson *ctx)
+stream_object_add(struct wcjson *ctx, void *doc, void *obj, void *key,
+    void *value)
 {
-	int ret = 3;
+	struct stream *s = doc;
 
-	switch (ctx->status) {
-	case WCJSON_ABORT_INVALID:
-		fputws(L"wcjson: Invalid JSON text\n", stderr);
-		ret = 1;
-		break;
-	case WCJSON_ABORT_END_OF_INPUT:
-		fputws(L"wcjson: Unexpected end of input\n", stderr);
-		ret = 2;
-		break;
-	case WCJSON_ABORT_ERROR:
-		errno = ctx->errnum;
-		perror("wcjson");
-		break;
-	default:
-		break;
-	}
+	s->frames[s->depth - 1].key = true;
+}
 
-	exit(ret);
+static void
+stream_object_end(struct wcjson *ctx, void *doc, void *obj)
+{
+	stream_end(ctx, doc, true);
+}
+
+static void *
+stream_array_start(struct wcjson *ctx, void *doc, void *parent)
+{
+	return stream_start(ctx, doc, false);
 }
 
 static void
-usage(void)
+stream_array_add(struct wcjson *ctx, void *doc, void *arr, void *value)
 {
-#ifdef HAVE_SETLOCALE
-	fprintf(stderr,
-	    "usage: wcjson [-i file] [-o file] [-d locale] [-e locale] "
-	    "[-a] [-r] [-m bytes]\n");
-#else
-	fprintf(stderr,
-	    "usage: wcjson [-i file] [-o file] [-a] [-r] [-m bytes]\n");
-#endif
-	exit(3);
+}
+
+static void
+stream_array_end(struct wcjson *ctx, void *doc, void *arr)
+{
+	stream_end(ctx, doc, false);
+}
+
+/*
+ * Decodes the UTF-8 string b in slices which are written or matched against
+ * the queries as a key. Escape sequences split by a slice are carried over to
+ * the next one.
+ */
+static int
+stream_utf8_string(struct stream *s, const char *b, size_t b_len,
+    bool escaped, bool key)
+{
+	size_t w_len = 0;
+
+	while (b_len > 0 || w_len > 0) {
+		const size_t n = stream_utf8_decode(b, b_len, s->wide,
+		    STREAM_NITEMS, &w_len);
+
+		if (n == (size_t)-1)
+			return -1;
+
+		b += n;
+		b_len -= n;
+
+		size_t m = w_len;
+
+		// Keeps back enough to see every surrogate pair escape in full
+		if (escaped && b_len > 0)
+			m = stream_unescape_slice(s->wide, w_len, w_len - 11);
+
+		if (key)
+			stream_key_part(s, s->wide, m, escaped);
+		else if (stream_string(s, s->wide, m, escaped) < 0)
+			return -1;
+
+		wmemmove(s->wide, &s->wide[m], w_len - m);
+		w_len -= m;
+	}
+
+	return 0;
+}
+
+static void *
+stream_string_token(struct wcjson *ctx, struct stream *s, const void *str,
+    const size_t len, const bool escaped, const bool utf8)
+{
+	const bool key = s->depth > 0 && s->frames[s->depth - 1].object &&
+	    s->frames[s->depth - 1].key;
+	enum stream_action act = STREAM_WRITE;
+
+	if (key && !s->selected) {
+		stream_key_start(s);
+
+		if (utf8) {
+			if (stream_utf8_string(s, str, len, escaped, true) < 0)
+				return stream_err(ctx, s);
+		} else
+			stream_key_part(s, str, len, escaped);
+
+		stream_key_end(s);
+	} else if ((key ? stream_sep(s) : stream_value(s, &act)) < 0)
+		return stream_err(ctx, s);
+
+	if (key)
+		s->frames[s->depth - 1].key = false;
+
+	if (act != STREAM_WRITE || (key && !s->selected))
+		return s;
+
+	if (stream_put(s, L"\"", 1) < 0 ||
+	    (utf8 ? stream_utf8_string(s, str, len, escaped, false) :
+	    stream_string(s, str, len, escaped)) < 0 ||
+	    stream_put(s, key ? L"\":" : L"\"", key ? 2 : 1) < 0 ||
+	    stream_done(s) < 0)
+		return stream_err(ctx, s);
+
+	return s;
+}
+
+static void *
+stream_string_value(struct wcjson *ctx, void *doc, const wchar_t *str,
+    const size_t len, const bool escaped)
+{
+	return stream_string_token(ctx, doc, str, len, escaped, false);
+}
+
+static void *
+stream_utf8_string_value(struct wcjson *ctx, void *doc, const char *str,
+    const size_t len, const bool escaped)
+{
+	return stream_string_token(ctx, doc, str, len, escaped, true);
+}
+
+static void *
+stream_number_value(struct wcjson *ctx, void *doc, const wchar_t *num,
+    const size_t len)
+{
+	struct stream *s = doc;
+	enum stream_action act;
+
+	if (stream_value(s, &act) < 0)
+		return stream_err(ctx, s);
+
+	if (act == STREAM_WRITE && (stream_put(s, num, len) < 0 ||
+	    stream_done(s) < 0))
+		return stream_err(ctx, s);
+
+	return s;
+}
+
+static void *
+stream_utf8_number_value(struct wcjson *ctx, void *doc, const char *num,
+    size_t len)
+{
+	struct stream *s = doc;
+	enum stream_action act;
+
+	if (stream_value(s, &act) < 0)
+		return stream_err(ctx, s);
+
+	if (act != STREAM_WRITE)
+		return s;
+
+	// Numbers consist of ASCII characters only
+	while (len > 0) {
+		const size_t n = len < STREAM_NITEMS ? len : STREAM_NITEMS;
+
+		for (size_t i = 0; i < n; i++)
+			s->wide[i] = (wchar_t)num[i];
+
+		if (stream_put(s, s->wide, n) < 0)
+			return stream_err(ctx, s);
+
+		num += n;
+		len -= n;
+	}
+
+	if (stream_done(s) < 0)
+		return stream_err(ctx, s);
+
+	return s;
+}
+
+static void *
+stream_bool_value(struct wcjson *ctx, void *doc, const bool value)
+{
+	struct stream *s = doc;
+	enum stream_action act;
+
+	if (stream_value(s, &act) < 0)
+		return stream_err(ctx, s);
+
+	if (act == STREAM_WRITE && (stream_put(s, value ? L"true" : L"false",
+	    value ? 4 : 5) < 0 || stream_done(s) < 0))
+		return stream_err(ctx, s);
+
+	return s;
+}
+
+static void *
+stream_null_value(struct wcjson *ctx, void *doc)
+{
+	struct stream *s = doc;
+	enum stream_action act;
+
+	if (stream_value(s, &act) < 0)
+		return stream_err(ctx, s);
+
+	if (act == STREAM_WRITE && (stream_put(s, L"null", 4) < 0 ||
+	    stream_done(s) < 0))
+		return stream_err(ctx, s);
+
+	return s;
+}
+
+static const struct wcjson_ops stream_ops = {
+	.object_start = stream_object_start,
+	.object_add = stream_object_add,
+	.object_end = stream_object_end,
+	.array_start = stream_array_start,
+	.array_add = stream_array_add,
+	.array_end = stream_array_end,
+	.string_value = stream_string_value,
+	.number_value = stream_number_value,
+	.bool_value = stream_bool_value,
+	.null_value = stream_null_value,
+};
+
+static const struct wcjson_utf8_ops stream_utf8_ops = {
+	.object_start = stream_object_start,
+	.object_add = stream_object_add,
+	.object_end = stream_object_end,
+	.array_start = stream_array_start,
+	.array_add = stream_array_add,
+	.array_end = stream_array_end,
+	.string_value = stream_utf8_string_value,
+	.number_value = stream_utf8_number_value,
+	.bool_value = stream_bool_value,
+	.null_value = stream_null_value,
+};
+
+/*
+ * Parses the JSON pointer p into query q taking memory from arena. Reference
+ * tokens are unescaped in place.
+ */
+static int
+query_parse(struct wcjson_arena *arena, const char *p, struct query *q)
+{
+	size_t len = mbstowcs(NULL, p, 0), t = 0;
+	wchar_t *w;
+
+	if (len == (size_t)-1)
+		return -1;
+
+	if ((w = wcjson_arena_alloc(arena, len + 1, sizeof(wchar_t))) == NULL)
+		return -1;
+
+	mbstowcs(w, p, len + 1);
+
+	if (len > 0 && w[0] != L'/')
+		goto err_inval;
+
+	q->t_nitems = 0;
+
+	for (size_t i = 0; i < len; i++)
+		if (w[i] == L'/')
+			q->t_nitems++;
+
+	q->tokens = wcjson_arena_alloc(arena, q->t_nitems,
+	    sizeof(struct query_token));
+
+	if (q->tokens == NULL)
+		return -1;
+
+	for (size_t i = 1; t < q->t_nitems; i++, t++) {
+		struct query_token *tok = &q->tokens[t];
+		wchar_t *d = &w[i];
+
+		tok->s = d;
+
+		for (; i < len && w[i] != L'/'; i++) {
+			if (w[i] == L'~') {
+				if (i + 1 == len || (w[i + 1] != L'0' &&
+				    w[i + 1] != L'1'))
+					goto err_inval;
+
+				*d++ = w[++i] == L'0' ? L'~' : L'/';
+			} else
+				*d++ = w[i];
+		}
+
+		tok->len = (size_t)(d - tok->s);
+		tok->index = 0;
+		tok->is_index = tok->len > 0 &&
+		    (tok->s[0] != L'0' || tok->len == 1);
+
+		for (size_t j = 0; j < tok->len && tok->is_index; j++) {
+			const size_t digit = (size_t)(tok->s[j] - L'0');
+
+			if (tok->s[j] < L'0' || tok->s[j] > L'9' ||
+			    tok->index > (SIZE_MAX - digit) / 10)
+				tok->is_index = false;
+			else
+				tok->index = tok->index * 10 + digit;
+		}
+	}
+
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Writes the JSON text json, or the UTF-8 encoded JSON text utf8 if not NULL,
+ * of len items to f while parsing it, keeping nothing but a frame per nesting
+ * level taken from the remaining memory of arena. Given
+ * queries, writes the selected values only, one per line, and skips all
+ * subtrees not leading to one.
+ */
+static int
+stream_print(struct wcjson *ctx, struct wcjson_arena *arena, FILE *f,
+    const wchar_t *json, const char *utf8, size_t len,
+    const struct query *queries, size_t q_nitems)
+{
+	struct stream s = {
+		.f = f,
+		.queries = queries,
+		.q_nitems = q_nitems,
+		.selected = q_nitems == 0,
+	};
+
+	s.frames = wcjson_arena_tail(arena, sizeof(struct stream_frame),
+	    &s.f_nitems);
+
+	if (s.frames == NULL) {
+		ctx->status = WCJSON_ABORT_ERROR;
+		ctx->errnum = errno;
+		return -1;
+	}
+
+	if (utf8 != NULL ? wcjsonutf8(ctx, &stream_utf8_ops, &s, utf8, len) < 0 :
+	    wcjson(ctx, &stream_ops, &s, json, len) < 0)
+		return -1;
+
+	return stream_flush(&s);
 }
 
 int
@@ -86,14 +1314,19 @@ main(int argc, char *argv[])
 {
 	int ch;
 	char *i = NULL, *o = NULL, *ep = NULL;
-	size_t limit = CLI_DEFAULT_LIMIT, len, total_bytes = 0;
+	size_t limit = CLI_DEFAULT_LIMIT, len = 0;
 	FILE *in = stdin, *out = stdout;
-	wchar_t *json = NULL, *strings = NULL, *esc = NULL, *outb = NULL;
-	char *mbstrings = NULL;
-	struct wcjson_value *values = NULL;
+	wchar_t *json = NULL, *outb = NULL;
+	char *utf8 = NULL;
+	const char *q_args[QUERY_MAX];
+	struct query queries[QUERY_MAX];
+	size_t q_nitems = 0;
+	void *block = NULL;
+	struct wcjson_arena arena = WCJSON_ARENA_INITIALIZER;
+	struct wcjson_document doc = WCJSON_DOCUMENT_INITIALIZER;
+	struct report rep = {.runs = 1};
 	struct optparse options = {0};
-	void *p;
-	wint_t wc;
+	double t;
 #ifdef HAVE_SETLOCALE
 	char *locale;
 	char *d = NULL, *e = NULL;
@@ -104,9 +1337,9 @@ main(int argc, char *argv[])
 	options.permute = 0;
 
 #ifdef HAVE_SETLOCALE
-	while ((ch = optparse(&options, "i:o:d:e:m:ar")) != -1) {
+	while ((ch = optparse(&options, "i:o:d:e:m:n:q:asrj")) != -1) {
 #else
-	while ((ch = optparse(&options, "i:o:m:ar")) != -1) {
+	while ((ch = optparse(&options, "i:o:m:n:q:asrj")) != -1) {
 #endif
 		switch (ch) {
 		case 'i':
@@ -146,10 +1379,38 @@ main(int argc, char *argv[])
 			else if (ep[0] != '\0')
 				usage();
 
+			break;
+		case 'n':
+			errno = 0;
+			const long long n = strtoll(options.optarg, &ep, 0);
+
+			if (errno != 0) {
+				perror(options.optarg);
+				usage();
+			}
+
+			if (n <= 0 || (unsigned long long)n > ULONG_MAX ||
+			    ep[0] != '\0')
+				usage();
+
+			rep.runs = (unsigned long)n;
 			break;
 		case 'a':
 			ascii = 1;
 			break;
+		case 's':
+			stream = 1;
+			break;
+		case 'q':
+			if (q_nitems == QUERY_MAX)
+				usage();
+
+			q_args[q_nitems++] = options.optarg;
+			stream = 1;
+			break;
+		case 'j':
+			report_json = 1;
+			/* FALLTHROUGH */
 		case 'r':
 			report = 1;
 			break;
@@ -163,14 +1424,20 @@ main(int argc, char *argv[])
 	if (argc || *argv)
 		usage();
 
+	if (stream && report)
+		usage();
+
+	// The first of several runs warms up and is not timed
+	rep.timed = rep.runs > 1 ? rep.runs - 1 : 1;
+
 #ifdef HAVE_SETLOCALE
 	locale = setlocale(LC_CTYPE, d != NULL ? d : "");
 	if (locale == NULL) {
 		errno = EINVAL;
 		goto err;
 	}
-	if (report)
-		fprintf(stdout, "Input locale: %s\n", locale);
+
+	snprintf(rep.in_locale, sizeof(rep.in_locale), "%s", locale);
 #endif
 
 	if (i != NULL)
@@ -179,169 +1446,65 @@ main(int argc, char *argv[])
 	if (in == NULL)
 		goto err;
 
-	size_t json_len = limit / sizeof(wchar_t);
-
-	if (json_len == 0) {
-		errno = ENOMEM;
-		goto err;
-	}
-
-	json = calloc(json_len, sizeof(wchar_t));
-
-	if (json == NULL)
-		goto err;
-
-	for (len = 0, wc = getwc(in); len < json_len && wc != WEOF;
-	    wc = getwc(in))
-		json[len++] = (wchar_t)wc;
-
-	if (ferror(in))
-		goto err;
-
-	if (wc != WEOF) {
-		errno = ENOMEM;
-		goto err;
-	}
-
-	if ((p = realloc(json, len * sizeof(wchar_t))) == NULL)
-		goto err;
-
-	json = p;
-
-	if (report) {
-		total_bytes += len * sizeof(wchar_t);
-		fprintf(stdout, "Input characters: %zu\n", len);
-		fprintf(stdout, "Input characters (byte): %zu\n",
-		    len * sizeof(wchar_t));
-	}
-
-	limit -= sizeof(wchar_t) * len;
-
-	size_t v_nitems = limit / sizeof(struct wcjson_value);
-
-	if (v_nitems == 0) {
-		errno = ENOMEM;
-		goto err;
-	}
-
-	values = calloc(v_nitems, sizeof(struct wcjson_value));
-
-	if (values == NULL)
-		goto err;
-
-	struct wcjson_document doc = WCJSON_DOCUMENT_INITIALIZER;
-	doc.values = values;
-	doc.v_nitems = v_nitems;
-	doc.v_next = 0;
-
-	int r = wcjsondocvalues(&wcjson, &doc, json, len);
-
-	if (report) {
-		fprintf(stdout, "Values: %zu\n", doc.v_nitems_cnt);
-		fprintf(stdout, "Values (byte): %zu\n",
-		    doc.v_nitems_cnt * sizeof(struct wcjson_value));
-
-		fprintf(stdout, "Wide string characters: %zu\n",
-		    doc.s_nitems_cnt);
-
-		fprintf(stdout, "Wide string characters (byte): %zu\n",
-		    doc.s_nitems_cnt * sizeof(wchar_t));
-
-		total_bytes += doc.s_nitems_cnt * sizeof(wchar_t);
-		total_bytes += doc.v_nitems_cnt * sizeof(struct wcjson_value);
-	}
-
-	if (r < 0) {
-		if (wcjson.errnum == ERANGE)
-			wcjson.errnum = ENOMEM;
-
-		goto err;
-	}
-
-	if ((p = realloc(values,
-	    doc.v_nitems_cnt * sizeof(struct wcjson_value))) == NULL)
-		goto err;
-
-	values = p;
-	doc.values = values;
-	doc.v_nitems = doc.v_nitems_cnt;
-
-	limit -= sizeof(struct wcjson_value) * doc.v_nitems_cnt;
-
-	size_t s_nitems = limit / sizeof(wchar_t);
-
-	if (s_nitems < doc.s_nitems_cnt) {
-		errno = ENOMEM;
-		goto err;
+	if (wcjson_arena_map(&arena, limit) < 0) {
+		if (errno != ENOSYS || (block = malloc(limit)) == NULL ||
+		    wcjson_arena_init(&arena, block, limit) < 0)
+			goto err;
 	}
 
-	strings = calloc(doc.s_nitems_cnt, sizeof(wchar_t));
+	for (size_t n = 0; n < q_nitems; n++)
+		if (query_parse(&arena, q_args[n], &queries[n]) < 0)
+			goto err;
 
-	if (strings == NULL)
-		goto err;
+	t = now();
 
-	doc.strings = strings;
-	doc.s_nitems = doc.s_nitems_cnt;
-	doc.s_next = 0;
+	// Streaming parses UTF-8 input from its mapping without decoding it
+	if (stream && (utf8 = in_map(in, &len)) != NULL)
+		rep.in_bytes = len;
 
-	if (wcjsondocstrings(&wcjson, &doc) < 0)
+	if (utf8 == NULL &&
+	    (json = in_read(in, &arena, &len, &rep.in_bytes)) == NULL)
 		goto err;
 
-	if (report) {
-		total_bytes += doc.mb_nitems_cnt * sizeof(char);
-		total_bytes += doc.e_nitems_cnt * sizeof(wchar_t);
-		fprintf(stdout, "Multibyte string characters: %zu\n",
-		    doc.mb_nitems_cnt);
-
-		fprintf(stdout, "Multibyte string  characters (byte): %zu\n",
-		    doc.mb_nitems_cnt * sizeof(char));
+	rep.secs[PHASE_DECODE] = now() - t;
+	rep.in_nitems = len;
 
-		fprintf(stdout, "Escape sequence characters: %zu\n",
-		    doc.e_nitems_cnt);
+	const size_t in_next = arena.next;
 
-		fprintf(stdout, "Escape sequence characters (byte): %zu\n",
-		    doc.e_nitems_cnt * sizeof(wchar_t));
+	// Streaming parses while writing output
+	for (unsigned long run = 0; !stream && run < (report ? rep.runs : 1);
+	    run++) {
+		arena.next = in_next;
+		doc = (struct wcjson_document)WCJSON_DOCUMENT_INITIALIZER;
+		wcjson = (struct wcjson)WCJSON_INITIALIZER;
 
-	}
-
-	limit -= doc.s_nitems_cnt * sizeof(wchar_t);
+		t = now();
 
-	size_t mb_nitems = limit / sizeof(char);
-
-	if (mb_nitems < doc.mb_nitems_cnt) {
-		errno = ENOMEM;
-		goto err;
-	}
+		int r = wcjsondocarenavalues(&wcjson, &arena, &doc, json, len);
 
-	mbstrings = calloc(doc.mb_nitems_cnt, sizeof(char));
+		t = lap(&rep, PHASE_VALUES, t, run);
+		rep.v_nitems = doc.v_nitems_cnt;
+		rep.s_nitems = doc.s_nitems_cnt;
 
-	if (mbstrings == NULL)
-		goto err;
+		if (r < 0) {
+			if (wcjson.errnum == ERANGE)
+				wcjson.errnum = ENOMEM;
 
-	doc.mbstrings = mbstrings;
-	doc.mb_nitems = doc.mb_nitems_cnt;
-	doc.mb_next = 0;
+			goto err;
+		}
 
-	if (wcjsondocmbstrings(&wcjson, &doc) < 0)
-		goto err;
+		if (wcjsondocarenastrings(&wcjson, &arena, &doc) < 0)
+			goto err;
 
-	limit -= doc.mb_nitems_cnt * sizeof(char);
+		t = lap(&rep, PHASE_STRINGS, t, run);
 
-	size_t e_nitems = limit / sizeof(wchar_t);
+		if (wcjsondocarenambstrings(&wcjson, &arena, &doc) < 0)
+			goto err;
 
-	if (e_nitems < doc.e_nitems_cnt) {
-		errno = ENOMEM;
-		goto err;
+		lap(&rep, PHASE_MBSTRINGS, t, run);
+		rep.mb_nitems = doc.mb_nitems_cnt;
 	}
 
-	esc = calloc(doc.e_nitems_cnt, sizeof(wchar_t));
-
-	if (esc == NULL)
-		goto err;
-
-	doc.esc = esc;
-	doc.e_nitems = doc.e_nitems_cnt;
-
 #ifdef HAVE_SETLOCALE
 	locale = setlocale(LC_CTYPE, e != NULL ? e : "");
 
@@ -350,53 +1513,57 @@ main(int argc, char *argv[])
 		goto err;
 	}
 
-	if (report)
-		fprintf(stdout, "Output locale: %s\n", locale);
+	snprintf(rep.out_locale, sizeof(rep.out_locale), "%s", locale);
 #endif
 
 	if (o != NULL && !report && (out = fopen(o, "w")) == NULL)
 		goto err;
 
-	if (report) {
-		limit -= doc.e_nitems_cnt * sizeof(wchar_t);
-		size_t o_nitems = limit / sizeof(wchar_t);
-
-		if (o_nitems == 0) {
-			errno = ENOMEM;
-			goto err;
-		}
+	// Bytes are written without converting through the locale if possible
+	out_init();
+	doc.mb_utf8 = out_utf8;
 
-		outb = calloc(o_nitems, sizeof(wchar_t));
+	// Output is encoded in bulk to byte oriented streams only
+	fwide(out, -1);
 
-		if (outb == NULL)
+	if (stream) {
+		if (stream_print(&wcjson, &arena, out, json, utf8, len,
+		    queries, q_nitems) < 0)
 			goto err;
+	} else if (report) {
+		const size_t doc_next = arena.next;
+		size_t o_nitems = 0;
 
-		if (ascii) {
-			if (wcjsondocsprintasc(outb, &o_nitems, &doc,
-			    doc.values) < 0) {
-
-				if (errno == ERANGE)
-					errno = ENOMEM;
+		for (unsigned long run = 0; run < rep.runs; run++) {
+			arena.next = doc_next;
+			outb = wcjson_arena_tail(&arena, sizeof(wchar_t),
+			    &o_nitems);
 
+			if (outb == NULL)
 				goto err;
-			}
-		} else {
-			if (wcjsondocsprint(outb, &o_nitems, &doc, doc.values) <
-			    0) {
+
+			t = now();
+
+			if ((ascii ? wcjsondocsprintasc(outb, &o_nitems, &doc,
+			    doc.values) : wcjsondocsprint(outb, &o_nitems, &doc,
+			    doc.values)) < 0) {
 
 				if (errno == ERANGE)
 					errno = ENOMEM;
 
 				goto err;
 			}
+
+			lap(&rep, PHASE_SERIALIZE, t, run);
 		}
 
-		total_bytes += o_nitems * sizeof(wchar_t);
-		fprintf(stdout, "Output characters: %zu\n", o_nitems);
-		fprintf(stdout, "Output characters (byte): %zu\n",
-		    o_nitems * sizeof(wchar_t));
+		rep.o_nitems = o_nitems;
+
+		if (wcjson_arena_shrink(&arena, outb, o_nitems + 1,
+		    sizeof(wchar_t)) < 0)
+			goto err;
 
-		fprintf(stdout, "Free memory (byte): %zu\n", limit);
+		rep.free_bytes = wcjson_arena_remaining(&arena);
 	} else if (ascii) {
 		if (wcjsondocfprintasc(out, &doc, doc.values) < 0)
 			goto err;
@@ -410,14 +1577,11 @@ main(int argc, char *argv[])
 		goto err;
 
 	if (report)
-		fprintf(stdout, "Total bytes: %zu\n", total_bytes);
-
-	free(json);
-	free(values);
-	free(strings);
-	free(mbstrings);
-	free(esc);
-	free(outb);
+		report_print(stdout, &rep);
+
+	in_unmap(utf8, len);
+	wcjson_arena_unmap(&arena);
+	free(block);
 	fclose(in);
 	fclose(out);
 	return 0;
@@ -427,12 +1591,12 @@ err:
 		wcjson.errnum = errno;
 	}
 
-	free(json);
-	free(values);
-	free(strings);
-	free(mbstrings);
-	free(esc);
-	free(outb);
+	if (report)
+		report_print(stdout, &rep);
+
+	in_unmap(utf8, len);
+	wcjson_arena_unmap(&arena);
+	free(block);
 
 	if (in != NULL)
 		fclose(in);
@@ -23,14 +23,83 @@ extern "C" {
 #endif
 
 #include <errno.h>
+#include <locale.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#endif
+
+#if defined(HAVE_SYS_MMAN_H)
+#include <sys/mman.h>
+#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+#define MAP_ANONYMOUS MAP_ANON
+#endif
+#endif
+
+#if defined(HAVE_SYS_STAT_H)
+#include <sys/stat.h>
+#endif
+
+#if defined(HAVE_UNISTD_H)
+#include <unistd.h>
+#elif defined(_WIN32)
+#include <io.h>
+#define write(fd, b, len) _write((fd), (b), (unsigned int)(len))
+typedef int ssize_t;
+#endif
+
+#if defined(HAVE_PTHREAD_H)
+#include <pthread.h>
+#define DOC_LOCK pthread_mutex_t
+#define doc_lock_init(l) pthread_mutex_init((l), NULL)
+#define doc_lock_destroy(l) pthread_mutex_destroy((l))
+#define doc_lock(l) pthread_mutex_lock((l))
+#define doc_unlock(l) pthread_mutex_unlock((l))
+#define DOC_THREAD pthread_t
+#define DOC_THREAD_RESULT void *
+#define DOC_THREAD_EXIT NULL
+#define doc_thread_create(t, fn, arg)					\
+  (pthread_create((t), NULL, (fn), (arg)) == 0 ? 0 : -1)
+#define doc_thread_join(t) pthread_join((t), NULL)
+#elif defined(_WIN32)
+#define DOC_LOCK SRWLOCK
+#define doc_lock_init(l) (InitializeSRWLock((l)), 0)
+#define doc_lock_destroy(l) ((void)(l))
+#define doc_lock(l) AcquireSRWLockExclusive((l))
+#define doc_unlock(l) ReleaseSRWLockExclusive((l))
+#define DOC_THREAD HANDLE
+#define DOC_THREAD_RESULT DWORD WINAPI
+#define DOC_THREAD_EXIT 0
+#define doc_thread_create(t, fn, arg)					\
+  ((*(t) = CreateThread(NULL, 0, (fn), (arg), 0, NULL)) != NULL ? 0 : -1)
+#define doc_thread_join(t)						\
+  (WaitForSingleObject((t), INFINITE), CloseHandle((t)))
+#else
+/* Pools cannot be shared without locks, so creating them fails */
+#define DOC_LOCK int
+#define doc_lock_init(l) ((void)(l), ENOSYS)
+#define doc_lock_destroy(l) ((void)(l))
+#define doc_lock(l) ((void)(l))
+#define doc_unlock(l) ((void)(l))
+#define DOC_THREAD int
+#define DOC_THREAD_RESULT void *
+#define DOC_THREAD_EXIT NULL
+#define doc_thread_create(t, fn, arg) ((void)(t), (void)(fn), (void)(arg), -1)
+#define doc_thread_join(t) ((void)(t))
+#endif
+
 #include <wcjson-document.h>
+#include <wcjson-ryu.h>
 
 #define MAX(a, b) ((a) > (b) ? (a) : (b))
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
 
 #define VALUE_IS_VALID(v)						\
   ((v)->is_null || (v)->is_boolean || (v)->is_array || (v)->is_object ||\
@@ -39,6 +108,175 @@ extern "C" {
 
 #define VALUE_IS_CHILD(v) ((v)->prev_idx != 0 || (v)->next_idx != 0)
 
+#define DOC_ALLOCATOR(d)						\
+  ((d)->allocator != NULL ? (d)->allocator : wcjson_allocator_default)
+
+/* FNV-1a parameters and type seeds of value hashes */
+#define DOC_HASH_BASIS 0xcbf29ce484222325ULL
+#define DOC_HASH_PRIME 0x100000001b3ULL
+#define DOC_HASH_SEED(c) (DOC_HASH_BASIS ^ (uint64_t)(c))
+
+/* Multiplier of the displacements of key set slots */
+#define DOC_KEYSET_DISPLACE 0x9e3779b97f4a7c15ULL
+
+/* Largest number of keys of a key set sharing a bucket */
+#define DOC_KEYSET_BUCKET 16
+
+/* Number of displacements tried for each bucket of a key set */
+#define DOC_KEYSET_TRIES 65536
+
+/* Number of items needed to format any double or 64-bit integer */
+#define DOC_NUMBER_NITEMS 32
+
+/* Number of object members compared without allocating memory */
+#define DOC_EQUAL_NITEMS 16
+
+/* Number of nesting levels traversed without allocating memory */
+#define DOC_WALK_DEPTH 64
+
+/* Number of characters buffered before encoding and writing output */
+#define DOC_OUT_NITEMS 4096
+
+/* Number of bytes encoded at once when writing output */
+#define DOC_OUT_BYTES 4096
+
+/* Number of characters escaped at once when a writer resumes a call */
+#define DOC_WRITER_NITEMS (16 * WCJSON_ESCAPE_MAX)
+
+/* Flags of the containers on the depth stack of a writer */
+#define DOC_WRITER_OBJECT 0x1
+#define DOC_WRITER_MEMBER 0x2
+#define DOC_WRITER_KEY 0x4
+
+/* Number of characters of keys unescaped for matching bindings */
+#define DOC_BIND_KEY_NITEMS 128
+
+/* Number of bytes of numbers converted by strtod */
+#define DOC_BIND_NUMBER_NITEMS 512
+
+/* Largest number of threads working on the ranges of a document */
+#define DOC_THREADS_MAX 64
+
+struct doc_out {
+	wchar_t *buf;
+	size_t nitems;
+	size_t pos;
+	int (*sink)(void *ctx, const wchar_t *s, size_t len);
+	void *sink_ctx;
+	bool terminate;
+	bool asc;
+};
+
+struct doc_member {
+	uint64_t hash;
+	const struct wcjson_value *pair;
+};
+
+struct doc_out_file {
+	FILE *f;
+	int fd;
+	mbstate_t mbs;
+	bool utf8;
+};
+
+struct arena_align {
+	char c;
+	union {
+		long double ld;
+		long long ll;
+		void *p;
+	} u;
+};
+
+/* Alignment of memory handed out by an arena */
+#define ARENA_ALIGN offsetof(struct arena_align, u)
+
+/* Number of documents returned to a pool per high-water mark period */
+#define DOC_POOL_PERIOD 64
+
+/* Snapshot file identification and format version */
+#define DOC_SNAPSHOT_MAGIC "WCJSONDS"
+#define DOC_SNAPSHOT_VERSION 1
+
+/* Number of values relocated at once when saving a snapshot */
+#define DOC_SNAPSHOT_NITEMS 64
+
+struct doc_snapshot {
+	char magic[8];
+	uint32_t version;
+	uint32_t byte_order;
+	uint32_t wchar_size;
+	uint32_t value_size;
+	uint32_t size_size;
+	uint32_t mb_utf8;
+	uint64_t v_nitems;
+	uint64_t s_nitems;
+	uint64_t mb_nitems;
+	uint64_t s_off;
+	uint64_t mb_off;
+	uint64_t size;
+};
+
+/* Offset of the values following the header of a snapshot */
+#define DOC_SNAPSHOT_VALUES						\
+  ((sizeof(struct doc_snapshot) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct doc_pool_entry {
+	struct wcjson_document doc;
+	struct doc_pool_entry *next;
+};
+
+struct wcjson_document_pool {
+	DOC_LOCK lock;
+	const struct wcjson_allocator *allocator;
+	struct doc_pool_entry *free;
+	size_t v_nitems;
+	size_t s_nitems;
+	size_t mb_nitems;
+	size_t v_hw;
+	size_t s_hw;
+	size_t mb_hw;
+	size_t v_min;
+	size_t s_min;
+	size_t mb_min;
+	size_t puts;
+};
+
+struct doc_walk_ops {
+	int (*value)(void *arg, const struct wcjson_document *doc,
+	    const struct wcjson_value *v);
+	int (*next)(void *arg, const struct wcjson_document *doc,
+	    const struct wcjson_value *v);
+	int (*end)(void *arg, const struct wcjson_document *doc,
+	    const struct wcjson_value *v);
+};
+
+struct doc_task {
+	int (*run)(void *task);
+	int errnum;
+};
+
+struct doc_range {
+	struct doc_task task;
+	struct wcjson_document *doc;
+	size_t v_begin;
+	size_t v_end;
+	size_t next;
+	size_t nitems;
+	size_t nitems_cnt;
+};
+
+struct doc_subtrees {
+	struct doc_task task;
+	const struct wcjson_document *doc;
+	const struct wcjson_value *head;
+	size_t count;
+	bool first;
+	bool asc;
+	wchar_t *d;
+	size_t d_len;
+};
+
 static void *doc_object_start(struct wcjson *, void *, void *);
 static void doc_object_add(struct wcjson *, void *, void *, void *, void *);
 static void doc_object_end(struct wcjson *, void *, void *);
@@ -52,6 +290,12 @@ static void *doc_string_value(struct wcjson *, void *, const wchar_t *,
 
 static void *doc_number_value(struct wcjson *, void *, const wchar_t *,
     const size_t);
+static int doc_mbstring(struct wcjson_document *, struct wcjson_value *);
+static void *doc_allocate(void *, size_t);
+static void *doc_reallocate(void *, void *, size_t);
+static void doc_deallocate(void *, void *);
+static void doc_sort(const void *, size_t *, const size_t,
+    int (*)(const void *, size_t, size_t));
 
 const struct wcjson_ops *const wcjson_document_ops = &(const struct wcjson_ops){
     .object_start = doc_object_start,
@@ -66,10 +310,45 @@ const struct wcjson_ops *const wcjson_document_ops = &(const struct wcjson_ops){
     .null_value = doc_null_value,
 };
 
+const struct wcjson_allocator *const wcjson_allocator_default =
+    &(const struct wcjson_allocator){
+	.allocate = doc_allocate,
+	.reallocate = doc_reallocate,
+	.deallocate = doc_deallocate,
+	.ctx = NULL,
+};
+
+static void *
+doc_allocate(void *ctx, size_t size)
+{
+	return malloc(size);
+}
+
+static void *
+doc_reallocate(void *ctx, void *p, size_t size)
+{
+	return realloc(p, size);
+}
+
+static void
+doc_deallocate(void *ctx, void *p)
+{
+	free(p);
+}
+
 static struct wcjson_value *
 wcjson_document_nextv(struct wcjson_document *doc,
     const bool maybe_null)
 {
+	size_t idx;
+
+	if (!maybe_null && doc->v_free != 0) {
+		// Reuse a slot released by wcjson_value_free
+		idx = doc->v_free - 1;
+		doc->v_free = doc->values[idx].next_idx;
+		goto init;
+	}
+
 	if (doc->v_nitems_cnt == SIZE_MAX)
 		goto err_range;
 
@@ -81,7 +360,9 @@ wcjson_document_nextv(struct wcjson_document *doc,
 	if (doc->v_next == SIZE_MAX || doc->v_next == doc->v_nitems)
 		goto err_range;
 
-	struct wcjson_value *v = &doc->values[doc->v_next];
+	idx = doc->v_next++;
+init:;
+	struct wcjson_value *v = &doc->values[idx];
 	v->is_null = 0;
 	v->is_boolean = 0;
 	v->is_true = 0;
@@ -94,7 +375,7 @@ wcjson_document_nextv(struct wcjson_document *doc,
 	v->s_len = 0;
 	v->mbstring = NULL;
 	v->mb_len = 0;
-	v->idx = doc->v_next++;
+	v->idx = idx;
 	v->head_idx = 0;
 	v->tail_idx = 0;
 	v->prev_idx = 0;
@@ -180,6 +461,329 @@ err_range:
 	return NULL;
 }
 
+static const char doc_digits[] =
+    "000102030405060708091011121314151617181920212223242526272829303132333435"
+    "363738394041424344454647484950515253545556575859606162636465666768697071"
+    "72737475767778798081828384858687888990919293949596979899";
+
+static inline uint64_t
+doc_umul128(const uint64_t a, const uint64_t b, uint64_t *hi)
+{
+	const uint64_t a_lo = a & 0xffffffffU, a_hi = a >> 32;
+	const uint64_t b_lo = b & 0xffffffffU, b_hi = b >> 32;
+	const uint64_t p00 = a_lo * b_lo, p01 = a_lo * b_hi;
+	const uint64_t p10 = a_hi * b_lo, p11 = a_hi * b_hi;
+	const uint64_t mid1 = p10 + (p00 >> 32);
+	const uint64_t mid2 = p01 + (mid1 & 0xffffffffU);
+
+	*hi = p11 + (mid1 >> 32) + (mid2 >> 32);
+	return (mid2 << 32) | (p00 & 0xffffffffU);
+}
+
+/* Upper bits of m times the 128-bit mul, shifted right by j > 64 */
+static inline uint64_t
+doc_mulshift(const uint64_t m, const uint64_t *mul, const int j)
+{
+	uint64_t hi0, hi1;
+	const uint64_t lo1 = doc_umul128(m, mul[1], &hi1);
+
+	(void)doc_umul128(m, mul[0], &hi0);
+
+	const uint64_t sum = hi0 + lo1;
+
+	if (sum < hi0)
+		hi1++;
+
+	return (hi1 << (128 - j)) | (sum >> (j - 64));
+}
+
+static inline int
+doc_pow5bits(const int e)
+{
+	return (int)(((uint32_t)e * 1217359) >> 19) + 1;
+}
+
+static inline bool
+doc_pow5_multiple(uint64_t v, const int p)
+{
+	int n = 0;
+
+	while (v % 5 == 0) {
+		v /= 5;
+		n++;
+	}
+
+	return n >= p;
+}
+
+static inline bool
+doc_pow2_multiple(const uint64_t v, const int p)
+{
+	return (v & ((UINT64_C(1) << p) - 1)) == 0;
+}
+
+/*
+ * Computes the shortest decimal m times 10 raised to the returned exponent
+ * converting back to the positive finite double with the given bits and
+ * closest to it of all such decimals (Ryu).
+ */
+static int
+doc_ryu(const uint64_t bits, uint64_t *mp)
+{
+	const uint64_t ieee_m = bits & ((UINT64_C(1) << 52) - 1);
+	const int ieee_e = (int)(bits >> 52);
+	const int e2 = (ieee_e == 0 ? 1 : ieee_e) - 1023 - 52 - 2;
+	const uint64_t m2 = ieee_e == 0 ? ieee_m : ieee_m | UINT64_C(1) << 52;
+	const bool even = (m2 & 1) == 0;
+	const uint64_t mv = 4 * m2;
+	const int mm_shift = ieee_m != 0 || ieee_e <= 1;
+	bool vm_zeros = false, vr_zeros = false, round_up = false;
+	uint64_t vr, vp, vm;
+	int e10, removed = 0, last = 0;
+
+	// Scale the interval of decimals rounding to the double by 10^-e10
+	if (e2 >= 0) {
+		const int q = (int)(((uint32_t)e2 * 78913) >> 18) - (e2 > 3);
+		const int j = -e2 + q + DOC_POW5_INV_BITCOUNT +
+		    doc_pow5bits(q) - 1;
+		const uint64_t *mul = doc_pow5_inv_split[q];
+
+		e10 = q;
+		vr = doc_mulshift(mv, mul, j);
+		vp = doc_mulshift(mv + 2, mul, j);
+		vm = doc_mulshift(mv - 1 - (uint64_t)mm_shift, mul, j);
+
+		if (q <= 21) {
+			if (mv % 5 == 0)
+				vr_zeros = doc_pow5_multiple(mv, q);
+			else if (even)
+				vm_zeros = doc_pow5_multiple(mv - 1 -
+				    (uint64_t)mm_shift, q);
+			else
+				vp -= doc_pow5_multiple(mv + 2, q);
+		}
+	} else {
+		const int q = (int)(((uint32_t)-e2 * 732923) >> 20) - (-e2 > 1);
+		const int i = -e2 - q;
+		const int j = q - (doc_pow5bits(i) - DOC_POW5_BITCOUNT);
+		const uint64_t *mul = doc_pow5_split[i];
+
+		e10 = q + e2;
+		vr = doc_mulshift(mv, mul, j);
+		vp = doc_mulshift(mv + 2, mul, j);
+		vm = doc_mulshift(mv - 1 - (uint64_t)mm_shift, mul, j);
+
+		if (q <= 1) {
+			vr_zeros = true;
+
+			if (even)
+				vm_zeros = mm_shift == 1;
+			else
+				vp--;
+		} else if (q < 63)
+			vr_zeros = doc_pow2_multiple(mv, q);
+	}
+
+	// Remove digits while the interval still holds a decimal
+	if (vm_zeros || vr_zeros) {
+		while (vp / 10 > vm / 10) {
+			vm_zeros &= vm % 10 == 0;
+			vr_zeros &= last == 0;
+			last = (int)(vr % 10);
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+
+		while (vm_zeros && vm % 10 == 0) {
+			vr_zeros &= last == 0;
+			last = (int)(vr % 10);
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+
+		// Round half to even if the exact value ends in 50...0
+		if (vr_zeros && last == 5 && vr % 2 == 0)
+			last = 4;
+
+		*mp = vr + ((vr == vm && (!even || !vm_zeros)) || last >= 5);
+	} else {
+		while (vp / 10 > vm / 10) {
+			round_up = vr % 10 >= 5;
+			vr /= 10;
+			vp /= 10;
+			vm /= 10;
+			removed++;
+		}
+
+		*mp = vr + (vr == vm || round_up);
+	}
+
+	return e10 + removed;
+}
+
+/* Writes the decimal digits of val to the end of buf, returning the first */
+static char *
+doc_utoa(char *end, uint64_t val)
+{
+	char *p = end;
+
+	while (val >= 100) {
+		const size_t d = (size_t)(val % 100) * 2;
+
+		val /= 100;
+		*--p = doc_digits[d + 1];
+		*--p = doc_digits[d];
+	}
+
+	if (val >= 10) {
+		*--p = doc_digits[val * 2 + 1];
+		*--p = doc_digits[val * 2];
+	} else
+		*--p = (char)('0' + val);
+
+	return p;
+}
+
+static size_t
+doc_wutoa(wchar_t *s, const uint64_t val)
+{
+	char buf[DOC_NUMBER_NITEMS];
+	const char *p = doc_utoa(&buf[sizeof(buf)], val);
+	size_t len = 0;
+
+	while (p < &buf[sizeof(buf)])
+		s[len++] = (wchar_t)*p++;
+
+	return len;
+}
+
+/*
+ * Formats a finite double like ECMAScript Number.prototype.toString, using
+ * exponential notation for exponents below -6 or above 20.
+ */
+static size_t
+doc_dtoa(wchar_t *s, const double d)
+{
+	char digits[DOC_NUMBER_NITEMS];
+	uint64_t bits, m;
+	size_t len = 0;
+
+	memcpy(&bits, &d, sizeof(bits));
+
+	if (bits >> 63)
+		s[len++] = L'-';
+
+	if ((bits & ~(UINT64_C(1) << 63)) == 0) {
+		s[len++] = L'0';
+		return len;
+	}
+
+	const int exp = doc_ryu(bits & ~(UINT64_C(1) << 63), &m);
+	const char *buf = doc_utoa(&digits[sizeof(digits)], m);
+	const int k = (int)(&digits[sizeof(digits)] - buf);
+	const int n = k + exp;
+
+	if (k <= n && n <= 21) {
+		// ddd000
+		for (int i = 0; i < k; i++)
+			s[len++] = (wchar_t)buf[i];
+
+		for (int i = k; i < n; i++)
+			s[len++] = L'0';
+	} else if (0 < n && n <= 21) {
+		// dd.ddd
+		for (int i = 0; i < k; i++) {
+			if (i == n)
+				s[len++] = L'.';
+
+			s[len++] = (wchar_t)buf[i];
+		}
+	} else if (-6 < n && n <= 0) {
+		// 0.000ddd
+		s[len++] = L'0';
+		s[len++] = L'.';
+
+		for (int i = n; i < 0; i++)
+			s[len++] = L'0';
+
+		for (int i = 0; i < k; i++)
+			s[len++] = (wchar_t)buf[i];
+	} else {
+		// d.ddde+dd
+		s[len++] = (wchar_t)buf[0];
+
+		if (k > 1)
+			s[len++] = L'.';
+
+		for (int i = 1; i < k; i++)
+			s[len++] = (wchar_t)buf[i];
+
+		s[len++] = L'e';
+		s[len++] = n - 1 < 0 ? L'-' : L'+';
+		len += doc_wutoa(&s[len], (uint64_t)(n - 1 < 0 ? 1 - n : n - 1));
+	}
+
+	return len;
+}
+
+/* Copies the formatted number to the strings array before adding its value */
+static struct wcjson_value *
+doc_value_number(struct wcjson_document *doc, const wchar_t *s,
+    const size_t len)
+{
+	const wchar_t *n = wcjson_document_string(doc, s, len);
+
+	if (n == NULL)
+		return NULL;
+
+	return wcjson_value_number(doc, n, len);
+}
+
+struct wcjson_value *
+wcjson_value_double(struct wcjson_document *doc, const double val)
+{
+	wchar_t s[DOC_NUMBER_NITEMS];
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+
+	// No JSON representation of infinities and NaNs
+	if (((bits >> 52) & 0x7ff) == 0x7ff)
+		goto err_inval;
+
+	return doc_value_number(doc, s, doc_dtoa(s, val));
+err_inval:
+	errno = EINVAL;
+	return NULL;
+}
+
+struct wcjson_value *
+wcjson_value_int64(struct wcjson_document *doc, const int64_t val)
+{
+	wchar_t s[DOC_NUMBER_NITEMS];
+	size_t len = 0;
+
+	if (val < 0)
+		s[len++] = L'-';
+
+	len += doc_wutoa(&s[len], val < 0 ? UINT64_C(0) - (uint64_t)val :
+	    (uint64_t)val);
+
+	return doc_value_number(doc, s, len);
+}
+
+struct wcjson_value *
+wcjson_value_uint64(struct wcjson_document *doc, const uint64_t val)
+{
+	wchar_t s[DOC_NUMBER_NITEMS];
+
+	return doc_value_number(doc, s, doc_wutoa(s, val));
+}
+
 struct wcjson_value *
 wcjson_value_object(struct wcjson_document *doc)
 {
@@ -324,6 +928,9 @@ wcjson_array_remove(const struct wcjson_document *doc,
 
 		if (arr->tail_idx == val->idx)
 			arr->tail_idx = val->prev_idx;
+
+		val->prev_idx = 0;
+		val->next_idx = 0;
 	}
 
 	return val;
@@ -400,7 +1007,7 @@ err_inval:
 }
 
 struct wcjson_value *
-wcjson_object_remove(const struct wcjson_document *doc,
+wcjson_object_remove(struct wcjson_document *doc,
     struct wcjson_value *obj, const wchar_t *key, const size_t key_len)
 {
 	struct wcjson_value *v;
@@ -420,7 +1027,15 @@ wcjson_object_remove(const struct wcjson_document *doc,
 			if (obj->tail_idx == v->idx)
 				obj->tail_idx = v->prev_idx;
 
-			return wcjson_value_head(doc, v);
+			struct wcjson_value *val = wcjson_value_head(doc, v);
+
+			// The pair is not visible to callers
+			v->prev_idx = 0;
+			v->next_idx = 0;
+			v->head_idx = 0;
+			v->tail_idx = 0;
+			(void)wcjson_value_free(doc, v);
+			return val;
 		}
 	}
 
@@ -442,793 +1057,4420 @@ wcjson_object_get(const struct wcjson_document *doc,
 	return NULL;
 }
 
-wchar_t *
-wcjson_document_string(struct wcjson_document *doc, const wchar_t *s,
-    const size_t len)
+static inline int
+doc_key_cmp(const wchar_t *a, const size_t a_len, const wchar_t *b,
+    const size_t b_len)
 {
-	size_t dst_len = doc->s_nitems - doc->s_next;
-	wchar_t *dst = &doc->strings[doc->s_next];
-
-	if (len == SIZE_MAX || dst_len < len + 1)
-		goto err_range;
-
-	wchar_t *ret = wcsncpy(dst, s, len);
-	ret[len] = L'\0';
-
-	const size_t s_next = doc->s_next + len + 1;
+	const int r = wmemcmp(a, b, MIN(a_len, b_len));
 
-	if (s_next < doc->s_next || s_next > doc->s_nitems)
-		goto err_range;
+	if (r != 0)
+		return r;
 
-	doc->s_next = s_next;
+	return a_len < b_len ? -1 : a_len > b_len;
+}
 
-	const size_t s_nitems_cnt = doc->s_nitems_cnt + len + 1;
+static inline uint64_t
+doc_hash_mix(uint64_t h)
+{
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
 
-	if (s_nitems_cnt < doc->s_nitems_cnt)
-		goto err_range;
+static inline uint64_t
+doc_hash_string(uint64_t h, const wchar_t *s, const size_t len)
+{
+	for (size_t i = 0; i < len; i++)
+		h = (h ^ (uint32_t)s[i]) * DOC_HASH_PRIME;
 
-	doc->s_nitems_cnt = s_nitems_cnt;
-	return ret;
-err_range:
-	errno = ERANGE;
-	return NULL;
+	return h;
 }
 
-char *
-wcjson_document_mbstring(struct wcjson_document *doc, const char *s,
-    const size_t len)
+/*
+ * Array members are combined in order, object members by adding their pair
+ * hashes, so that the hash of an object does not depend on the member order.
+ */
+uint64_t
+wcjson_value_hash(const struct wcjson_document *doc,
+    const struct wcjson_value *value, uint64_t *hashes)
 {
-	size_t dst_len = doc->mb_nitems - doc->mb_next;
-	char *dst = &doc->mbstrings[doc->mb_next];
+	const struct wcjson_value *v;
+	uint64_t h, c, n = 0;
 
-	if (len == SIZE_MAX || dst_len < len + 1)
-		goto err_range;
+	if (hashes != NULL && hashes[value->idx] != 0)
+		return hashes[value->idx];
 
-	char *ret = strncpy(dst, s, len);
-	ret[len] = '\0';
+	if (!VALUE_IS_VALID(value) || (value->is_pair && value->head_idx == 0))
+		goto err_inval;
 
-	const size_t mb_next = doc->mb_next + len + 1;
+	if (value->is_null)
+		h = DOC_HASH_SEED('n');
+	else if (value->is_boolean)
+		h = DOC_HASH_SEED(value->is_true ? 't' : 'f');
+	else if (value->is_string)
+		h = doc_hash_string(DOC_HASH_SEED('s'), value->string,
+		    value->s_len);
+	else if (value->is_number)
+		h = doc_hash_string(DOC_HASH_SEED('#'), value->string,
+		    value->s_len);
+	else if (value->is_pair) {
+		c = wcjson_value_hash(doc, wcjson_value_head(doc, value),
+		    hashes);
+		if (c == 0)
+			return 0;
+
+		h = doc_hash_string(DOC_HASH_SEED(':'), value->string,
+		    value->s_len);
+		h = (h ^ c) * DOC_HASH_PRIME;
+	} else if (value->is_array) {
+		h = DOC_HASH_SEED('[');
+
+		wcjson_value_foreach(v, doc, value) {
+			if ((c = wcjson_value_hash(doc, v, hashes)) == 0)
+				return 0;
+
+			h = doc_hash_mix(h ^ c);
+			n++;
+		}
 
-	if (mb_next < doc->mb_next || mb_next > doc->mb_nitems)
-		goto err_range;
+		h = (h ^ n) * DOC_HASH_PRIME;
+	} else {
+		h = 0;
 
-	doc->mb_next = mb_next;
+		wcjson_value_foreach(v, doc, value) {
+			if ((c = wcjson_value_hash(doc, v, hashes)) == 0)
+				return 0;
 
-	const size_t mb_nitems_cnt = doc->mb_nitems_cnt + len + 1;
+			h += c;
+			n++;
+		}
 
-	if (mb_nitems_cnt < doc->mb_nitems_cnt)
-		goto err_range;
+		h = (DOC_HASH_SEED('{') ^ h ^ n) * DOC_HASH_PRIME;
+	}
 
-	doc->mb_nitems_cnt = mb_nitems_cnt;
-	return ret;
-err_range:
-	errno = ERANGE;
-	return NULL;
+	// Zero marks hashes not computed yet
+	if ((h = doc_hash_mix(h)) == 0)
+		h = 1;
+
+	if (hashes != NULL)
+		hashes[value->idx] = h;
+
+	return h;
+err_inval:
+	errno = EINVAL;
+	return 0;
 }
 
-static void *
-doc_object_start(struct wcjson *ctx, void *doc, void *parent)
+/* Counts the members of obj equal to the member m of the object in doc */
+static size_t
+doc_equal_count(const struct wcjson_document *doc,
+    const struct wcjson_value *m, const uint64_t *hashes,
+    const struct wcjson_document *obj_doc, const struct wcjson_value *obj,
+    const uint64_t *obj_hashes)
 {
-	const int saved_errno = errno;
-	struct wcjson_document *d = doc;
+	const struct wcjson_value *o;
+	size_t n = 0;
 
-	errno = 0;
-	struct wcjson_value *v = wcjson_document_nextv(d, true);
+	wcjson_value_foreach(o, obj_doc, obj)
+		if (wcjson_value_equal(doc, m, hashes, obj_doc, o, obj_hashes))
+			n++;
 
-	if (errno)
-		goto err;
+	return n;
+}
 
-	errno = saved_errno;
+/* Compares the members of two objects pairwise in quadratic time */
+static bool
+doc_equal_counts(const struct wcjson_document *doc,
+    const struct wcjson_value *obj, const uint64_t *hashes,
+    const struct wcjson_document *other_doc, const struct wcjson_value *other,
+    const uint64_t *other_hashes)
+{
+	const struct wcjson_value *v;
 
-	if (v != NULL)
-		v->is_object = 1;
+	wcjson_value_foreach(v, doc, obj) {
+		if (doc_equal_count(doc, v, hashes, doc, obj, hashes) !=
+		    doc_equal_count(doc, v, hashes, other_doc, other,
+		    other_hashes))
+			return false;
+	}
 
-	return v;
-err:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = errno;
-	errno = saved_errno;
-	return v;
+	return true;
 }
 
-static void
-doc_object_add(struct wcjson *ctx, void *doc, void *obj, void *key,
-    void *value)
+/* Orders members by hash and members with equal hashes by key */
+static int
+doc_member_cmp(const void *ctx, const size_t a, const size_t b)
 {
-	struct wcjson_document *d = doc;
+	const struct doc_member *ma = (const struct doc_member *)ctx + a;
+	const struct doc_member *mb = (const struct doc_member *)ctx + b;
 
-	if (obj != NULL && key != NULL && value != NULL) {
-		struct wcjson_value *o = obj;
-		struct wcjson_value *pair = key;
-		struct wcjson_value *v = value;
+	if (ma->hash != mb->hash)
+		return ma->hash < mb->hash ? -1 : 1;
 
-		pair->is_string = 0;
-		pair->is_pair = 1;
-		pair->head_idx = v->idx;
-		pair->tail_idx = v->idx;
+	return doc_key_cmp(ma->pair->string, ma->pair->s_len,
+	    mb->pair->string, mb->pair->s_len);
+}
 
-		if (o->head_idx == 0) {
-			o->head_idx = pair->idx;
-			o->tail_idx = pair->idx;
-		} else {
-			d->values[o->tail_idx].next_idx = pair->idx;
-			pair->prev_idx = o->tail_idx;
-			o->tail_idx = pair->idx;
-		}
+/* Collects the members of obj with their hashes ordered by doc_member_cmp */
+static bool
+doc_members(const struct wcjson_document *doc, const struct wcjson_value *obj,
+    const uint64_t *hashes, struct doc_member *m, size_t *idx)
+{
+	const struct wcjson_value *v;
+	size_t n = 0;
+
+	wcjson_value_foreach(v, doc, obj) {
+		m[n].hash = hashes != NULL && hashes[v->idx] != 0 ?
+		    hashes[v->idx] : wcjson_value_hash(doc, v, NULL);
+		m[n].pair = v;
+
+		if (m[n].hash == 0 || !v->is_pair)
+			return false;
+
+		idx[n] = n;
+		n++;
 	}
+
+	doc_sort(m, idx, n, doc_member_cmp);
+	return true;
 }
 
-static void
-doc_object_end(struct wcjson *ctx, void *doc, void *obj)
+/*
+ * Tests the members of two objects with the same number of members to be
+ * equal as multisets: every member occurs as often in obj as in other, so no
+ * member of other is left without a match once keys repeat. Both member lists
+ * are ordered by hash, so that only members in runs of equal hashes need to
+ * be compared.
+ */
+static bool
+doc_equal_members(const struct wcjson_document *doc,
+    const struct wcjson_value *obj, const uint64_t *hashes,
+    const struct wcjson_document *other_doc, const struct wcjson_value *other,
+    const uint64_t *other_hashes, const size_t n)
 {
+	struct doc_member m_local[2 * DOC_EQUAL_NITEMS];
+	size_t idx_local[2 * DOC_EQUAL_NITEMS];
+	const struct wcjson_allocator *a = DOC_ALLOCATOR(doc);
+	struct doc_member *m = m_local;
+	size_t *idx = idx_local;
+	bool r = false;
+
+	if (n > DOC_EQUAL_NITEMS) {
+		const size_t size = sizeof(*m) + sizeof(*idx);
+
+		// Falls back to comparing pairwise if no memory is available
+		if (n > SIZE_MAX / 2 / size ||
+		    (m = a->allocate(a->ctx, 2 * n * size)) == NULL)
+			return doc_equal_counts(doc, obj, hashes, other_doc,
+			    other, other_hashes);
+
+		idx = (size_t *)(m + 2 * n);
+	}
+
+	struct doc_member *o = m + n;
+	size_t *o_idx = idx + n;
+
+	if (!doc_members(doc, obj, hashes, m, idx) ||
+	    !doc_members(other_doc, other, other_hashes, o, o_idx))
+		goto out;
+
+	for (size_t i = 0, j; i < n; i = j) {
+		const uint64_t h = m[idx[i]].hash;
+
+		for (j = i; j < n && m[idx[j]].hash == h; j++)
+			if (o[o_idx[j]].hash != h)
+				goto out;
+
+		if (j < n && o[o_idx[j]].hash == h)
+			goto out;
+
+		// Runs of equal hashes are compared as multisets
+		for (size_t k = i; k < j; k++) {
+			const struct wcjson_value *v = m[idx[k]].pair;
+			size_t m_cnt = 0, o_cnt = 0;
+
+			for (size_t l = i; l < j; l++) {
+				if (wcjson_value_equal(doc, v, hashes, doc,
+				    m[idx[l]].pair, hashes))
+					m_cnt++;
+
+				if (wcjson_value_equal(doc, v, hashes,
+				    other_doc, o[o_idx[l]].pair, other_hashes))
+					o_cnt++;
+			}
+
+			if (m_cnt != o_cnt)
+				goto out;
+		}
+	}
+
+	r = true;
+out:
+	if (m != m_local)
+		a->deallocate(a->ctx, m);
+
+	return r;
 }
 
-static void *
-doc_array_start(struct wcjson *ctx, void *doc, void *parent)
+bool
+wcjson_value_equal(const struct wcjson_document *doc,
+    const struct wcjson_value *value, const uint64_t *hashes,
+    const struct wcjson_document *other_doc,
+    const struct wcjson_value *other, const uint64_t *other_hashes)
 {
-	const int saved_errno = errno;
-	struct wcjson_document *d = doc;
+	const struct wcjson_value *v, *o;
+
+	if (hashes != NULL && other_hashes != NULL &&
+	    hashes[value->idx] != 0 && other_hashes[other->idx] != 0 &&
+	    hashes[value->idx] != other_hashes[other->idx])
+		return false;
+
+	if (!(VALUE_IS_VALID(value) && VALUE_IS_VALID(other)) ||
+	    value->is_null != other->is_null ||
+	    value->is_boolean != other->is_boolean ||
+	    value->is_true != other->is_true ||
+	    value->is_string != other->is_string ||
+	    value->is_number != other->is_number ||
+	    value->is_object != other->is_object ||
+	    value->is_array != other->is_array ||
+	    value->is_pair != other->is_pair)
+		return false;
+
+	if ((value->is_string || value->is_number || value->is_pair) &&
+	    (value->s_len != other->s_len ||
+	    wcsncmp(value->string, other->string, value->s_len) != 0))
+		return false;
+
+	if (value->is_pair)
+		return value->head_idx != 0 && other->head_idx != 0 &&
+		    wcjson_value_equal(doc, wcjson_value_head(doc, value),
+		    hashes, other_doc, wcjson_value_head(other_doc, other),
+		    other_hashes);
+
+	if (value->is_array) {
+		for (v = wcjson_value_head(doc, value),
+		    o = wcjson_value_head(other_doc, other);
+		    v != NULL && o != NULL; v = wcjson_value_next(doc, v),
+		    o = wcjson_value_next(other_doc, o))
+			if (!wcjson_value_equal(doc, v, hashes, other_doc, o,
+			    other_hashes))
+				return false;
+
+		return v == NULL && o == NULL;
+	}
 
-	errno = 0;
-	struct wcjson_value *v = wcjson_document_nextv(d, true);
+	if (value->is_object) {
+		size_t n = 0, cnt;
 
-	if (errno)
-		goto err;
+		wcjson_value_foreach(v, doc, value)
+			n++;
 
-	errno = saved_errno;
+		cnt = n;
 
-	if (v != NULL)
-		v->is_array = 1;
+		wcjson_value_foreach(o, other_doc, other)
+			if (n-- == 0)
+				return false;
 
-	return v;
-err:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = errno;
-	errno = saved_errno;
-	return v;
+		return n == 0 &&
+		    doc_equal_members(doc, value, hashes, other_doc, other,
+		    other_hashes, cnt);
+	}
+
+	return true;
 }
 
+/* Heapsorts the indices in idx using cmp */
 static void
-doc_array_add(struct wcjson *ctx, void *doc, void *arr,
-    void *value)
+doc_sort(const void *d, size_t *idx, const size_t n,
+    int (*cmp)(const void *, size_t, size_t))
 {
-	struct wcjson_document *d = doc;
+	for (size_t end = n, start = n / 2; end > 1;) {
+		size_t root, t;
+
+		if (start > 0)
+			root = --start;
+		else {
+			t = idx[--end];
+			idx[end] = idx[0];
+			idx[0] = t;
+			root = 0;
+		}
 
-	if (arr != NULL && value != NULL) {
-		struct wcjson_value *a = arr;
-		struct wcjson_value *v = value;
+		for (size_t c; (c = 2 * root + 1) < end; root = c) {
+			if (c + 1 < end && cmp(d, idx[c + 1], idx[c]) > 0)
+				c++;
 
-		if (a->head_idx == 0) {
-			a->head_idx = v->idx;
-			a->tail_idx = v->idx;
-		} else {
-			d->values[a->tail_idx].next_idx = v->idx;
-			v->prev_idx = a->tail_idx;
-			a->tail_idx = v->idx;
+			if (cmp(d, idx[root], idx[c]) >= 0)
+				break;
+
+			t = idx[root];
+			idx[root] = idx[c];
+			idx[c] = t;
 		}
 	}
 }
 
-static void
-doc_array_end(struct wcjson *ctx, void *doc, void *arr)
+/* Orders pairs by key and pairs with equal keys by index */
+static int
+doc_index_cmp(const void *ctx, const size_t a, const size_t b)
 {
+	const struct wcjson_document *d = ctx;
+	const struct wcjson_value *va = &d->values[a];
+	const struct wcjson_value *vb = &d->values[b];
+	const int r = doc_key_cmp(va->string, va->s_len, vb->string, vb->s_len);
+
+	if (r != 0)
+		return r;
+
+	return a < b ? -1 : a > b;
 }
 
-static void *
-doc_string_value(struct wcjson *ctx, void *doc, const wchar_t *str,
-    const size_t len, const bool escaped)
+int
+wcjson_object_index(const struct wcjson_document *doc,
+    const struct wcjson_value *obj, size_t *index, size_t *nitemsp)
 {
-	const int saved_errno = errno;
-	struct wcjson_document *d = doc;
+	const struct wcjson_value *v;
+	size_t n = 0;
 
-	errno = 0;
-	struct wcjson_value *v = wcjson_document_nextv(d, true);
+	if (!obj->is_object)
+		goto err_inval;
 
-	if (errno)
-		goto err;
+	wcjson_value_foreach(v, doc, obj) {
+		if (!(v->is_pair && VALUE_IS_VALID(v)))
+			goto err_inval;
 
-	errno = saved_errno;
+		if (n == *nitemsp)
+			goto err_range;
 
-	if (v != NULL) {
-		v->is_string = 1;
-		v->string = str;
-		v->s_len = len;
+		index[n++] = v->idx;
 	}
 
-	const size_t s_nitems_cnt = d->s_nitems_cnt + len + 1;
-
-	if (s_nitems_cnt < d->s_nitems_cnt)
-		goto err_range;
-
-	d->s_nitems_cnt = s_nitems_cnt;
-	return v;
-err:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = errno;
-	errno = saved_errno;
-	return v;
+	doc_sort(doc, index, n, doc_index_cmp);
+	*nitemsp = n;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
 err_range:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = ERANGE;
-	errno = saved_errno;
-	return v;
+	errno = ERANGE;
+	return -1;
 }
 
-static void *
-doc_number_value(struct wcjson *ctx, void *doc, const wchar_t *num,
-    const size_t len)
+struct wcjson_value *
+wcjson_object_find(const struct wcjson_document *doc, const size_t *index,
+    const size_t nitems, const wchar_t *key, const size_t key_len)
 {
-	const int saved_errno = errno;
-	struct wcjson_document *d = doc;
-
-	errno = 0;
-	struct wcjson_value *v = wcjson_document_nextv(d, true);
+	size_t lo = 0, hi = nitems;
 
-	if (errno)
-		goto err;
-
-	errno = saved_errno;
+	// Lower bound, so the pair with the lowest index is found
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+		const struct wcjson_value *v = &doc->values[index[mid]];
 
-	if (v != NULL) {
-		v->is_number = 1;
-		v->string = num;
-		v->s_len = len;
+		if (doc_key_cmp(v->string, v->s_len, key, key_len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
 	}
 
-	const size_t s_nitems_cnt = d->s_nitems_cnt + len + 1;
+	if (lo == nitems)
+		return NULL;
 
-	if (s_nitems_cnt < d->s_nitems_cnt)
-		goto err_range;
+	const struct wcjson_value *v = &doc->values[index[lo]];
 
-	d->s_nitems_cnt = s_nitems_cnt;
-	return v;
-err:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = errno;
-	errno = saved_errno;
-	return v;
-err_range:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = ERANGE;
-	errno = saved_errno;
-	return v;
+	if (doc_key_cmp(v->string, v->s_len, key, key_len) != 0)
+		return NULL;
+
+	return wcjson_value_head(doc, v);
 }
 
-static void *
-doc_bool_value(struct wcjson *ctx, void *doc, const bool value)
+int
+wcjson_object_join(const struct wcjson_document *doc, const size_t *index,
+    const size_t nitems, const struct wcjson_document *other_doc,
+    const size_t *other_index, const size_t other_nitems,
+    int (*join)(void *ctx, const struct wcjson_value *pair,
+    const struct wcjson_value *other_pair), void *ctx)
 {
-	const int saved_errno = errno;
-	struct wcjson_document *d = doc;
-
-	errno = 0;
-	struct wcjson_value *v = wcjson_document_nextv(d, true);
-
-	if (errno)
-		goto err;
-
-	errno = saved_errno;
+	size_t i = 0, j = 0;
+
+	while (i < nitems || j < other_nitems) {
+		const struct wcjson_value *v = i < nitems ?
+		    &doc->values[index[i]] : NULL;
+		const struct wcjson_value *o = j < other_nitems ?
+		    &other_doc->values[other_index[j]] : NULL;
+		int r = v == NULL ? 1 : o == NULL ? -1 :
+		    doc_key_cmp(v->string, v->s_len, o->string, o->s_len);
+
+		if (r < 0) {
+			o = NULL;
+			i++;
+		} else if (r > 0) {
+			v = NULL;
+			j++;
+		} else {
+			i++;
+			j++;
+		}
 
-	if (v != NULL) {
-		v->is_boolean = 1;
-		v->is_true = value ? 1 : 0;
+		if (join(ctx, v, o) < 0)
+			return -1;
 	}
 
-	return v;
-err:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = errno;
-	errno = saved_errno;
-	return v;
+	return 0;
 }
 
-static void *
-doc_null_value(struct wcjson *ctx, void *doc)
+static inline uint64_t
+doc_keyset_hash(const wchar_t *key, const size_t len)
 {
-	const int saved_errno = errno;
-	struct wcjson_document *d = doc;
-
-	errno = 0;
-	struct wcjson_value *v = wcjson_document_nextv(d, true);
+	return doc_hash_mix(doc_hash_string(DOC_HASH_SEED('k'), key, len));
+}
 
-	if (errno)
-		goto err;
+static inline size_t
+doc_keyset_bucket(const struct wcjson_keyset *set, const uint64_t h)
+{
+	return (size_t)(h >> 32) & (set->b_nitems - 1);
+}
 
-	errno = saved_errno;
+static inline size_t
+doc_keyset_slot(const struct wcjson_keyset *set, const uint64_t h,
+    const size_t d)
+{
+	return (size_t)doc_hash_mix(h ^ ((uint64_t)d * DOC_KEYSET_DISPLACE)) &
+	    (set->s_nitems - 1);
+}
 
-	if (v != NULL)
-		v->is_null = 1;
+static inline const wchar_t *
+doc_keyset_key(const struct wcjson_keyset *set, const size_t i, size_t *lenp)
+{
+	if (set->bindings != NULL) {
+		*lenp = set->bindings[i].key_len;
+		return set->bindings[i].key;
+	}
 
-	return v;
-err:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = errno;
-	errno = saved_errno;
-	return v;
+	*lenp = set->lens[i];
+	return set->keys[i];
 }
 
+/* Number of bits of a table item marking occupied slots while building */
+#define DOC_KEYSET_BITS (sizeof(size_t) * 8)
+
+/*
+ * Finds a displacement moving the n keys of a bucket with hashes hs to
+ * distinct slots not yet marked in the bitmap used and marks them.
+ */
 static int
-doc_unesc(struct wcjson *ctx, struct wcjson_document *d,
-    struct wcjson_value *v)
+doc_keyset_place(struct wcjson_keyset *set, const size_t bucket,
+    const uint64_t *hs, const size_t n, size_t *used)
 {
-	if (v->is_string || v->is_pair) {
-		size_t dst_len = d->s_nitems - d->s_next;
-		wchar_t *dst = &d->strings[d->s_next];
+	size_t s[DOC_KEYSET_BUCKET];
 
-		if (wcjsonstowc(v->string, v->s_len, dst, &dst_len) < 0)
-			goto err_decode;
+	for (size_t i = 0; i < n; i++)
+		for (size_t j = 0; j < i; j++)
+			if (hs[i] == hs[j])
+				goto err_inval;
 
-		dst[dst_len] = L'\0';
+	for (size_t d = 0; d < DOC_KEYSET_TRIES; d++) {
+		size_t i;
 
-		const size_t s_next = d->s_next + dst_len + 1;
+		for (i = 0; i < n; i++) {
+			size_t j;
 
-		if (s_next < d->s_next || s_next > d->s_nitems)
-			goto err_range;
+			s[i] = doc_keyset_slot(set, hs[i], d);
 
-		v->string = dst;
-		v->s_len = dst_len;
+			if ((used[s[i] / DOC_KEYSET_BITS] >>
+			    (s[i] % DOC_KEYSET_BITS)) & 1)
+				break;
 
-		d->s_next = s_next;
-		d->e_nitems_cnt = MAX(dst_len * WCJSON_ESCAPE_MAX,
-		    d->e_nitems_cnt);
+			for (j = 0; j < i && s[j] != s[i]; j++)
+				;
 
-		const size_t mblen = wcstombs(NULL, v->string, v->s_len);
+			if (j < i)
+				break;
+		}
 
-		if (mblen == (size_t)-1)
-			goto err;
+		if (i < n)
+			continue;
 
-		const size_t mb_nitems_cnt = d->mb_nitems_cnt + mblen + 1;
+		for (i = 0; i < n; i++)
+			used[s[i] / DOC_KEYSET_BITS] |=
+			    (size_t)1 << (s[i] % DOC_KEYSET_BITS);
+
+		set->table[bucket] = d;
+		return 0;
+	}
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
 
-		if (mb_nitems_cnt < d->mb_nitems_cnt)
+/*
+ * Hash and displace: keys are hashed to buckets, which are placed largest
+ * first by searching a displacement of the slots of their keys. The slots
+ * array serves as scratch space until all buckets are placed, holding the
+ * bucket of each key, then the keys grouped by a counting sort on the size of
+ * their buckets followed by a bitmap of the slots taken.
+ */
+static int
+doc_keyset_build(struct wcjson_keyset *set, const size_t nitems)
+{
+	size_t *const buckets = set->table;
+	size_t off[DOC_KEYSET_BUCKET + 1] = {0};
+	uint64_t hs[DOC_KEYSET_BUCKET];
+	size_t b_nitems = 1;
+	size_t len;
+
+	while (b_nitems < nitems) {
+		if (b_nitems > SIZE_MAX / 6)
 			goto err_range;
 
-		d->mb_nitems_cnt = mb_nitems_cnt;
+		b_nitems <<= 1;
+	}
 
-		if (v->is_pair &&
-		    doc_unesc(ctx, d, wcjson_value_head(d, v)) < 0)
-			goto err;
-	} else if (v->is_number) {
-		size_t dst_len = d->s_nitems - d->s_next;
-		wchar_t *dst = &d->strings[d->s_next];
+	if (set->t_nitems < 3 * b_nitems)
+		goto err_range;
 
-		if (v->s_len == SIZE_MAX || dst_len < v->s_len + 1)
-			goto err_range;
+	set->k_nitems = nitems;
+	set->b_nitems = b_nitems;
+	set->s_nitems = 2 * b_nitems;
 
-		wmemcpy(dst, v->string, v->s_len);
-		dst[v->s_len] = L'\0';
+	size_t *const slots = &set->table[b_nitems];
+	size_t *const bkts = &slots[b_nitems];
 
-		const size_t s_next = d->s_next + v->s_len + 1;
+	for (size_t b = 0; b < b_nitems; b++)
+		buckets[b] = 0;
 
-		if (s_next < d->s_next || s_next > d->s_nitems)
-			goto err_range;
+	for (size_t i = 0; i < nitems; i++) {
+		const wchar_t *key = doc_keyset_key(set, i, &len);
 
-		v->string = dst;
+		bkts[i] = doc_keyset_bucket(set, doc_keyset_hash(key, len));
 
-		d->s_next = s_next;
+		if (++buckets[bkts[i]] > DOC_KEYSET_BUCKET)
+			goto err_inval;
+	}
 
-		const size_t mblen = wcstombs(NULL, v->string, v->s_len);
+	// Groups of larger buckets come first
+	for (size_t b = 0; b < b_nitems; b++)
+		off[buckets[b]] += buckets[b];
 
-		if (mblen == (size_t)-1)
-			goto err;
+	for (size_t n = DOC_KEYSET_BUCKET, o = 0; n > 0; n--) {
+		const size_t cnt = off[n];
 
-		const size_t mb_nitems_cnt = d->mb_nitems_cnt + mblen + 1;
+		off[n] = o;
+		o += cnt;
+	}
 
-		if (mb_nitems_cnt < d->mb_nitems_cnt)
-			goto err_range;
+	for (size_t b = 0; b < b_nitems; b++) {
+		const size_t n = buckets[b];
 
-		d->mb_nitems_cnt = mb_nitems_cnt;
-	} else if (v->is_array) {
-		for (struct wcjson_value *n = wcjson_value_tail(d, v);
-		    n != NULL; n = wcjson_value_prev(d, n))
-			if (doc_unesc(ctx, d, n) < 0)
-				goto err;
-	} else if (v->is_object) {
-		for (struct wcjson_value *n = wcjson_value_tail(d, v);
-		    n != NULL; n = wcjson_value_prev(d, n))
-			if (doc_unesc(ctx, d, n) < 0)
-				goto err;
+		buckets[b] = off[n];
+		off[n] += n;
+	}
+
+	for (size_t i = 0; i < nitems; i++)
+		slots[buckets[bkts[i]]++] = i;
+
+	for (size_t b = 0; b < b_nitems; b++)
+		buckets[b] = 0;
+
+	for (size_t i = 0; i < b_nitems; i++)
+		bkts[i] = 0;
+
+	for (size_t i = 0; i < nitems;) {
+		size_t n = 0, b = SIZE_MAX;
+
+		for (; i < nitems && n < DOC_KEYSET_BUCKET; i++, n++) {
+			const wchar_t *key = doc_keyset_key(set, slots[i], &len);
+			const uint64_t h = doc_keyset_hash(key, len);
+
+			if (b != SIZE_MAX && doc_keyset_bucket(set, h) != b)
+				break;
+
+			b = doc_keyset_bucket(set, h);
+			hs[n] = h;
+		}
+
+		if (doc_keyset_place(set, b, hs, n, bkts) < 0)
+			return -1;
+	}
+
+	for (size_t i = 0; i < set->s_nitems; i++)
+		slots[i] = 0;
+
+	for (size_t i = 0; i < nitems; i++) {
+		const wchar_t *key = doc_keyset_key(set, i, &len);
+		const uint64_t h = doc_keyset_hash(key, len);
+
+		slots[doc_keyset_slot(set, h,
+		    buckets[doc_keyset_bucket(set, h)])] = i + 1;
 	}
 
 	return 0;
-err:
+err_inval:
+	errno = EINVAL;
 	return -1;
 err_range:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = ERANGE;
+	errno = ERANGE;
 	return -1;
-err_decode:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = errno;
+}
+
+int
+wcjson_keyset_init(struct wcjson_keyset *set, const wchar_t *const *keys,
+    const size_t *lens, const size_t nitems)
+{
+	set->keys = keys;
+	set->lens = lens;
+	set->bindings = NULL;
+
+	return doc_keyset_build(set, nitems);
+}
+
+int
+wcjson_keyset_bindings(struct wcjson_keyset *set,
+    const struct wcjson_binding *bindings, const size_t nitems)
+{
+	set->keys = NULL;
+	set->lens = NULL;
+	set->bindings = bindings;
+
+	return doc_keyset_build(set, nitems);
+}
+
+size_t
+wcjson_keyset_find(const struct wcjson_keyset *set, const wchar_t *key,
+    const size_t len)
+{
+	if (set->k_nitems == 0)
+		return SIZE_MAX;
+
+	const uint64_t h = doc_keyset_hash(key, len);
+	const size_t d = set->table[doc_keyset_bucket(set, h)];
+	const size_t id = set->table[set->b_nitems + doc_keyset_slot(set, h, d)];
+	size_t k_len;
+
+	if (id == 0)
+		return SIZE_MAX;
+
+	const wchar_t *k = doc_keyset_key(set, id - 1, &k_len);
+
+	if (k_len != len || wmemcmp(k, key, len) != 0)
+		return SIZE_MAX;
+
+	return id - 1;
+}
+
+int
+wcjson_object_match(const struct wcjson_document *doc,
+    const struct wcjson_value *obj, const struct wcjson_keyset *set,
+    struct wcjson_value **values)
+{
+	const struct wcjson_value *v;
+
+	if (!obj->is_object)
+		goto err_inval;
+
+	wcjson_value_foreach(v, doc, obj) {
+		const size_t id = wcjson_keyset_find(set, v->string, v->s_len);
+
+		if (id != SIZE_MAX && values[id] == NULL)
+			values[id] = wcjson_value_head(doc, v);
+	}
+
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+wchar_t *
+wcjson_document_string(struct wcjson_document *doc, const wchar_t *s,
+    const size_t len)
+{
+	size_t dst_len = doc->s_nitems - doc->s_next;
+	wchar_t *dst = &doc->strings[doc->s_next];
+
+	if (len == SIZE_MAX || dst_len < len + 1)
+		goto err_range;
+
+	wchar_t *ret = wcsncpy(dst, s, len);
+	ret[len] = L'\0';
+
+	const size_t s_next = doc->s_next + len + 1;
+
+	if (s_next < doc->s_next || s_next > doc->s_nitems)
+		goto err_range;
+
+	doc->s_next = s_next;
+
+	const size_t s_nitems_cnt = doc->s_nitems_cnt + len + 1;
+
+	if (s_nitems_cnt < doc->s_nitems_cnt)
+		goto err_range;
+
+	doc->s_nitems_cnt = s_nitems_cnt;
+	return ret;
+err_range:
+	errno = ERANGE;
+	return NULL;
+}
+
+char *
+wcjson_document_mbstring(struct wcjson_document *doc, const char *s,
+    const size_t len)
+{
+	size_t dst_len = doc->mb_nitems - doc->mb_next;
+	char *dst = &doc->mbstrings[doc->mb_next];
+
+	if (len == SIZE_MAX || dst_len < len + 1)
+		goto err_range;
+
+	char *ret = strncpy(dst, s, len);
+	ret[len] = '\0';
+
+	const size_t mb_next = doc->mb_next + len + 1;
+
+	if (mb_next < doc->mb_next || mb_next > doc->mb_nitems)
+		goto err_range;
+
+	doc->mb_next = mb_next;
+
+	const size_t mb_nitems_cnt = doc->mb_nitems_cnt + len + 1;
+
+	if (mb_nitems_cnt < doc->mb_nitems_cnt)
+		goto err_range;
+
+	doc->mb_nitems_cnt = mb_nitems_cnt;
+	return ret;
+err_range:
+	errno = ERANGE;
+	return NULL;
+}
+
+const char *
+wcjson_value_mbstring(struct wcjson_document *doc, struct wcjson_value *v)
+{
+	if (!(v->is_string || v->is_number || v->is_pair) || v->string == NULL)
+		goto err_inval;
+
+	if (v->mbstring != NULL)
+		return v->mbstring;
+
+	if (doc->mbstrings == NULL)
+		goto err_range;
+
+	if (doc_mbstring(doc, v) < 0)
+		return NULL;
+
+	const size_t mb_nitems_cnt = doc->mb_nitems_cnt + v->mb_len + 1;
+
+	if (mb_nitems_cnt < doc->mb_nitems_cnt)
+		goto err_range;
+
+	doc->mb_nitems_cnt = mb_nitems_cnt;
+	return v->mbstring;
+err_inval:
+	errno = EINVAL;
+	return NULL;
+err_range:
+	errno = ERANGE;
+	return NULL;
+}
+
+/*
+ * Pushes the value and all its descendants to the free list, using the
+ * next_idx member of released slots to queue the values still to visit.
+ * Links on the free list are stored as indices plus one.
+ */
+int
+wcjson_value_free(struct wcjson_document *doc, struct wcjson_value *value)
+{
+	if (value == NULL || VALUE_IS_CHILD(value) || !VALUE_IS_VALID(value))
+		goto err_inval;
+
+	size_t head = value->idx;
+	size_t tail = head;
+	size_t n = 1;
+
+	for (size_t i = head; i != SIZE_MAX;) {
+		struct wcjson_value *v = &doc->values[i];
+		size_t c = v->is_object || v->is_array || v->is_pair ?
+		    v->head_idx : 0;
+
+		while (c != 0) {
+			if (c >= doc->v_next || ++n > doc->v_next)
+				goto err_inval;
+
+			const size_t next = v->is_pair ? 0 :
+			    doc->values[c].next_idx;
+
+			doc->values[tail].next_idx = c + 1;
+			doc->values[c].next_idx = 0;
+			tail = c;
+			c = next;
+		}
+
+		v->is_null = 0;
+		v->is_boolean = 0;
+		v->is_true = 0;
+		v->is_string = 0;
+		v->is_number = 0;
+		v->is_object = 0;
+		v->is_array = 0;
+		v->is_pair = 0;
+		v->string = NULL;
+		v->s_len = 0;
+		v->mbstring = NULL;
+		v->mb_len = 0;
+		v->head_idx = 0;
+		v->tail_idx = 0;
+		v->prev_idx = 0;
+		i = v->next_idx != 0 ? v->next_idx - 1 : SIZE_MAX;
+	}
+
+	doc->values[tail].next_idx = doc->v_free;
+	doc->v_free = head + 1;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Pre-order successor of the value at idx, with parents kept in idx members */
+static size_t
+doc_compact_succ(struct wcjson_document *d, size_t idx, const size_t root)
+{
+	const struct wcjson_value *v = &d->values[idx];
+
+	if ((v->is_object || v->is_array || v->is_pair) && v->head_idx != 0) {
+		d->values[v->head_idx].idx = idx;
+		return v->head_idx;
+	}
+
+	while (idx != root) {
+		const size_t parent = d->values[idx].idx;
+		const size_t next = d->values[parent].is_pair ? 0 :
+		    d->values[idx].next_idx;
+
+		d->values[idx].idx = idx;
+
+		if (next != 0) {
+			d->values[next].idx = parent;
+			return next;
+		}
+
+		idx = parent;
+	}
+
+	return SIZE_MAX;
+}
+
+static inline uintptr_t
+doc_compact_key(const struct wcjson_document *d, const size_t idx,
+    const bool mb)
+{
+	return mb ? (uintptr_t)d->values[idx].mbstring :
+	    (uintptr_t)d->values[idx].string;
+}
+
+static int
+doc_compact_cmp(const struct wcjson_document *d, const size_t a,
+    const size_t b, const bool mb)
+{
+	const uintptr_t ka = doc_compact_key(d, a, mb);
+	const uintptr_t kb = doc_compact_key(d, b, mb);
+
+	return ka < kb ? -1 : ka > kb;
+}
+
+static int
+doc_compact_cmp_strings(const void *d, const size_t a, const size_t b)
+{
+	return doc_compact_cmp(d, a, b, false);
+}
+
+static int
+doc_compact_cmp_mbstrings(const void *d, const size_t a, const size_t b)
+{
+	return doc_compact_cmp(d, a, b, true);
+}
+
+/*
+ * Slides the strings of the values in idx towards the start of the strings or
+ * mbstrings array in address order, so no string is overwritten before it has
+ * been moved. Strings starting inside a string moved before share its copy.
+ */
+static size_t
+doc_compact_strings(struct wcjson_document *d, size_t *idx, const size_t n,
+    const bool mb)
+{
+	const size_t size = mb ? sizeof(char) : sizeof(wchar_t);
+	char *const base = mb ? d->mbstrings : (char *)d->strings;
+	uintptr_t prev = 0, prev_end = 0;
+	size_t next = 0, prev_next = 0;
+
+	doc_sort(d, idx, n, mb ? doc_compact_cmp_mbstrings :
+	    doc_compact_cmp_strings);
+
+	for (size_t i = 0; i < n; i++) {
+		struct wcjson_value *v = &d->values[idx[i]];
+		const uintptr_t s = doc_compact_key(d, idx[i], mb);
+		const size_t len = ((mb ? v->mb_len : v->s_len) + 1) * size;
+		size_t off;
+
+		if (i > 0 && s < prev_end && s + len <= prev_end)
+			off = prev_next + (s - prev);
+		else {
+			off = next;
+			memmove(base + next, (const char *)s, len);
+			prev = s;
+			prev_end = s + len;
+			prev_next = next;
+			next += len;
+		}
+
+		if (mb)
+			v->mbstring = base + off;
+		else
+			v->string = (const wchar_t *)(const void *)(base + off);
+	}
+
+	return next / size;
+}
+
+int
+wcjson_document_compact(struct wcjson_document *doc,
+    const struct wcjson_value *value, size_t *map)
+{
+	struct wcjson_value *const values = doc->values;
+	size_t n = 0;
+
+	if (value == NULL || VALUE_IS_CHILD(value) || !VALUE_IS_VALID(value))
+		goto err_inval;
+
+	for (size_t i = 0; i < doc->v_next; i++)
+		map[i] = SIZE_MAX;
+
+	// Number the values reachable from value in pre-order
+	for (size_t i = value->idx; i != SIZE_MAX;
+	    i = doc_compact_succ(doc, i, value->idx)) {
+		const struct wcjson_value *v = &values[i];
+
+		if (map[i] != SIZE_MAX || v->head_idx >= doc->v_next ||
+		    v->tail_idx >= doc->v_next || v->prev_idx >= doc->v_next ||
+		    v->next_idx >= doc->v_next || !VALUE_IS_VALID(v))
+			goto err_links;
+
+		map[i] = n++;
+	}
+
+	// Rewrite the links, keeping the new index in the idx member
+	for (size_t i = 0; i < doc->v_next; i++) {
+		struct wcjson_value *v = &values[i];
+
+		v->idx = map[i];
+
+		if (v->idx == SIZE_MAX)
+			continue;
+
+		v->head_idx = v->head_idx != 0 ? map[v->head_idx] : 0;
+		v->tail_idx = v->tail_idx != 0 ? map[v->tail_idx] : 0;
+		v->prev_idx = v->prev_idx != 0 ? map[v->prev_idx] : 0;
+		v->next_idx = v->next_idx != 0 ? map[v->next_idx] : 0;
+	}
+
+	// Compact strings using map as scratch space
+	const uintptr_t s_lo = (uintptr_t)doc->strings;
+	const uintptr_t s_hi = (uintptr_t)(doc->strings + doc->s_next);
+	const uintptr_t mb_lo = (uintptr_t)doc->mbstrings;
+	const uintptr_t mb_hi = (uintptr_t)(doc->mbstrings + doc->mb_next);
+	size_t s_cnt = 0, mb_cnt = 0, s_n = 0, mb_n = 0;
+
+	for (size_t i = 0; i < doc->v_next; i++) {
+		const struct wcjson_value *v = &values[i];
+		const uintptr_t s = (uintptr_t)v->string;
+
+		if (v->idx == SIZE_MAX || v->string == NULL)
+			continue;
+
+		s_cnt += v->s_len + 1;
+
+		if (doc->strings != NULL && s >= s_lo && s < s_hi)
+			map[s_n++] = i;
+	}
+
+	if (s_n > 0)
+		doc->s_next = doc_compact_strings(doc, map, s_n, false);
+
+	for (size_t i = 0; i < doc->v_next; i++) {
+		const struct wcjson_value *v = &values[i];
+		const uintptr_t mb = (uintptr_t)v->mbstring;
+
+		if (v->idx == SIZE_MAX || v->mbstring == NULL)
+			continue;
+
+		mb_cnt += v->mb_len + 1;
+
+		if (doc->mbstrings != NULL && mb >= mb_lo && mb < mb_hi)
+			map[mb_n++] = i;
+	}
+
+	if (mb_n > 0)
+		doc->mb_next = doc_compact_strings(doc, map, mb_n, true);
+
+	for (size_t i = 0; i < doc->v_next; i++)
+		map[i] = values[i].idx;
+
+	// Move every value to its new index
+	for (size_t i = 0; i < doc->v_next; i++) {
+		while (values[i].idx != SIZE_MAX && values[i].idx != i) {
+			const struct wcjson_value t = values[values[i].idx];
+
+			values[values[i].idx] = values[i];
+			values[i] = t;
+		}
+	}
+
+	if (s_n == 0)
+		doc->s_next = 0;
+
+	if (mb_n == 0)
+		doc->mb_next = 0;
+
+	doc->v_next = n;
+	doc->v_nitems_cnt = n;
+	doc->v_free = 0;
+	doc->s_nitems_cnt = s_cnt;
+	doc->mb_nitems_cnt = mb_cnt;
+	return 0;
+err_links:
+	for (size_t i = 0; i < doc->v_next; i++)
+		values[i].idx = i;
+err_inval:
+	errno = EINVAL;
 	return -1;
 }
 
-static int
-doc_mbstrings(struct wcjson *ctx, struct wcjson_document *d,
-    struct wcjson_value *v)
+void
+wcjson_document_reset(struct wcjson_document *doc)
+{
+	doc->v_nitems_cnt = 0;
+	doc->v_next = 0;
+	doc->v_free = 0;
+	doc->s_nitems_cnt = 0;
+	doc->s_next = 0;
+	doc->mb_nitems_cnt = 0;
+	doc->mb_next = 0;
+}
+
+int
+wcjson_arena_init(struct wcjson_arena *a, void *block, const size_t size)
+{
+	if (block == NULL || size == 0)
+		goto err_inval;
+
+	a->base = block;
+	a->size = size;
+	a->next = 0;
+	a->mapped = false;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+int
+wcjson_arena_map(struct wcjson_arena *a, const size_t size)
+{
+	if (size == 0)
+		goto err_inval;
+
+#if defined(HAVE_SYS_MMAN_H)
+	void *p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (p == MAP_FAILED)
+		return -1;
+#elif defined(_WIN32)
+	void *p = VirtualAlloc(NULL, size, MEM_RESERVE | MEM_COMMIT,
+	    PAGE_READWRITE);
+
+	if (p == NULL)
+		goto err_nomem;
+#else
+	goto err_nosys;
+#endif
+	a->base = p;
+	a->size = size;
+	a->next = 0;
+	a->mapped = true;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+#if defined(_WIN32) && !defined(HAVE_SYS_MMAN_H)
+err_nomem:
+	errno = ENOMEM;
+	return -1;
+#endif
+#if !defined(HAVE_SYS_MMAN_H) && !defined(_WIN32)
+err_nosys:
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int
+wcjson_arena_unmap(struct wcjson_arena *a)
+{
+	int r = 0;
+
+	if (a->mapped) {
+#if defined(HAVE_SYS_MMAN_H)
+		r = munmap(a->base, a->size);
+#elif defined(_WIN32)
+		if (!VirtualFree(a->base, 0, MEM_RELEASE)) {
+			errno = EINVAL;
+			r = -1;
+		}
+#endif
+	}
+
+	a->base = NULL;
+	a->size = 0;
+	a->next = 0;
+	a->mapped = false;
+	return r;
+}
+
+static inline size_t
+arena_next(const struct wcjson_arena *a)
+{
+	const uintptr_t p = (uintptr_t)(a->base + a->next);
+	const size_t pad = (size_t)(-p & (ARENA_ALIGN - 1));
+
+	return pad > a->size - a->next ? a->size : a->next + pad;
+}
+
+void *
+wcjson_arena_alloc(struct wcjson_arena *a, const size_t nitems,
+    const size_t size)
+{
+	const size_t next = arena_next(a);
+
+	if (size != 0 && nitems > (a->size - next) / size)
+		goto err_nomem;
+
+	a->next = next + nitems * size;
+	return a->base + next;
+err_nomem:
+	errno = ENOMEM;
+	return NULL;
+}
+
+void *
+wcjson_arena_tail(struct wcjson_arena *a, const size_t size,
+    size_t *nitemsp)
+{
+	const size_t next = arena_next(a);
+
+	if (size == 0)
+		goto err_inval;
+
+	*nitemsp = (a->size - next) / size;
+
+	if (*nitemsp == 0)
+		goto err_nomem;
+
+	a->next = next + *nitemsp * size;
+	return a->base + next;
+err_inval:
+	errno = EINVAL;
+	return NULL;
+err_nomem:
+	errno = ENOMEM;
+	return NULL;
+}
+
+int
+wcjson_arena_shrink(struct wcjson_arena *a, void *p, const size_t nitems,
+    const size_t size)
+{
+	const char *c = p;
+
+	if (c < a->base || c > a->base + a->next)
+		goto err_inval;
+
+	const size_t off = (size_t)(c - a->base);
+
+	if (size != 0 && nitems > (a->next - off) / size)
+		goto err_inval;
+
+	a->next = off + nitems * size;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+size_t
+wcjson_arena_remaining(const struct wcjson_arena *a)
+{
+	return a->size - arena_next(a);
+}
+
+static int
+doc_grow(const struct wcjson_allocator *a, void **p, size_t *nitemsp,
+    const size_t nitems_cnt, const size_t size)
+{
+	if (nitems_cnt <= *nitemsp)
+		return 0;
+
+	if (nitems_cnt > SIZE_MAX / size)
+		goto err_nomem;
+
+	void *n = a->reallocate(a->ctx, *p, nitems_cnt * size);
+
+	if (n == NULL)
+		return -1;
+
+	*p = n;
+	*nitemsp = nitems_cnt;
+	return 0;
+err_nomem:
+	errno = ENOMEM;
+	return -1;
+}
+
+/*
+ * Allocates a pooled document whose arrays are allocated separately by the
+ * allocator of the pool, so that they can be grown and freed like the arrays
+ * of any other document.
+ */
+static struct doc_pool_entry *
+doc_pool_entry(const struct wcjson_allocator *a, const size_t v_nitems,
+    const size_t s_nitems, const size_t mb_nitems)
+{
+	struct doc_pool_entry *e = a->allocate(a->ctx, sizeof(*e));
+	void *p;
+
+	if (e == NULL)
+		return NULL;
+
+	e->doc = (struct wcjson_document)WCJSON_DOCUMENT_INITIALIZER;
+	e->doc.allocator = a;
+	e->next = NULL;
+
+	p = NULL;
+	if (doc_grow(a, &p, &e->doc.v_nitems, v_nitems,
+	    sizeof(struct wcjson_value)) < 0)
+		goto err;
+
+	e->doc.values = p;
+
+	p = NULL;
+	if (doc_grow(a, &p, &e->doc.s_nitems, s_nitems, sizeof(wchar_t)) < 0)
+		goto err;
+
+	e->doc.strings = p;
+
+	p = NULL;
+	if (doc_grow(a, &p, &e->doc.mb_nitems, mb_nitems, sizeof(char)) < 0)
+		goto err;
+
+	e->doc.mbstrings = p;
+	return e;
+err:
+	a->deallocate(a->ctx, e->doc.values);
+	a->deallocate(a->ctx, e->doc.strings);
+	a->deallocate(a->ctx, e);
+	return NULL;
+}
+
+static void
+doc_pool_entry_free(const struct wcjson_allocator *a, struct doc_pool_entry *e)
+{
+	a->deallocate(a->ctx, e->doc.values);
+	a->deallocate(a->ctx, e->doc.strings);
+	a->deallocate(a->ctx, e->doc.mbstrings);
+	a->deallocate(a->ctx, e);
+}
+
+int
+wcjson_document_grow(struct wcjson_document *doc)
+{
+	const struct wcjson_allocator *a = DOC_ALLOCATOR(doc);
+	const uintptr_t s_old = (uintptr_t)doc->strings;
+	const uintptr_t mb_old = (uintptr_t)doc->mbstrings;
+	void *p;
+
+	p = doc->values;
+	if (doc_grow(a, &p, &doc->v_nitems, doc->v_nitems_cnt,
+	    sizeof(struct wcjson_value)) < 0)
+		return -1;
+
+	doc->values = p;
+
+	p = doc->strings;
+	if (doc_grow(a, &p, &doc->s_nitems, doc->s_nitems_cnt,
+	    sizeof(wchar_t)) < 0)
+		return -1;
+
+	doc->strings = p;
+
+	p = doc->mbstrings;
+	if (doc_grow(a, &p, &doc->mb_nitems, doc->mb_nitems_cnt,
+	    sizeof(char)) < 0)
+		return -1;
+
+	doc->mbstrings = p;
+
+	const uintptr_t s_new = (uintptr_t)doc->strings;
+	const uintptr_t mb_new = (uintptr_t)doc->mbstrings;
+
+	if (s_new == s_old && mb_new == mb_old)
+		return 0;
+
+	// Rebase string pointers into moved arrays
+	for (size_t i = 0; i < doc->v_next; i++) {
+		struct wcjson_value *v = &doc->values[i];
+		const uintptr_t s = (uintptr_t)v->string;
+		const uintptr_t mb = (uintptr_t)v->mbstring;
+
+		if (s_new != s_old && v->string != NULL && s >= s_old &&
+		    s - s_old < doc->s_next * sizeof(wchar_t))
+			v->string = doc->strings + (s - s_old) / sizeof(wchar_t);
+
+		if (mb_new != mb_old && v->mbstring != NULL && mb >= mb_old &&
+		    mb - mb_old < doc->mb_next)
+			v->mbstring = doc->mbstrings + (mb - mb_old);
+	}
+
+	return 0;
+}
+
+void
+wcjson_document_free(struct wcjson_document *doc)
+{
+	const struct wcjson_allocator *a = DOC_ALLOCATOR(doc);
+
+	a->deallocate(a->ctx, doc->values);
+	a->deallocate(a->ctx, doc->strings);
+	a->deallocate(a->ctx, doc->mbstrings);
+	doc->values = NULL;
+	doc->v_nitems = 0;
+	doc->strings = NULL;
+	doc->s_nitems = 0;
+	doc->mbstrings = NULL;
+	doc->mb_nitems = 0;
+	wcjson_document_reset(doc);
+}
+
+static inline size_t
+doc_pool_size(const size_t nitems, const size_t used, const size_t target)
+{
+	// Documents released by wcjson_document_free are reallocated
+	if (nitems < used || nitems == 0)
+		return MAX(target, nitems > SIZE_MAX / 2 ? SIZE_MAX : nitems * 2);
+
+	return nitems > target && nitems - target > target ? target : nitems;
+}
+
+struct wcjson_document_pool *
+wcjson_document_pool_create(const struct wcjson_allocator *allocator,
+    const size_t v_nitems, const size_t s_nitems, const size_t mb_nitems)
+{
+	const struct wcjson_allocator *a = allocator != NULL ? allocator :
+	    wcjson_allocator_default;
+	struct wcjson_document_pool *pool = a->allocate(a->ctx, sizeof(*pool));
+
+	if (pool == NULL)
+		return NULL;
+
+	const int r = doc_lock_init(&pool->lock);
+
+	if (r != 0) {
+		a->deallocate(a->ctx, pool);
+		errno = r;
+		return NULL;
+	}
+
+	pool->allocator = a;
+	pool->free = NULL;
+	pool->v_nitems = v_nitems;
+	pool->s_nitems = s_nitems;
+	pool->mb_nitems = mb_nitems;
+	pool->v_hw = 0;
+	pool->s_hw = 0;
+	pool->mb_hw = 0;
+	pool->v_min = v_nitems;
+	pool->s_min = s_nitems;
+	pool->mb_min = mb_nitems;
+	pool->puts = 0;
+	return pool;
+}
+
+struct wcjson_document *
+wcjson_document_pool_get(struct wcjson_document_pool *pool)
+{
+	doc_lock(&pool->lock);
+
+	struct doc_pool_entry *e = pool->free;
+	const size_t v_nitems = MAX(pool->v_nitems, pool->v_hw);
+	const size_t s_nitems = MAX(pool->s_nitems, pool->s_hw);
+	const size_t mb_nitems = MAX(pool->mb_nitems, pool->mb_hw);
+
+	if (e != NULL)
+		pool->free = e->next;
+
+	doc_unlock(&pool->lock);
+
+	if (e == NULL && (e = doc_pool_entry(pool->allocator, v_nitems,
+	    s_nitems, mb_nitems)) == NULL)
+		return NULL;
+
+	return &e->doc;
+}
+
+void
+wcjson_document_pool_put(struct wcjson_document_pool *pool,
+    struct wcjson_document *doc)
+{
+	struct doc_pool_entry *e = (struct doc_pool_entry *)doc;
+	const size_t v_used = MAX(doc->v_next, doc->v_nitems_cnt);
+	const size_t s_used = MAX(doc->s_next, doc->s_nitems_cnt);
+	const size_t mb_used = MAX(doc->mb_next, doc->mb_nitems_cnt);
+
+	doc_lock(&pool->lock);
+
+	pool->v_hw = MAX(pool->v_hw, v_used);
+	pool->s_hw = MAX(pool->s_hw, s_used);
+	pool->mb_hw = MAX(pool->mb_hw, mb_used);
+
+	const size_t v_target = MAX(pool->v_nitems, pool->v_hw);
+	const size_t s_target = MAX(pool->s_nitems, pool->s_hw);
+	const size_t mb_target = MAX(pool->mb_nitems, pool->mb_hw);
+
+	if (++pool->puts == DOC_POOL_PERIOD) {
+		// Sizes follow the high-water marks of the last period
+		pool->v_nitems = MAX(pool->v_min, pool->v_hw);
+		pool->s_nitems = MAX(pool->s_min, pool->s_hw);
+		pool->mb_nitems = MAX(pool->mb_min, pool->mb_hw);
+		pool->v_hw = 0;
+		pool->s_hw = 0;
+		pool->mb_hw = 0;
+		pool->puts = 0;
+	}
+
+	doc_unlock(&pool->lock);
+
+	const size_t v_nitems = doc_pool_size(doc->v_nitems, v_used, v_target);
+	const size_t s_nitems = doc_pool_size(doc->s_nitems, s_used, s_target);
+	const size_t mb_nitems = doc_pool_size(doc->mb_nitems, mb_used,
+	    mb_target);
+
+	if (v_nitems != doc->v_nitems || s_nitems != doc->s_nitems ||
+	    mb_nitems != doc->mb_nitems) {
+		struct doc_pool_entry *n = doc_pool_entry(pool->allocator,
+		    v_nitems, s_nitems, mb_nitems);
+
+		// Keeps the current document if resizing fails
+		if (n != NULL) {
+			doc_pool_entry_free(pool->allocator, e);
+			e = n;
+		}
+	}
+
+	wcjson_document_reset(&e->doc);
+	e->doc.mb_utf8 = false;
+	e->doc.allocator = pool->allocator;
+
+	doc_lock(&pool->lock);
+	e->next = pool->free;
+	pool->free = e;
+	doc_unlock(&pool->lock);
+}
+
+void
+wcjson_document_pool_destroy(struct wcjson_document_pool *pool)
+{
+	if (pool == NULL)
+		return;
+
+	while (pool->free != NULL) {
+		struct doc_pool_entry *e = pool->free;
+
+		pool->free = e->next;
+		doc_pool_entry_free(pool->allocator, e);
+	}
+
+	doc_lock_destroy(&pool->lock);
+	pool->allocator->deallocate(pool->allocator->ctx, pool);
+}
+
+static void *
+doc_object_start(struct wcjson *ctx, void *doc, void *parent)
+{
+	const int saved_errno = errno;
+	struct wcjson_document *d = doc;
+
+	errno = 0;
+	struct wcjson_value *v = wcjson_document_nextv(d, true);
+
+	if (errno)
+		goto err;
+
+	errno = saved_errno;
+
+	if (v != NULL)
+		v->is_object = 1;
+
+	return v;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	errno = saved_errno;
+	return v;
+}
+
+static void
+doc_object_add(struct wcjson *ctx, void *doc, void *obj, void *key,
+    void *value)
+{
+	struct wcjson_document *d = doc;
+
+	if (obj != NULL && key != NULL && value != NULL) {
+		struct wcjson_value *o = obj;
+		struct wcjson_value *pair = key;
+		struct wcjson_value *v = value;
+
+		pair->is_string = 0;
+		pair->is_pair = 1;
+		pair->head_idx = v->idx;
+		pair->tail_idx = v->idx;
+
+		if (o->head_idx == 0) {
+			o->head_idx = pair->idx;
+			o->tail_idx = pair->idx;
+		} else {
+			d->values[o->tail_idx].next_idx = pair->idx;
+			pair->prev_idx = o->tail_idx;
+			o->tail_idx = pair->idx;
+		}
+	}
+}
+
+static void
+doc_object_end(struct wcjson *ctx, void *doc, void *obj)
+{
+}
+
+static void *
+doc_array_start(struct wcjson *ctx, void *doc, void *parent)
+{
+	const int saved_errno = errno;
+	struct wcjson_document *d = doc;
+
+	errno = 0;
+	struct wcjson_value *v = wcjson_document_nextv(d, true);
+
+	if (errno)
+		goto err;
+
+	errno = saved_errno;
+
+	if (v != NULL)
+		v->is_array = 1;
+
+	return v;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	errno = saved_errno;
+	return v;
+}
+
+static void
+doc_array_add(struct wcjson *ctx, void *doc, void *arr,
+    void *value)
+{
+	struct wcjson_document *d = doc;
+
+	if (arr != NULL && value != NULL) {
+		struct wcjson_value *a = arr;
+		struct wcjson_value *v = value;
+
+		if (a->head_idx == 0) {
+			a->head_idx = v->idx;
+			a->tail_idx = v->idx;
+		} else {
+			d->values[a->tail_idx].next_idx = v->idx;
+			v->prev_idx = a->tail_idx;
+			a->tail_idx = v->idx;
+		}
+	}
+}
+
+static void
+doc_array_end(struct wcjson *ctx, void *doc, void *arr)
+{
+}
+
+static void *
+doc_string_value(struct wcjson *ctx, void *doc, const wchar_t *str,
+    const size_t len, const bool escaped)
+{
+	const int saved_errno = errno;
+	struct wcjson_document *d = doc;
+
+	errno = 0;
+	struct wcjson_value *v = wcjson_document_nextv(d, true);
+
+	if (errno)
+		goto err;
+
+	errno = saved_errno;
+
+	if (v != NULL) {
+		v->is_string = 1;
+		v->string = str;
+		v->s_len = len;
+	}
+
+	const size_t s_nitems_cnt = d->s_nitems_cnt + len + 1;
+
+	if (s_nitems_cnt < d->s_nitems_cnt)
+		goto err_range;
+
+	d->s_nitems_cnt = s_nitems_cnt;
+	return v;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	errno = saved_errno;
+	return v;
+err_range:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = ERANGE;
+	errno = saved_errno;
+	return v;
+}
+
+static void *
+doc_number_value(struct wcjson *ctx, void *doc, const wchar_t *num,
+    const size_t len)
+{
+	const int saved_errno = errno;
+	struct wcjson_document *d = doc;
+
+	errno = 0;
+	struct wcjson_value *v = wcjson_document_nextv(d, true);
+
+	if (errno)
+		goto err;
+
+	errno = saved_errno;
+
+	if (v != NULL) {
+		v->is_number = 1;
+		v->string = num;
+		v->s_len = len;
+	}
+
+	const size_t s_nitems_cnt = d->s_nitems_cnt + len + 1;
+
+	if (s_nitems_cnt < d->s_nitems_cnt)
+		goto err_range;
+
+	d->s_nitems_cnt = s_nitems_cnt;
+	return v;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	errno = saved_errno;
+	return v;
+err_range:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = ERANGE;
+	errno = saved_errno;
+	return v;
+}
+
+static void *
+doc_bool_value(struct wcjson *ctx, void *doc, const bool value)
+{
+	const int saved_errno = errno;
+	struct wcjson_document *d = doc;
+
+	errno = 0;
+	struct wcjson_value *v = wcjson_document_nextv(d, true);
+
+	if (errno)
+		goto err;
+
+	errno = saved_errno;
+
+	if (v != NULL) {
+		v->is_boolean = 1;
+		v->is_true = value ? 1 : 0;
+	}
+
+	return v;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	errno = saved_errno;
+	return v;
+}
+
+static void *
+doc_null_value(struct wcjson *ctx, void *doc)
+{
+	const int saved_errno = errno;
+	struct wcjson_document *d = doc;
+
+	errno = 0;
+	struct wcjson_value *v = wcjson_document_nextv(d, true);
+
+	if (errno)
+		goto err;
+
+	errno = saved_errno;
+
+	if (v != NULL)
+		v->is_null = 1;
+
+	return v;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	errno = saved_errno;
+	return v;
+}
+
+static int
+doc_unesc_at(struct wcjson_document *d, struct wcjson_value *v,
+    size_t *nextp, const size_t nitems)
+{
+	if (v->is_string || v->is_pair) {
+		size_t dst_len = nitems - *nextp;
+		wchar_t *dst = &d->strings[*nextp];
+
+		if (wcjsonstowc(v->string, v->s_len, dst, &dst_len) < 0)
+			return -1;
+
+		dst[dst_len] = L'\0';
+
+		const size_t next = *nextp + dst_len + 1;
+
+		if (next < *nextp || next > nitems)
+			goto err_range;
+
+		v->string = dst;
+		v->s_len = dst_len;
+
+		*nextp = next;
+	} else if (v->is_number) {
+		size_t dst_len = nitems - *nextp;
+		wchar_t *dst = &d->strings[*nextp];
+
+		if (v->s_len == SIZE_MAX || dst_len < v->s_len + 1)
+			goto err_range;
+
+		wmemcpy(dst, v->string, v->s_len);
+		dst[v->s_len] = L'\0';
+
+		const size_t next = *nextp + v->s_len + 1;
+
+		if (next < *nextp || next > nitems)
+			goto err_range;
+
+		v->string = dst;
+
+		*nextp = next;
+	}
+
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+static int
+doc_unesc(struct wcjson *ctx, struct wcjson_document *d,
+    struct wcjson_value *v)
+{
+	if (doc_unesc_at(d, v, &d->s_next, d->s_nitems) < 0) {
+		ctx->status = WCJSON_ABORT_ERROR;
+		ctx->errnum = errno;
+		return -1;
+	}
+
+	return 0;
+}
+
+static int
+doc_mblen(const struct wcjson_document *d, const struct wcjson_value *v,
+    size_t *mb_lenp)
+{
+	if (d->mb_utf8) {
+		*mb_lenp = 0;
+		return wctoutf8s(v->string, v->s_len, NULL, mb_lenp);
+	}
+
+	const wchar_t *src = v->string;
+	mbstate_t mbs;
+
+	memset(&mbs, 0, sizeof(mbs));
+
+	if ((*mb_lenp = wcsrtombs(NULL, &src, 0, &mbs)) == (size_t)-1)
+		return -1;
+
+	return 0;
+}
+
+static int
+doc_mbsize(const struct wcjson_document *d, const struct wcjson_value *v,
+    size_t *mb_nitems_cntp)
+{
+	size_t mb_len;
+
+	if (doc_mblen(d, v, &mb_len) < 0)
+		return -1;
+
+	const size_t mb_nitems_cnt = *mb_nitems_cntp + mb_len + 1;
+
+	if (mb_nitems_cnt < *mb_nitems_cntp)
+		goto err_range;
+
+	*mb_nitems_cntp = mb_nitems_cnt;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+static int
+doc_mbstring_at(struct wcjson_document *d, struct wcjson_value *v,
+    size_t *nextp, const size_t nitems)
+{
+	size_t dst_len = nitems - *nextp;
+	char *dst = &d->mbstrings[*nextp];
+	size_t mb_len;
+
+	if (d->mb_utf8) {
+		if (dst_len == 0)
+			goto err_range;
+
+		mb_len = dst_len - 1;
+
+		if (wctoutf8s(v->string, v->s_len, dst, &mb_len) < 0)
+			return -1;
+
+		dst[mb_len] = '\0';
+	} else {
+		const wchar_t *src = v->string;
+		mbstate_t mbs;
+
+		memset(&mbs, 0, sizeof(mbs));
+		mb_len = wcsrtombs(dst, &src, dst_len, &mbs);
+
+		if (mb_len == (size_t)-1)
+			return -1;
+
+		if (mb_len == dst_len)
+			goto err_range;
+	}
+
+	const size_t next = *nextp + mb_len + 1;
+
+	if (next < *nextp || next > nitems)
+		goto err_range;
+
+	v->mbstring = dst;
+	v->mb_len = mb_len;
+
+	*nextp = next;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+static int
+doc_mbstring(struct wcjson_document *d, struct wcjson_value *v)
+{
+	return doc_mbstring_at(d, v, &d->mb_next, d->mb_nitems);
+}
+
+static int
+doc_mbstrings(struct wcjson *ctx, struct wcjson_document *d,
+    struct wcjson_value *v)
+{
+	if (v->is_string || v->is_pair || v->is_number) {
+		if (d->mbstrings == NULL) {
+			if (doc_mbsize(d, v, &d->mb_nitems_cnt) < 0)
+				goto err;
+		} else if (v->mbstring == NULL && doc_mbstring(d, v) < 0)
+			goto err;
+	}
+
+	return 0;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	return -1;
+}
+
+static inline struct doc_task *
+doc_task_at(void *tasks, const size_t i, const size_t size)
+{
+	return (struct doc_task *)((char *)tasks + i * size);
+}
+
+static DOC_THREAD_RESULT
+doc_task_run(void *arg)
+{
+	struct doc_task *t = arg;
+
+	if (t->run(t) < 0)
+		t->errnum = errno;
+
+	return DOC_THREAD_EXIT;
+}
+
+/*
+ * Runs every task of an array of structures starting with a doc_task on a
+ * thread of its own, the first one on the calling thread, and falls back to
+ * the calling thread for tasks no thread could be created for.
+ */
+static int
+doc_tasks_run(void *tasks, const size_t ntasks, const size_t size,
+    int (*run)(void *))
+{
+	DOC_THREAD threads[DOC_THREADS_MAX];
+	bool started[DOC_THREADS_MAX];
+
+	for (size_t i = 0; i < ntasks; i++) {
+		struct doc_task *t = doc_task_at(tasks, i, size);
+
+		t->run = run;
+		t->errnum = 0;
+		started[i] = i > 0 &&
+		    doc_thread_create(&threads[i], doc_task_run, t) == 0;
+	}
+
+	for (size_t i = 0; i < ntasks; i++)
+		if (!started[i])
+			(void)doc_task_run(doc_task_at(tasks, i, size));
+
+	for (size_t i = 1; i < ntasks; i++)
+		if (started[i])
+			doc_thread_join(threads[i]);
+
+	for (size_t i = 0; i < ntasks; i++) {
+		const int errnum = doc_task_at(tasks, i, size)->errnum;
+
+		if (errnum != 0) {
+			errno = errnum;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static inline int
+doc_ranges_run(struct doc_range *ranges, const size_t nranges,
+    int (*run)(void *))
+{
+	return doc_tasks_run(ranges, nranges, sizeof(*ranges), run);
+}
+
+/*
+ * Splits the values of a document into ranges of about the same number of
+ * values.
+ */
+static size_t
+doc_ranges(struct wcjson_document *d, struct doc_range *ranges,
+    size_t nthreads)
+{
+	nthreads = MIN(nthreads, DOC_THREADS_MAX);
+	nthreads = MIN(nthreads, MAX(d->v_next, 1));
+
+	const size_t quot = d->v_next / nthreads;
+	const size_t rem = d->v_next % nthreads;
+	size_t v_begin = 0;
+
+	for (size_t i = 0; i < nthreads; i++) {
+		ranges[i] = (struct doc_range){
+			.doc = d,
+			.v_begin = v_begin,
+			.v_end = v_begin + quot + (i < rem ? 1 : 0),
+		};
+		v_begin = ranges[i].v_end;
+	}
+
+	return nthreads;
+}
+
+/*
+ * Assigns consecutive offsets starting at next to ranges needing nitems_cnt
+ * items each.
+ */
+static int
+doc_ranges_offsets(struct doc_range *ranges, const size_t nranges,
+    size_t next, const size_t nitems, size_t *nextp)
+{
+	for (size_t i = 0; i < nranges; i++) {
+		const size_t end = next + ranges[i].nitems_cnt;
+
+		if (end < next || end > nitems)
+			goto err_range;
+
+		ranges[i].next = next;
+		ranges[i].nitems = end;
+		next = end;
+	}
+
+	*nextp = next;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+static int
+doc_range_ssize(void *task)
+{
+	struct doc_range *r = task;
+	const struct wcjson_value *values = r->doc->values;
+	size_t cnt = 0;
+
+	for (size_t i = r->v_begin; i < r->v_end; i++) {
+		const struct wcjson_value *v = &values[i];
+
+		if (!(v->is_string || v->is_pair || v->is_number))
+			continue;
+
+		const size_t next = cnt + v->s_len + 1;
+
+		if (next <= cnt)
+			goto err_range;
+
+		cnt = next;
+	}
+
+	r->nitems_cnt = cnt;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+static int
+doc_range_unesc(void *task)
+{
+	struct doc_range *r = task;
+	struct wcjson_document *d = r->doc;
+
+	for (size_t i = r->v_begin; i < r->v_end; i++)
+		if (doc_unesc_at(d, &d->values[i], &r->next, r->nitems) < 0)
+			return -1;
+
+	return 0;
+}
+
+static int
+doc_range_mbsize(void *task)
+{
+	struct doc_range *r = task;
+	const struct wcjson_document *d = r->doc;
+	size_t cnt = 0;
+
+	for (size_t i = r->v_begin; i < r->v_end; i++) {
+		const struct wcjson_value *v = &d->values[i];
+
+		if (!(v->is_string || v->is_pair || v->is_number))
+			continue;
+
+		// Converted values need no room when converting the rest
+		if (d->mbstrings != NULL && v->mbstring != NULL)
+			continue;
+
+		if (doc_mbsize(d, v, &cnt) < 0)
+			return -1;
+	}
+
+	r->nitems_cnt = cnt;
+	return 0;
+}
+
+static int
+doc_range_mbstring(void *task)
+{
+	struct doc_range *r = task;
+	struct wcjson_document *d = r->doc;
+
+	for (size_t i = r->v_begin; i < r->v_end; i++) {
+		struct wcjson_value *v = &d->values[i];
+
+		if (!(v->is_string || v->is_pair || v->is_number) ||
+		    v->mbstring != NULL)
+			continue;
+
+		if (doc_mbstring_at(d, v, &r->next, r->nitems) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Keeps all state of a walk on the stack of the calling thread, so that any
+ * number of threads can walk the same document. Only nesting levels exceeding
+ * DOC_WALK_DEPTH are tracked in memory of the allocator of the document.
+ */
+static int
+doc_walk(const struct wcjson_document *d, const struct wcjson_value *root,
+    const struct doc_walk_ops *ops, void *arg)
+{
+	size_t stack_local[DOC_WALK_DEPTH];
+	const struct wcjson_allocator *a = DOC_ALLOCATOR(d);
+	size_t *stack = stack_local;
+	size_t depth = 0, nitems = DOC_WALK_DEPTH;
+	const struct wcjson_value *v = root;
+	int r = -1;
+
+	for (;;) {
+		if (!VALUE_IS_VALID(v)) {
+			errno = EINVAL;
+			goto out;
+		}
+
+		if (ops->value(arg, d, v) < 0)
+			goto out;
+
+		if ((v->is_array || v->is_object || v->is_pair) &&
+		    v->head_idx != 0) {
+			if (depth == nitems) {
+				size_t *p;
+
+				if (nitems > SIZE_MAX / 2 / sizeof(size_t)) {
+					errno = ENOMEM;
+					goto out;
+				}
+
+				if (stack == stack_local) {
+					p = a->allocate(a->ctx,
+					    nitems * 2 * sizeof(size_t));
+
+					if (p != NULL)
+						memcpy(p, stack_local,
+						    sizeof(stack_local));
+				} else
+					p = a->reallocate(a->ctx, stack,
+					    nitems * 2 * sizeof(size_t));
+
+				if (p == NULL)
+					goto out;
+
+				stack = p;
+				nitems *= 2;
+			}
+
+			stack[depth++] = v->idx;
+			v = &d->values[v->head_idx];
+			continue;
+		}
+
+		if ((v->is_array || v->is_object) && ops->end(arg, d, v) < 0)
+			goto out;
+
+		while (depth > 0 && v->next_idx == 0) {
+			v = &d->values[stack[--depth]];
+
+			if (ops->end(arg, d, v) < 0)
+				goto out;
+		}
+
+		if (depth == 0)
+			break;
+
+		if (ops->next(arg, d, v) < 0)
+			goto out;
+
+		v = &d->values[v->next_idx];
+	}
+
+	r = 0;
+out:
+	if (stack != stack_local)
+		a->deallocate(a->ctx, stack);
+
+	return r;
+}
+
+static int
+doc_out_bytes(struct doc_out_file *o, const char *b, size_t len)
+{
+	if (o->f != NULL)
+		return fwrite(b, sizeof(char), len, o->f) == len ? 0 : -1;
+
+	while (len > 0) {
+		const ssize_t n = write(o->fd, b, len);
+
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+
+			return -1;
+		}
+
+		b += n;
+		len -= (size_t)n;
+	}
+
+	return 0;
+}
+
+/* Relies on doc_out terminating the chunk it passes in. */
+static int
+doc_out_file(void *ctx, const wchar_t *s, size_t s_len)
+{
+	struct doc_out_file *o = ctx;
+	char b[DOC_OUT_BYTES];
+
+	// Streams without orientation become wide oriented like with putwc
+	if (o->f != NULL && fwide(o->f, 1) > 0)
+		return fputws(s, o->f) == -1 ? -1 : 0;
+
+	while (s_len > 0) {
+		size_t n, b_len = sizeof(b);
+
+		if (o->utf8) {
+			n = MIN(s_len, DOC_OUT_BYTES / 4);
+#if defined(WCHAR_T_UTF16)
+			// Keep UTF 16 surrogates together
+			if (n < s_len && n > 1 && s[n - 1] >= 0xd800 &&
+			    s[n - 1] <= 0xdbff)
+				n--;
+#endif
+			if (wctoutf8s(s, n, b, &b_len) < 0)
+				return -1;
+		} else {
+			const wchar_t *p = s;
+
+			b_len = wcsrtombs(b, &p, sizeof(b), &o->mbs);
+
+			if (b_len == (size_t)-1)
+				return -1;
+
+			n = p == NULL ? s_len : (size_t)(p - s);
+		}
+
+		if (doc_out_bytes(o, b, b_len) < 0)
+			return -1;
+
+		s += n;
+		s_len -= n;
+	}
+
+	return 0;
+}
+
+static int
+doc_out_flush(struct doc_out *o)
+{
+	const size_t len = o->pos;
+
+	if (len == 0)
+		return 0;
+
+	if (o->terminate)
+		o->buf[len] = L'\0';
+
+	o->pos = 0;
+	return o->sink(o->sink_ctx, o->buf, len);
+}
+
+static int
+doc_out_put(struct doc_out *o, const wchar_t *s, size_t len)
+{
+	while (len > 0) {
+		if (o->pos == o->nitems && doc_out_flush(o) < 0)
+			return -1;
+
+		const size_t n = MIN(len, o->nitems - o->pos);
+
+		wmemcpy(&o->buf[o->pos], s, n);
+		o->pos += n;
+		s += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/*
+ * Number of characters out of the first n of s to escape at once without
+ * splitting a character encoded by multiple wide characters.
+ */
+static size_t
+doc_out_slice(const wchar_t *s, const size_t s_len, size_t n)
+{
+	if (n >= s_len)
+		return s_len;
+
+#if defined(WCHAR_T_UTF16)
+	if (s[n - 1] >= 0xd800 && s[n - 1] <= 0xdbff)
+		n = n > 1 ? n - 1 : n + 1;
+#elif defined(WCHAR_T_UTF8)
+	size_t m = n;
+
+	while (m > 0 && (s[m] & 0xc0) == 0x80)
+		m--;
+
+	if (m == 0) {
+		while (n < s_len && (s[n] & 0xc0) == 0x80)
+			n++;
+	} else
+		n = m;
+#endif
+	return n;
+}
+
+static int
+doc_out_esc(struct doc_out *o, const wchar_t *s, size_t s_len)
+{
+	while (s_len > 0) {
+		if (o->nitems - o->pos < WCJSON_ESCAPE_MAX &&
+		    doc_out_flush(o) < 0)
+			return -1;
+
+		size_t e_len = o->nitems - o->pos;
+		const size_t n = doc_out_slice(s, s_len,
+		    e_len / WCJSON_ESCAPE_MAX);
+
+		if (o->asc) {
+			if (wctoascjsons(s, n, &o->buf[o->pos], &e_len) < 0)
+				return -1;
+		} else {
+			if (wctowcjsons(s, n, &o->buf[o->pos], &e_len) < 0)
+				return -1;
+		}
+
+		o->pos += e_len;
+		s += n;
+		s_len -= n;
+	}
+
+	return 0;
+}
+
+static int
+doc_out_value(void *arg, const struct wcjson_document *d,
+    const struct wcjson_value *v)
+{
+	struct doc_out *o = arg;
+
+	if (v->is_null) {
+		if (doc_out_put(o, L"null", 4) < 0)
+			return -1;
+	} else if (v->is_boolean) {
+		if (v->is_true) {
+			if (doc_out_put(o, L"true", 4) < 0)
+				return -1;
+		} else {
+			if (doc_out_put(o, L"false", 5) < 0)
+				return -1;
+		}
+	} else if (v->is_string || v->is_pair) {
+		if (doc_out_put(o, L"\"", 1) < 0)
+			return -1;
+
+		if (doc_out_esc(o, v->string, v->s_len) < 0)
+			return -1;
+
+		if (doc_out_put(o, v->is_pair ? L"\":" : L"\"",
+		    v->is_pair ? 2 : 1) < 0)
+			return -1;
+	} else if (v->is_number) {
+		if (doc_out_put(o, v->string, v->s_len) < 0)
+			return -1;
+	} else if (v->is_array) {
+		if (doc_out_put(o, L"[", 1) < 0)
+			return -1;
+	} else if (v->is_object) {
+		if (doc_out_put(o, L"{", 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+doc_out_next(void *arg, const struct wcjson_document *d,
+    const struct wcjson_value *v)
+{
+	return doc_out_put(arg, L",", 1);
+}
+
+static int
+doc_out_end(void *arg, const struct wcjson_document *d,
+    const struct wcjson_value *v)
+{
+	if (v->is_array)
+		return doc_out_put(arg, L"]", 1);
+
+	if (v->is_object)
+		return doc_out_put(arg, L"}", 1);
+
+	return 0;
+}
+
+static const struct doc_walk_ops doc_out_ops = {
+	.value = doc_out_value,
+	.next = doc_out_next,
+	.end = doc_out_end,
+};
+
+static int
+doc_out(struct doc_out *o, const struct wcjson_document *d,
+    const struct wcjson_value *v)
+{
+	if (o->nitems < WCJSON_ESCAPE_MAX)
+		goto err_inval;
+
+	if (doc_walk(d, v, &doc_out_ops, o) < 0)
+		return -1;
+
+	return doc_out_flush(o);
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+static int
+doc_out_fd(FILE *f, int fd, bool asc, const struct wcjson_document *d,
+    const struct wcjson_value *v)
+{
+	wchar_t buf[DOC_OUT_NITEMS + 1];
+	struct doc_out_file of = {
+		.f = f,
+		.fd = fd,
+		.utf8 = d->mb_utf8,
+	};
+	struct doc_out o = {
+		.buf = buf,
+		.nitems = DOC_OUT_NITEMS,
+		.pos = 0,
+		.sink = doc_out_file,
+		.sink_ctx = &of,
+		.terminate = true,
+		.asc = asc,
+	};
+
+	return doc_out(&o, d, v);
+}
+
+struct doc_out_mb {
+	char *d;
+	size_t d_len;
+};
+
+static int
+doc_out_mb(void *ctx, const wchar_t *s, size_t s_len)
+{
+	struct doc_out_mb *o = ctx;
+	size_t n = o->d_len;
+
+	if (wctoutf8s(s, s_len, o->d, &n) < 0)
+		return -1;
+
+	o->d += n;
+	o->d_len -= n;
+	return 0;
+}
+
+/* Serializes to UTF-8 encoded bytes independent of the current locale. */
+static int
+doc_sprintmb(char *d, size_t *d_lenp, bool asc,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *v)
+{
+	wchar_t buf[DOC_OUT_NITEMS];
+	struct doc_out_mb mb = {
+		.d = d,
+		.d_len = *d_lenp,
+	};
+	struct doc_out o = {
+		.buf = buf,
+		.nitems = DOC_OUT_NITEMS,
+		.pos = 0,
+		.sink = doc_out_mb,
+		.sink_ctx = &mb,
+		.terminate = false,
+		.asc = asc,
+	};
+
+	if (doc_out(&o, doc, v) < 0)
+		return -1;
+
+	*d_lenp -= mb.d_len;
+	return 0;
+}
+
+static inline size_t
+doc_snapshot_align(size_t off)
+{
+	return (off + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+}
+
+static int
+doc_snapshot_pad(struct doc_out_file *o, size_t pad)
+{
+	static const char zero[ARENA_ALIGN];
+
+	return pad > 0 ? doc_out_bytes(o, zero, pad) : 0;
+}
+
+/* Tests all strings of d to be stored in its strings and mbstrings arrays. */
+static int
+doc_snapshot_check(const struct wcjson_document *d)
+{
+	if (d->v_next > d->v_nitems || d->s_next > d->s_nitems ||
+	    d->mb_next > d->mb_nitems || d->v_free != 0)
+		goto err_inval;
+
+	for (size_t i = 0; i < d->v_next; i++) {
+		const struct wcjson_value *v = &d->values[i];
+
+		if (v->string != NULL && (v->string < d->strings ||
+		    v->string > d->strings + d->s_next ||
+		    v->s_len > (size_t)(d->strings + d->s_next - v->string)))
+			goto err_inval;
+
+		if (v->mbstring != NULL && (v->mbstring < d->mbstrings ||
+		    v->mbstring > d->mbstrings + d->mb_next ||
+		    v->mb_len > (size_t)(d->mbstrings + d->mb_next -
+		    v->mbstring)))
+			goto err_inval;
+	}
+
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+/*
+ * Writes the values of d with the string and mbstring pointers replaced by
+ * offsets into the strings and mbstrings arrays plus one, keeping NULL.
+ */
+static int
+doc_snapshot_values(struct doc_out_file *o, const struct wcjson_document *d)
+{
+	struct wcjson_value buf[DOC_SNAPSHOT_NITEMS];
+
+	for (size_t i = 0; i < d->v_next; i += DOC_SNAPSHOT_NITEMS) {
+		const size_t n = MIN(DOC_SNAPSHOT_NITEMS, d->v_next - i);
+
+		memcpy(buf, &d->values[i], n * sizeof(struct wcjson_value));
+
+		for (size_t j = 0; j < n; j++) {
+			struct wcjson_value *v = &buf[j];
+
+			if (v->string != NULL)
+				v->string = (const wchar_t *)(uintptr_t)
+				    (v->string - d->strings + 1);
+
+			if (v->mbstring != NULL)
+				v->mbstring = (const char *)(uintptr_t)
+				    (v->mbstring - d->mbstrings + 1);
+		}
+
+		if (doc_out_bytes(o, (const char *)buf,
+		    n * sizeof(struct wcjson_value)) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Tests the values of d to form trees in linear time. Children are claimed by
+ * storing the index of their parent in their idx member, so that every value
+ * can have one parent only and the trees can be walked from the values left
+ * unclaimed without a stack, before all idx members get restored.
+ */
+static int
+doc_snapshot_tree(struct wcjson_document *d)
+{
+	struct wcjson_value *const values = d->values;
+	size_t n = 0;
+
+	for (size_t i = 0; i < d->v_nitems; i++) {
+		const struct wcjson_value *v = &values[i];
+		const bool container = v->is_object || v->is_array ||
+		    v->is_pair;
+		size_t prev = 0;
+
+		if (v->head_idx == 0 ? v->tail_idx != 0 || v->is_pair :
+		    !container)
+			goto err_inval;
+
+		for (size_t c = v->head_idx; c != 0; c = values[c].next_idx) {
+			struct wcjson_value *child = &values[c];
+
+			if (c == i || child->idx != c || child->prev_idx != prev ||
+			    child->is_pair != v->is_object ||
+			    (v->is_pair && c != v->tail_idx))
+				goto err_inval;
+
+			child->idx = i;
+			prev = c;
+		}
+
+		if (prev != v->tail_idx)
+			goto err_inval;
+	}
+
+	for (size_t r = 0; r < d->v_nitems; r++) {
+		if (values[r].idx != r)
+			continue;
+
+		if (values[r].prev_idx != 0 || values[r].next_idx != 0)
+			goto restore;
+
+		for (size_t i = r; i != SIZE_MAX; n++) {
+			if (values[i].head_idx != 0) {
+				i = values[i].head_idx;
+				continue;
+			}
+
+			while (i != r && values[i].next_idx == 0)
+				i = values[i].idx;
+
+			i = i != r ? values[i].next_idx : SIZE_MAX;
+		}
+	}
+
+restore:
+	for (size_t i = 0; i < d->v_nitems; i++)
+		values[i].idx = i;
+
+	// Values in cycles are not reachable from any unclaimed value
+	if (n != d->v_nitems)
+		goto err_inval;
+
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Resolves the offsets of the values of d, validating all of them. */
+static int
+doc_snapshot_fixup(struct wcjson_document *d)
+{
+	for (size_t i = 0; i < d->v_nitems; i++) {
+		struct wcjson_value *v = &d->values[i];
+		const uintptr_t s_off = (uintptr_t)v->string;
+		const uintptr_t mb_off = (uintptr_t)v->mbstring;
+
+		if (v->idx != i || v->head_idx >= d->v_nitems ||
+		    v->tail_idx >= d->v_nitems || v->prev_idx >= d->v_nitems ||
+		    v->next_idx >= d->v_nitems)
+			goto err_inval;
+
+		if (s_off != 0) {
+			if (s_off - 1 > d->s_nitems ||
+			    v->s_len > d->s_nitems - (s_off - 1))
+				goto err_inval;
+
+			v->string = &d->strings[s_off - 1];
+		}
+
+		if (mb_off != 0) {
+			if (mb_off - 1 > d->mb_nitems ||
+			    v->mb_len > d->mb_nitems - (mb_off - 1))
+				goto err_inval;
+
+			v->mbstring = &d->mbstrings[mb_off - 1];
+		}
+
+		if (!VALUE_IS_VALID(v))
+			goto err_inval;
+	}
+
+	return doc_snapshot_tree(d);
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+struct doc_sprint_arg {
+	wchar_t *d;
+	size_t d_len;
+	bool asc;
+};
+
+static inline int
+doc_sprint_copy(struct doc_sprint_arg *a, const wchar_t *s, size_t s_len)
+{
+	if (a->d_len < s_len)
+		goto err_range;
+
+	wmemcpy(a->d, s, s_len);
+	a->d += s_len;
+	a->d_len -= s_len;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+static int
+doc_sprint_value(void *arg, const struct wcjson_document *doc,
+    const struct wcjson_value *v)
+{
+	struct doc_sprint_arg *a = arg;
+
+	if (v->is_null) {
+		if (doc_sprint_copy(a, L"null", 4) < 0)
+			return -1;
+	} else if (v->is_boolean) {
+		if (v->is_true) {
+			if (doc_sprint_copy(a, L"true", 4) < 0)
+				return -1;
+		} else {
+			if (doc_sprint_copy(a, L"false", 5) < 0)
+				return -1;
+		}
+	} else if (v->is_string || v->is_pair) {
+		if (doc_sprint_copy(a, L"\"", 1) < 0)
+			return -1;
+
+		size_t e_len = a->d_len;
+
+		if (a->asc) {
+			if (wctoascjsons(v->string, v->s_len, a->d, &e_len) < 0)
+				return -1;
+		} else {
+			if (wctowcjsons(v->string, v->s_len, a->d, &e_len) < 0)
+				return -1;
+		}
+
+		a->d += e_len;
+		a->d_len -= e_len;
+
+		if (doc_sprint_copy(a, L"\"", 1) < 0)
+			return -1;
+
+		if (v->is_pair && doc_sprint_copy(a, L":", 1) < 0)
+			return -1;
+	} else if (v->is_number) {
+		if (doc_sprint_copy(a, v->string, v->s_len) < 0)
+			return -1;
+	} else if (v->is_array) {
+		if (doc_sprint_copy(a, L"[", 1) < 0)
+			return -1;
+	} else if (v->is_object) {
+		if (doc_sprint_copy(a, L"{", 1) < 0)
+			return -1;
+	}
+
+	return 0;
+}
+
+static int
+doc_sprint_next(void *arg, const struct wcjson_document *doc,
+    const struct wcjson_value *v)
+{
+	return doc_sprint_copy(arg, L",", 1);
+}
+
+static int
+doc_sprint_end(void *arg, const struct wcjson_document *doc,
+    const struct wcjson_value *v)
+{
+	if (v->is_array)
+		return doc_sprint_copy(arg, L"]", 1);
+
+	if (v->is_object)
+		return doc_sprint_copy(arg, L"}", 1);
+
+	return 0;
+}
+
+static const struct doc_walk_ops doc_sprint_ops = {
+	.value = doc_sprint_value,
+	.next = doc_sprint_next,
+	.end = doc_sprint_end,
+};
+
+static int
+doc_sprint(wchar_t *d, size_t *d_lenp, bool asc,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *v)
+{
+	struct doc_sprint_arg a = {
+		.d = d,
+		.d_len = *d_lenp,
+		.asc = asc,
+	};
+
+	if (doc_walk(doc, v, &doc_sprint_ops, &a) < 0)
+		return -1;
+
+	*d_lenp -= a.d_len;
+	return 0;
+}
+
+static int
+doc_out_count(void *ctx, const wchar_t *s, size_t s_len)
+{
+	size_t *cntp = ctx;
+	const size_t cnt = *cntp + s_len;
+
+	if (cnt < *cntp)
+		goto err_range;
+
+	*cntp = cnt;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+static int
+doc_subtrees_size(void *task)
+{
+	struct doc_subtrees *t = task;
+	wchar_t buf[DOC_OUT_NITEMS];
+	size_t cnt = 0;
+	struct doc_out o = {
+		.buf = buf,
+		.nitems = DOC_OUT_NITEMS,
+		.pos = 0,
+		.sink = doc_out_count,
+		.sink_ctx = &cnt,
+		.terminate = false,
+		.asc = t->asc,
+	};
+	const struct wcjson_value *v = t->head;
+
+	for (size_t i = 0; i < t->count; i++) {
+		if ((i > 0 || !t->first) && doc_out_put(&o, L",", 1) < 0)
+			return -1;
+
+		if (doc_walk(t->doc, v, &doc_out_ops, &o) < 0)
+			return -1;
+
+		v = &t->doc->values[v->next_idx];
+	}
+
+	if (doc_out_flush(&o) < 0)
+		return -1;
+
+	t->d_len = cnt;
+	return 0;
+}
+
+static int
+doc_subtrees_sprint(void *task)
+{
+	struct doc_subtrees *t = task;
+	struct doc_sprint_arg a = {
+		.d = t->d,
+		.d_len = t->d_len,
+		.asc = t->asc,
+	};
+	const struct wcjson_value *v = t->head;
+
+	for (size_t i = 0; i < t->count; i++) {
+		if ((i > 0 || !t->first) && doc_sprint_copy(&a, L",", 1) < 0)
+			return -1;
+
+		if (doc_walk(t->doc, v, &doc_sprint_ops, &a) < 0)
+			return -1;
+
+		v = &t->doc->values[v->next_idx];
+	}
+
+	return 0;
+}
+
+/*
+ * Measures the members or items of a container in ranges of consecutive
+ * subtrees, places the ranges one after the other and renders them into their
+ * part of the output concurrently.
+ */
+static int
+doc_mtsprint(wchar_t *d, size_t *d_lenp, bool asc,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *v, size_t nthreads)
+{
+	struct doc_subtrees trees[DOC_THREADS_MAX];
+
+	if (nthreads == 0 || !VALUE_IS_VALID(v))
+		goto err_inval;
+
+	if (!(v->is_array || v->is_object) || v->head_idx == 0)
+		return doc_sprint(d, d_lenp, asc, doc, v);
+
+	size_t count = 0;
+
+	for (size_t i = v->head_idx; i != 0; i = doc->values[i].next_idx)
+		count++;
+
+	nthreads = MIN(nthreads, DOC_THREADS_MAX);
+	nthreads = MIN(nthreads, count);
+
+	const size_t quot = count / nthreads;
+	const size_t rem = count % nthreads;
+	const struct wcjson_value *head = &doc->values[v->head_idx];
+
+	for (size_t i = 0; i < nthreads; i++) {
+		trees[i] = (struct doc_subtrees){
+			.doc = doc,
+			.head = head,
+			.count = quot + (i < rem ? 1 : 0),
+			.first = i == 0,
+			.asc = asc,
+		};
+
+		for (size_t j = 0; j < trees[i].count; j++)
+			head = &doc->values[head->next_idx];
+	}
+
+	if (doc_tasks_run(trees, nthreads, sizeof(*trees),
+	    doc_subtrees_size) < 0)
+		return -1;
+
+	size_t len = 2;
+
+	for (size_t i = 0; i < nthreads; i++) {
+		const size_t next = len + trees[i].d_len;
+
+		if (next < len)
+			goto err_range;
+
+		len = next;
+	}
+
+	if (len > *d_lenp)
+		goto err_range;
+
+	size_t pos = 0;
+
+	d[pos++] = v->is_array ? L'[' : L'{';
+
+	for (size_t i = 0; i < nthreads; i++) {
+		trees[i].d = &d[pos];
+		pos += trees[i].d_len;
+	}
+
+	d[pos] = v->is_array ? L']' : L'}';
+
+	if (doc_tasks_run(trees, nthreads, sizeof(*trees),
+	    doc_subtrees_sprint) < 0)
+		return -1;
+
+	*d_lenp = len;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+int
+wcjsondocvalues(struct wcjson *ctx, struct wcjson_document *doc,
+    const wchar_t *txt, const size_t len)
+{
+	doc->v_nitems_cnt = 0;
+	doc->s_nitems_cnt = 0;
+
+	return wcjson(ctx, wcjson_document_ops, doc, txt, len);
+}
+
+int
+wcjsondocstrings(struct wcjson *ctx, struct wcjson_document *doc)
+{
+	for (size_t i = 0; i < doc->v_next; i++)
+		if (doc_unesc(ctx, doc, &doc->values[i]) < 0)
+			return -1;
+
+	return 0;
+}
+
+int
+wcjsondocmbstrings(struct wcjson *ctx, struct wcjson_document *doc)
+{
+	if (doc->mbstrings == NULL)
+		doc->mb_nitems_cnt = 0;
+
+	for (size_t i = 0; i < doc->v_next; i++)
+		if (doc_mbstrings(ctx, doc, &doc->values[i]) < 0)
+			return -1;
+
+	return 0;
+}
+
+int
+wcjsondocmtstrings(struct wcjson *ctx, struct wcjson_document *doc,
+    const size_t nthreads)
+{
+	struct doc_range ranges[DOC_THREADS_MAX];
+
+	if (nthreads == 0)
+		goto err_inval;
+
+	const size_t nranges = doc_ranges(doc, ranges, nthreads);
+
+	if (doc_ranges_run(ranges, nranges, doc_range_ssize) < 0 ||
+	    doc_ranges_offsets(ranges, nranges, doc->s_next, doc->s_nitems,
+		&doc->s_next) < 0 ||
+	    doc_ranges_run(ranges, nranges, doc_range_unesc) < 0)
+		goto err;
+
+	return 0;
+err_inval:
+	errno = EINVAL;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	return -1;
+}
+
+int
+wcjsondocmtmbstrings(struct wcjson *ctx, struct wcjson_document *doc,
+    const size_t nthreads)
+{
+	struct doc_range ranges[DOC_THREADS_MAX];
+
+	if (nthreads == 0)
+		goto err_inval;
+
+	const size_t nranges = doc_ranges(doc, ranges, nthreads);
+
+	if (doc_ranges_run(ranges, nranges, doc_range_mbsize) < 0)
+		goto err;
+
+	if (doc->mbstrings == NULL) {
+		size_t cnt = 0;
+
+		if (doc_ranges_offsets(ranges, nranges, 0, SIZE_MAX, &cnt) < 0)
+			goto err;
+
+		doc->mb_nitems_cnt = cnt;
+		return 0;
+	}
+
+	if (doc_ranges_offsets(ranges, nranges, doc->mb_next, doc->mb_nitems,
+		&doc->mb_next) < 0 ||
+	    doc_ranges_run(ranges, nranges, doc_range_mbstring) < 0)
+		goto err;
+
+	return 0;
+err_inval:
+	errno = EINVAL;
+err:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errno;
+	return -1;
+}
+
+static inline int
+doc_arena_err(struct wcjson *ctx)
+{
+	if (ctx->status == WCJSON_OK) {
+		ctx->status = WCJSON_ABORT_ERROR;
+		ctx->errnum = errno;
+	}
+
+	return -1;
+}
+
+int
+wcjsondocarenavalues(struct wcjson *ctx, struct wcjson_arena *a,
+    struct wcjson_document *doc, const wchar_t *txt, const size_t len)
+{
+	size_t v_nitems;
+	struct wcjson_value *values = wcjson_arena_tail(a,
+	    sizeof(struct wcjson_value), &v_nitems);
+
+	if (values == NULL)
+		return doc_arena_err(ctx);
+
+	doc->values = values;
+	doc->v_nitems = v_nitems;
+	doc->v_next = 0;
+	doc->v_free = 0;
+
+	const int r = wcjsondocvalues(ctx, doc, txt, len);
+
+	// Give back what the values did not use
+	if (r < 0) {
+		doc->values = NULL;
+		doc->v_nitems = 0;
+		doc->v_next = 0;
+	} else
+		doc->v_nitems = doc->v_next;
+
+	if (wcjson_arena_shrink(a, values, doc->v_nitems,
+	    sizeof(struct wcjson_value)) < 0)
+		return doc_arena_err(ctx);
+
+	return r;
+}
+
+int
+wcjsondocarenastrings(struct wcjson *ctx, struct wcjson_arena *a,
+    struct wcjson_document *doc)
+{
+	wchar_t *strings = wcjson_arena_alloc(a, doc->s_nitems_cnt,
+	    sizeof(wchar_t));
+
+	if (strings == NULL)
+		return doc_arena_err(ctx);
+
+	doc->strings = strings;
+	doc->s_nitems = doc->s_nitems_cnt;
+	doc->s_next = 0;
+
+	return wcjsondocstrings(ctx, doc);
+}
+
+int
+wcjsondocarenambstrings(struct wcjson *ctx, struct wcjson_arena *a,
+    struct wcjson_document *doc)
+{
+	doc->mbstrings = NULL;
+
+	if (wcjsondocmbstrings(ctx, doc) < 0)
+		return -1;
+
+	char *mbstrings = wcjson_arena_alloc(a, doc->mb_nitems_cnt,
+	    sizeof(char));
+
+	if (mbstrings == NULL)
+		return doc_arena_err(ctx);
+
+	doc->mbstrings = mbstrings;
+	doc->mb_nitems = doc->mb_nitems_cnt;
+	doc->mb_next = 0;
+
+	return wcjsondocmbstrings(ctx, doc);
+}
+
+int
+wcjsondocfprint(FILE *f, const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	return doc_out_fd(f, -1, false, doc, value);
+}
+
+int
+wcjsondocfprintasc(FILE *f, const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	return doc_out_fd(f, -1, true, doc, value);
+}
+
+int
+wcjsondocwrite(int fd, const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	return doc_out_fd(NULL, fd, false, doc, value);
+}
+
+int
+wcjsondocwriteasc(int fd, const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	return doc_out_fd(NULL, fd, true, doc, value);
+}
+
+int
+wcjsondocserialize(const struct wcjson_document *doc,
+    const struct wcjson_value *value,
+    int (*sink)(void *ctx, const wchar_t *s, size_t len), void *sink_ctx,
+    wchar_t *chunk, size_t chunk_len)
+{
+	struct doc_out o = {
+		.buf = chunk,
+		.nitems = chunk_len,
+		.pos = 0,
+		.sink = sink,
+		.sink_ctx = sink_ctx,
+		.terminate = false,
+		.asc = false,
+	};
+
+	return doc_out(&o, doc, value);
+}
+
+int
+wcjsondocserializeasc(const struct wcjson_document *doc,
+    const struct wcjson_value *value,
+    int (*sink)(void *ctx, const wchar_t *s, size_t len), void *sink_ctx,
+    wchar_t *chunk, size_t chunk_len)
+{
+	struct doc_out o = {
+		.buf = chunk,
+		.nitems = chunk_len,
+		.pos = 0,
+		.sink = sink,
+		.sink_ctx = sink_ctx,
+		.terminate = false,
+		.asc = true,
+	};
+
+	return doc_out(&o, doc, value);
+}
+
+int
+wcjsondocsprint(wchar_t *s, size_t *lenp, const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	size_t s_len = *lenp;
+	size_t t_len = s_len;
+	int r = doc_sprint(s, &t_len, false, doc, value);
+
+	if (r < 0)
+		return -1;
+
+	s_len -= t_len;
+
+	if (s_len < 1)
+		goto err_range;
+
+	s[t_len] = L'\0';
+	*lenp -= s_len;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+int
+wcjsondocsprintasc(wchar_t *s, size_t *lenp,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	size_t s_len = *lenp;
+	size_t t_len = s_len;
+	int r = doc_sprint(s, &t_len, true, doc, value);
+
+	if (r < 0)
+		return -1;
+
+	s_len -= t_len;
+
+	if (s_len < 1)
+		goto err_range;
+
+	s[t_len] = L'\0';
+	*lenp -= s_len;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+int
+wcjsondocmtsprint(wchar_t *s, size_t *lenp, const struct wcjson_document *doc,
+    const struct wcjson_value *value, const size_t nthreads)
+{
+	size_t s_len = *lenp;
+	size_t t_len = s_len;
+	int r = doc_mtsprint(s, &t_len, false, doc, value, nthreads);
+
+	if (r < 0)
+		return -1;
+
+	s_len -= t_len;
+
+	if (s_len < 1)
+		goto err_range;
+
+	s[t_len] = L'\0';
+	*lenp -= s_len;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+int
+wcjsondocmtsprintasc(wchar_t *s, size_t *lenp,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *value, const size_t nthreads)
+{
+	size_t s_len = *lenp;
+	size_t t_len = s_len;
+	int r = doc_mtsprint(s, &t_len, true, doc, value, nthreads);
+
+	if (r < 0)
+		return -1;
+
+	s_len -= t_len;
+
+	if (s_len < 1)
+		goto err_range;
+
+	s[t_len] = L'\0';
+	*lenp -= s_len;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+int
+wcjsondocsprintmb(char *s, size_t *lenp, const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	size_t s_len = *lenp;
+	size_t t_len = s_len;
+	int r = doc_sprintmb(s, &t_len, false, doc, value);
+
+	if (r < 0)
+		return -1;
+
+	s_len -= t_len;
+
+	if (s_len < 1)
+		goto err_range;
+
+	s[t_len] = '\0';
+	*lenp -= s_len;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
+int
+wcjsondocsprintmbasc(char *s, size_t *lenp, const struct wcjson_document *doc,
+    const struct wcjson_value *value)
+{
+	size_t s_len = *lenp;
+	size_t t_len = s_len;
+	int r = doc_sprintmb(s, &t_len, true, doc, value);
+
+	if (r < 0)
+		return -1;
+
+	s_len -= t_len;
+
+	if (s_len < 1)
+		goto err_range;
+
+	s[t_len] = '\0';
+	*lenp -= s_len;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+int
+wcjsondocsave(int fd, const struct wcjson_document *doc)
+{
+	struct doc_out_file of = {
+		.f = NULL,
+		.fd = fd,
+	};
+	const size_t v_size = doc->v_next * sizeof(struct wcjson_value);
+	const size_t s_off = doc_snapshot_align(DOC_SNAPSHOT_VALUES + v_size);
+	const size_t s_size = doc->s_next * sizeof(wchar_t);
+	const size_t mb_off = doc_snapshot_align(s_off + s_size);
+	struct doc_snapshot h = {
+		.magic = DOC_SNAPSHOT_MAGIC,
+		.version = DOC_SNAPSHOT_VERSION,
+		.byte_order = 0x01020304,
+		.wchar_size = sizeof(wchar_t),
+		.value_size = sizeof(struct wcjson_value),
+		.size_size = sizeof(size_t),
+		.mb_utf8 = doc->mb_utf8,
+		.v_nitems = doc->v_next,
+		.s_nitems = doc->s_next,
+		.mb_nitems = doc->mb_next,
+		.s_off = s_off,
+		.mb_off = mb_off,
+		.size = mb_off + doc->mb_next,
+	};
+
+	// Nothing is written for documents which cannot be saved
+	if (doc_snapshot_check(doc) < 0)
+		return -1;
+
+	if (doc_out_bytes(&of, (const char *)&h, sizeof(h)) < 0 ||
+	    doc_snapshot_pad(&of, DOC_SNAPSHOT_VALUES - sizeof(h)) < 0)
+		return -1;
+
+	if (doc_snapshot_values(&of, doc) < 0 ||
+	    doc_snapshot_pad(&of, s_off - DOC_SNAPSHOT_VALUES - v_size) < 0)
+		return -1;
+
+	if (doc_out_bytes(&of, (const char *)doc->strings, s_size) < 0 ||
+	    doc_snapshot_pad(&of, mb_off - s_off - s_size) < 0)
+		return -1;
+
+	return doc_out_bytes(&of, doc->mbstrings, doc->mb_next);
+}
+
+int
+wcjsondocload(int fd, struct wcjson_document *doc)
+{
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_SYS_STAT_H)
+	struct doc_snapshot h;
+	struct stat st;
+	char *p;
+
+	if (fstat(fd, &st) < 0)
+		return -1;
+
+	if (st.st_size < (off_t)DOC_SNAPSHOT_VALUES)
+		goto err_inval;
+
+	// Private pages so that only the pages of values are copied on fixup
+	p = mmap(NULL, (size_t)st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+	    fd, 0);
+
+	if (p == MAP_FAILED)
+		return -1;
+
+	memcpy(&h, p, sizeof(h));
+
+	if (memcmp(h.magic, DOC_SNAPSHOT_MAGIC, sizeof(h.magic)) != 0 ||
+	    h.version != DOC_SNAPSHOT_VERSION || h.byte_order != 0x01020304 ||
+	    h.wchar_size != sizeof(wchar_t) ||
+	    h.value_size != sizeof(struct wcjson_value) ||
+	    h.size_size != sizeof(size_t) || h.size != (uint64_t)st.st_size)
+		goto err_unmap;
+
+	// Sections are ordered and bounded before their sizes are subtracted
+	if (h.s_off < DOC_SNAPSHOT_VALUES || h.s_off > h.mb_off ||
+	    h.mb_off > h.size || h.s_off % ARENA_ALIGN != 0)
+		goto err_unmap;
+
+	if (h.v_nitems > (h.s_off - DOC_SNAPSHOT_VALUES) /
+	    sizeof(struct wcjson_value) ||
+	    h.s_nitems > (h.mb_off - h.s_off) / sizeof(wchar_t) ||
+	    h.mb_nitems != h.size - h.mb_off)
+		goto err_unmap;
+
+	struct wcjson_document d = WCJSON_DOCUMENT_INITIALIZER;
+
+	d.values = (struct wcjson_value *)(p + DOC_SNAPSHOT_VALUES);
+	d.v_nitems = d.v_nitems_cnt = d.v_next = (size_t)h.v_nitems;
+	d.strings = (wchar_t *)(p + h.s_off);
+	d.s_nitems = d.s_nitems_cnt = d.s_next = (size_t)h.s_nitems;
+	d.mbstrings = p + h.mb_off;
+	d.mb_nitems = d.mb_nitems_cnt = d.mb_next = (size_t)h.mb_nitems;
+	d.mb_utf8 = h.mb_utf8 != 0;
+
+	if (doc_snapshot_fixup(&d) < 0)
+		goto err_unmap;
+
+	*doc = d;
+	return 0;
+err_unmap:
+	munmap(p, (size_t)st.st_size);
+err_inval:
+	errno = EINVAL;
+	return -1;
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+int
+wcjsondocunload(struct wcjson_document *doc)
+{
+	int r = 0;
+
+#if defined(HAVE_SYS_MMAN_H)
+	if (doc->values != NULL) {
+		char *p = (char *)doc->values - DOC_SNAPSHOT_VALUES;
+		struct doc_snapshot h;
+
+		memcpy(&h, p, sizeof(h));
+		r = munmap(p, (size_t)h.size);
+	}
+#endif
+	*doc = (struct wcjson_document)WCJSON_DOCUMENT_INITIALIZER;
+	return r;
+}
+
+/*
+ * Passes the buffer to the sink or fails with ERANGE without a sink, keeping
+ * the number of characters the current call has written so far to skip them
+ * when that call gets repeated.
+ */
+static int
+doc_writer_drain(struct wcjson_writer *w, const size_t cur)
+{
+	if (w->nitems == 0)
+		goto err_inval;
+
+	if (w->sink == NULL)
+		goto err_range;
+
+	if (w->sink(w->sink_ctx, w->buf, w->pos) < 0)
+		goto err_sink;
+
+	w->pos = 0;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+err_range:
+	errno = ERANGE;
+err_sink:
+	w->skip = cur;
+	return -1;
+}
+
+static int
+doc_writer_put(struct wcjson_writer *w, size_t *cur, const wchar_t *s,
+    size_t len)
+{
+	if (*cur < w->skip) {
+		const size_t n = MIN(len, w->skip - *cur);
+
+		*cur += n;
+		s += n;
+		len -= n;
+	}
+
+	while (len > 0) {
+		if (w->pos == w->nitems && doc_writer_drain(w, *cur) < 0)
+			return -1;
+
+		const size_t n = MIN(len, w->nitems - w->pos);
+
+		wmemcpy(&w->buf[w->pos], s, n);
+		w->pos += n;
+		*cur += n;
+		s += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int
+doc_writer_esc(struct wcjson_writer *w, size_t *cur, const wchar_t *s,
+    size_t s_len)
+{
+	wchar_t e[DOC_WRITER_NITEMS];
+
+	while (s_len > 0) {
+		// Escape directly into the buffer unless resuming or near its end
+		const bool direct = *cur >= w->skip &&
+		    w->nitems - w->pos >= WCJSON_ESCAPE_MAX;
+		wchar_t *d = direct ? &w->buf[w->pos] : e;
+		size_t e_len = direct ? w->nitems - w->pos : DOC_WRITER_NITEMS;
+		const size_t n = doc_out_slice(s, s_len,
+		    e_len / WCJSON_ESCAPE_MAX);
+
+		if (w->asc) {
+			if (wctoascjsons(s, n, d, &e_len) < 0)
+				return -1;
+		} else {
+			if (wctowcjsons(s, n, d, &e_len) < 0)
+				return -1;
+		}
+
+		if (direct) {
+			w->pos += e_len;
+			*cur += e_len;
+		} else if (doc_writer_put(w, cur, e, e_len) < 0)
+			return -1;
+
+		s += n;
+		s_len -= n;
+	}
+
+	return 0;
+}
+
+/* Checks a value to be expected next and writes the separating comma */
+static int
+doc_writer_value(struct wcjson_writer *w, size_t *cur)
+{
+	if (w->depth == 0) {
+		if (w->done)
+			goto err_inval;
+
+		return 0;
+	}
+
+	const unsigned char f = w->stack[w->depth - 1];
+
+	if (f & DOC_WRITER_OBJECT) {
+		if (!(f & DOC_WRITER_KEY))
+			goto err_inval;
+
+		return 0;
+	}
+
+	return f & DOC_WRITER_MEMBER ? doc_writer_put(w, cur, L",", 1) : 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Records a value to have been written completely */
+static void
+doc_writer_done(struct wcjson_writer *w)
+{
+	w->skip = 0;
+
+	if (w->depth == 0)
+		w->done = true;
+	else {
+		unsigned char *f = &w->stack[w->depth - 1];
+
+		*f = (unsigned char)((*f & ~DOC_WRITER_KEY) | DOC_WRITER_MEMBER);
+	}
+}
+
+static int
+doc_writer_scalar(struct wcjson_writer *w, const wchar_t *s, const size_t len)
+{
+	size_t cur = 0;
+
+	if (doc_writer_value(w, &cur) < 0)
+		return -1;
+
+	if (doc_writer_put(w, &cur, s, len) < 0)
+		return -1;
+
+	doc_writer_done(w);
+	return 0;
+}
+
+static int
+doc_writer_begin(struct wcjson_writer *w, const wchar_t *c,
+    const unsigned char flags)
+{
+	size_t cur = 0;
+
+	if (w->depth == w->st_nitems)
+		goto err_overflow;
+
+	if (doc_writer_value(w, &cur) < 0)
+		return -1;
+
+	if (doc_writer_put(w, &cur, c, 1) < 0)
+		return -1;
+
+	// The top level value gets done when its container ends
+	if (w->depth > 0)
+		doc_writer_done(w);
+
+	w->skip = 0;
+	w->stack[w->depth++] = flags;
+	return 0;
+err_overflow:
+	errno = EOVERFLOW;
+	return -1;
+}
+
+static int
+doc_writer_end(struct wcjson_writer *w, const wchar_t *c,
+    const unsigned char flags)
+{
+	size_t cur = 0;
+
+	if (w->depth == 0 || (w->stack[w->depth - 1] &
+	    (DOC_WRITER_OBJECT | DOC_WRITER_KEY)) != flags)
+		goto err_inval;
+
+	if (doc_writer_put(w, &cur, c, 1) < 0)
+		return -1;
+
+	w->depth--;
+	doc_writer_done(w);
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+/* Tests s to hold exactly one number according to the JSON grammar */
+static bool
+doc_number_valid(const wchar_t *s, const size_t len)
+{
+	size_t i = 0;
+	size_t d;
+
+	if (i < len && s[i] == L'-')
+		i++;
+
+	if (i < len && s[i] == L'0')
+		i++;
+	else {
+		for (d = i; i < len && s[i] >= L'0' && s[i] <= L'9'; i++)
+			;
+
+		if (i == d)
+			return false;
+	}
+
+	if (i < len && s[i] == L'.') {
+		for (d = ++i; i < len && s[i] >= L'0' && s[i] <= L'9'; i++)
+			;
+
+		if (i == d)
+			return false;
+	}
+
+	if (i < len && (s[i] == L'e' || s[i] == L'E')) {
+		if (++i < len && (s[i] == L'+' || s[i] == L'-'))
+			i++;
+
+		for (d = i; i < len && s[i] >= L'0' && s[i] <= L'9'; i++)
+			;
+
+		if (i == d)
+			return false;
+	}
+
+	return i == len;
+}
+
+int
+wcjson_writer_begin_object(struct wcjson_writer *w)
+{
+	return doc_writer_begin(w, L"{", DOC_WRITER_OBJECT);
+}
+
+int
+wcjson_writer_end_object(struct wcjson_writer *w)
+{
+	return doc_writer_end(w, L"}", DOC_WRITER_OBJECT);
+}
+
+int
+wcjson_writer_begin_array(struct wcjson_writer *w)
+{
+	return doc_writer_begin(w, L"[", 0);
+}
+
+int
+wcjson_writer_end_array(struct wcjson_writer *w)
+{
+	return doc_writer_end(w, L"]", 0);
+}
+
+int
+wcjson_writer_key(struct wcjson_writer *w, const wchar_t *key,
+    const size_t len)
+{
+	size_t cur = 0;
+
+	if (w->depth == 0 || (w->stack[w->depth - 1] &
+	    (DOC_WRITER_OBJECT | DOC_WRITER_KEY)) != DOC_WRITER_OBJECT)
+		goto err_inval;
+
+	if ((w->stack[w->depth - 1] & DOC_WRITER_MEMBER) &&
+	    doc_writer_put(w, &cur, L",", 1) < 0)
+		return -1;
+
+	if (doc_writer_put(w, &cur, L"\"", 1) < 0)
+		return -1;
+
+	if (doc_writer_esc(w, &cur, key, len) < 0)
+		return -1;
+
+	if (doc_writer_put(w, &cur, L"\":", 2) < 0)
+		return -1;
+
+	w->skip = 0;
+	w->stack[w->depth - 1] |= DOC_WRITER_KEY;
+	return 0;
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+int
+wcjson_writer_string(struct wcjson_writer *w, const wchar_t *val,
+    const size_t len)
+{
+	size_t cur = 0;
+
+	if (doc_writer_value(w, &cur) < 0)
+		return -1;
+
+	if (doc_writer_put(w, &cur, L"\"", 1) < 0)
+		return -1;
+
+	if (doc_writer_esc(w, &cur, val, len) < 0)
+		return -1;
+
+	if (doc_writer_put(w, &cur, L"\"", 1) < 0)
+		return -1;
+
+	doc_writer_done(w);
+	return 0;
+}
+
+int
+wcjson_writer_number(struct wcjson_writer *w, const wchar_t *val,
+    const size_t len)
+{
+	if (!doc_number_valid(val, len))
+		goto err_inval;
+
+	return doc_writer_scalar(w, val, len);
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+int
+wcjson_writer_double(struct wcjson_writer *w, const double val)
+{
+	wchar_t s[DOC_NUMBER_NITEMS];
+	uint64_t bits;
+
+	memcpy(&bits, &val, sizeof(bits));
+
+	// No JSON representation of infinities and NaNs
+	if (((bits >> 52) & 0x7ff) == 0x7ff)
+		goto err_inval;
+
+	return doc_writer_scalar(w, s, doc_dtoa(s, val));
+err_inval:
+	errno = EINVAL;
+	return -1;
+}
+
+int
+wcjson_writer_int64(struct wcjson_writer *w, const int64_t val)
+{
+	wchar_t s[DOC_NUMBER_NITEMS];
+	size_t len = 0;
+
+	if (val < 0)
+		s[len++] = L'-';
+
+	len += doc_wutoa(&s[len], val < 0 ? UINT64_C(0) - (uint64_t)val :
+	    (uint64_t)val);
+
+	return doc_writer_scalar(w, s, len);
+}
+
+int
+wcjson_writer_uint64(struct wcjson_writer *w, const uint64_t val)
+{
+	wchar_t s[DOC_NUMBER_NITEMS];
+
+	return doc_writer_scalar(w, s, doc_wutoa(s, val));
+}
+
+int
+wcjson_writer_bool(struct wcjson_writer *w, const bool val)
+{
+	return val ? doc_writer_scalar(w, L"true", 4) :
+	    doc_writer_scalar(w, L"false", 5);
+}
+
+int
+wcjson_writer_null(struct wcjson_writer *w)
+{
+	return doc_writer_scalar(w, L"null", 4);
+}
+
+int
+wcjson_writer_flush(struct wcjson_writer *w)
+{
+	if (w->sink == NULL || w->pos == 0)
+		return 0;
+
+	if (w->sink(w->sink_ctx, w->buf, w->pos) < 0)
+		return -1;
+
+	w->pos = 0;
+	return 0;
+}
+
+/* Powers of ten exactly representable as doubles */
+static const double doc_pow10[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+	1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22,
+};
+
+static void *
+doc_bind_err(struct wcjson *ctx, const int errnum)
+{
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = errnum;
+	return NULL;
+}
+
+/*
+ * Binding of the value parsed next and the address it is stored at, or NULL
+ * for values not bound.
+ */
+static const struct wcjson_binding *
+doc_bind_target(struct wcjson *ctx, struct wcjson_binder *b, char **addrp)
+{
+	if (b->depth == 0) {
+		doc_bind_err(ctx, EINVAL);
+		return NULL;
+	}
+
+	const struct wcjson_binder_frame *f = &b->stack[b->depth - 1];
+
+	if (f->binding->type == WCJSON_BINDING_OBJECT) {
+		if (b->field != NULL)
+			*addrp = f->base + b->field->offset;
+
+		return b->field;
+	}
+
+	if (*f->count == f->binding->nitems) {
+		doc_bind_err(ctx, ERANGE);
+		return NULL;
+	}
+
+	*addrp = f->base + *f->count * f->binding->size +
+	    f->binding->bindings->offset;
+
+	return f->binding->bindings;
+}
+
+static void *
+doc_bind_start(struct wcjson *ctx, struct wcjson_binder *b,
+    const enum wcjson_binding_type type)
+{
+	const struct wcjson_binding *field = b->binding;
+	char *addr = (char *)b->base + field->offset;
+
+	if (b->depth > 0) {
+		field = doc_bind_target(ctx, b, &addr);
+
+		if (field == NULL)
+			return ctx->status == WCJSON_OK ? WCJSON_SKIP : NULL;
+	}
+
+	if (field->type != type)
+		return doc_bind_err(ctx, EINVAL);
+
+	// Arrays without an element binding are not bound
+	if (type == WCJSON_BINDING_ARRAY && field->bindings == NULL)
+		return WCJSON_SKIP;
+
+	if (b->depth == b->st_nitems)
+		return doc_bind_err(ctx, ERANGE);
+
+	struct wcjson_binder_frame *f = &b->stack[b->depth++];
+
+	f->binding = field;
+	f->base = addr;
+	f->count = NULL;
+
+	if (type == WCJSON_BINDING_ARRAY) {
+		// The count lives in the struct holding the array
+		f->count = (size_t *)(addr - field->offset + field->count);
+		*f->count = 0;
+	}
+
+	b->field = NULL;
+	b->key = false;
+	return f;
+}
+
+static void *
+doc_bind_object_start(struct wcjson *ctx, void *doc, void *parent)
+{
+	return doc_bind_start(ctx, doc, WCJSON_BINDING_OBJECT);
+}
+
+static void
+doc_bind_object_add(struct wcjson *ctx, void *doc, void *obj, void *key,
+    void *value)
+{
+	struct wcjson_binder *b = doc;
+
+	b->field = NULL;
+	b->key = false;
+}
+
+static void
+doc_bind_end(struct wcjson *ctx, void *doc, void *obj)
 {
-	if (v->is_string || v->is_pair) {
-		size_t dst_len = d->mb_nitems - d->mb_next;
-		char *dst = &d->mbstrings[d->mb_next];
-		size_t mb_len = wcstombs(dst, v->string, dst_len);
+	struct wcjson_binder *b = doc;
 
-		if (mb_len == (size_t)-1)
-			goto err;
-
-		if (mb_len == dst_len)
-			goto err_range;
+	b->depth--;
+}
 
-		const size_t mb_next = d->mb_next + mb_len + 1;
+static void *
+doc_bind_array_start(struct wcjson *ctx, void *doc, void *parent)
+{
+	return doc_bind_start(ctx, doc, WCJSON_BINDING_ARRAY);
+}
 
-		if (mb_next < d->mb_next || mb_next > d->mb_nitems)
-			goto err_range;
+static void
+doc_bind_array_add(struct wcjson *ctx, void *doc, void *arr, void *value)
+{
+	struct wcjson_binder_frame *f = arr;
 
-		v->mbstring = dst;
-		v->mb_len = mb_len;
+	(*f->count)++;
+}
 
-		d->mb_next = mb_next;
+/* Looks up the binding of a key of the object bound by frame f */
+static void
+doc_bind_key(struct wcjson_binder *b, const struct wcjson_binder_frame *f,
+    const wchar_t *str, size_t len, const bool escaped)
+{
+	// Keys longer than the buffer stay unbound if escaped
+	wchar_t k[DOC_BIND_KEY_NITEMS];
 
-		if (v->is_pair &&
-		    doc_mbstrings(ctx, d, wcjson_value_head(d, v)) < 0)
-			goto err;
-	} else if (v->is_number) {
-		size_t dst_len = d->mb_nitems - d->mb_next;
-		char *dst = &d->mbstrings[d->mb_next];
-		size_t mb_len = wcstombs(dst, v->string, dst_len);
+	b->field = NULL;
+	b->key = true;
 
-		if (mb_len == (size_t)-1)
-			goto err;
+	if (escaped) {
+		const int saved_errno = errno;
+		size_t k_len = DOC_BIND_KEY_NITEMS;
 
-		if (mb_len == dst_len)
-			goto err_range;
+		if (wcjsonstowc(str, len, k, &k_len) < 0) {
+			errno = saved_errno;
+			return;
+		}
 
-		const size_t mb_next = d->mb_next + mb_len + 1;
+		str = k;
+		len = k_len;
+	}
 
-		if (mb_next < d->mb_next || mb_next > d->mb_nitems)
-			goto err_range;
+	if (f->binding->keyset != NULL) {
+		const size_t id = wcjson_keyset_find(f->binding->keyset, str, len);
 
-		v->mbstring = dst;
-		v->mb_len = mb_len;
+		if (id != SIZE_MAX)
+			b->field = &f->binding->bindings[id];
 
-		d->mb_next = mb_next;
-	} else if (v->is_array) {
-		for (struct wcjson_value *n = wcjson_value_tail(d, v);
-		    n != NULL; n = wcjson_value_prev(d, n))
-			if (doc_mbstrings(ctx, d, n) < 0)
-				goto err;
-	} else if (v->is_object) {
-		for (struct wcjson_value *n = wcjson_value_tail(d, v);
-		    n != NULL; n = wcjson_value_prev(d, n))
-			if (doc_mbstrings(ctx, d, n) < 0)
-				goto err;
+		return;
 	}
 
-	return 0;
-err:
-	return -1;
-err_range:
-	ctx->status = WCJSON_ABORT_ERROR;
-	ctx->errnum = ERANGE;
-	return -1;
+	for (size_t i = 0; i < f->binding->b_nitems; i++) {
+		const struct wcjson_binding *field = &f->binding->bindings[i];
+
+		if (field->key_len == len && wmemcmp(field->key, str, len) == 0) {
+			b->field = field;
+			return;
+		}
+	}
 }
 
-static int
-doc_fprint(FILE *f, bool asc, const struct wcjson_document *d,
-    const struct wcjson_value *v)
+static void *
+doc_bind_string_value(struct wcjson *ctx, void *doc, const wchar_t *str,
+    const size_t len, const bool escaped)
 {
-	if (v->is_null) {
-		if (fputws(L"null", f) == -1)
-			return -1;
-	} else if (v->is_boolean) {
-		if (fputws(v->is_true ? L"true" : L"false", f) == -1)
-			return -1;
-	} else if (v->is_string || v->is_pair) {
-		size_t e_len = d->e_nitems;
+	struct wcjson_binder *b = doc;
+	char *addr = NULL;
 
-		if (asc) {
-			if (wctoascjsons(v->string, v->s_len, d->esc, &e_len) <
-			    0)
-				return -1;
-		} else {
-			if (wctowcjsons(v->string, v->s_len, d->esc, &e_len) <
-			    0)
-				return -1;
-		}
+	if (b->depth > 0 && !b->key && b->stack[b->depth - 1].binding->type ==
+	    WCJSON_BINDING_OBJECT) {
+		doc_bind_key(b, &b->stack[b->depth - 1], str, len, escaped);
+		return NULL;
+	}
 
-		if (putwc(L'"', f) == WEOF)
-			return -1;
+	const struct wcjson_binding *field = doc_bind_target(ctx, b, &addr);
 
-		if (fwprintf(f, L"%.*ls", (int)e_len, d->esc) < 0)
-			return -1;
+	if (field == NULL)
+		return NULL;
 
-		if (putwc(L'"', f) == WEOF)
-			return -1;
+	if (field->type != WCJSON_BINDING_STRING || field->nitems == 0)
+		return doc_bind_err(ctx, EINVAL);
 
-		if (v->is_pair) {
-			if (putwc(L':', f) == WEOF)
-				return -1;
+	wchar_t *d = (wchar_t *)addr;
+	size_t d_len = field->nitems - 1;
 
-			if (doc_fprint(f, asc, d, wcjson_value_head(d, v)) < 0)
-				return -1;
-		}
-	} else if (v->is_number) {
-		if (fwprintf(f, L"%.*ls", (int)v->s_len, v->string) < 0)
-			return -1;
-	} else if (v->is_array) {
-		if (putwc(L'[', f) == WEOF)
-			return -1;
+	if (escaped) {
+		const int saved_errno = errno;
 
-		struct wcjson_value *n = wcjson_value_head(d, v);
+		if (wcjsonstowc(str, len, d, &d_len) < 0) {
+			const int errnum = errno;
 
-		while (n != NULL) {
-			if (doc_fprint(f, asc, d, n) < 0)
-				return -1;
+			errno = saved_errno;
+			return doc_bind_err(ctx, errnum);
+		}
+	} else {
+		if (len > d_len)
+			return doc_bind_err(ctx, ERANGE);
 
-			n = wcjson_value_next(d, n);
+		wmemcpy(d, str, len);
+		d_len = len;
+	}
 
-			if (n != NULL && putwc(L',', f) == WEOF)
-				return -1;
-		}
+	d[d_len] = L'\0';
+	return NULL;
+}
 
-		if (putwc(L']', f) == WEOF)
-			return -1;
-	} else if (v->is_object) {
-		if (putwc(L'{', f) == WEOF)
-			return -1;
+/* Converts the integer number s to its magnitude and sign */
+static int
+doc_bind_integer(const wchar_t *s, const size_t len, uint64_t *mp, bool *negp)
+{
+	uint64_t m = 0;
+	size_t i = 0;
 
-		struct wcjson_value *n = wcjson_value_head(d, v);
+	*negp = s[0] == L'-';
 
-		while (n != NULL) {
-			if (doc_fprint(f, asc, d, n) < 0)
-				return -1;
+	if (*negp)
+		i++;
 
-			n = wcjson_value_next(d, n);
+	for (; i < len; i++) {
+		if (s[i] < L'0' || s[i] > L'9')
+			goto err_inval;
 
-			if (n != NULL && putwc(L',', f) == WEOF)
-				return -1;
-		}
+		const uint64_t d = (uint64_t)(s[i] - L'0');
 
-		if (putwc(L'}', f) == WEOF)
-			return -1;
-	} else
-		goto err_inval;
+		if (m > (UINT64_MAX - d) / 10)
+			goto err_range;
+
+		m = m * 10 + d;
+	}
 
+	*mp = m;
 	return 0;
 err_inval:
 	errno = EINVAL;
 	return -1;
-}
-
-static inline int
-doc_sprint_copy(const wchar_t *s, size_t s_len, wchar_t *d,
-    size_t *d_lenp)
-{
-	if (*d_lenp < s_len)
-		goto err_range;
-
-	wmemcpy(d, s, s_len);
-	*d_lenp -= s_len;
-	return 0;
 err_range:
 	errno = ERANGE;
 	return -1;
 }
 
+/*
+ * Converts the number s to the nearest double. Numbers with up to 15
+ * significant digits and powers of ten up to 22 are converted exactly with a
+ * single multiplication or division, all others by strtod using the decimal
+ * point of the current locale.
+ */
 static int
-doc_sprint(wchar_t *d, size_t *d_lenp, bool asc,
-    const struct wcjson_document *doc,
-    const struct wcjson_value *v)
+doc_bind_double(const wchar_t *s, const size_t len, double *dp)
 {
-	size_t d_len = *d_lenp;
-
-	if (v->is_null) {
-		if (doc_sprint_copy(L"null", 4, d, &d_len) < 0)
-			return -1;
-	} else if (v->is_boolean) {
-		if (v->is_true) {
-			if (doc_sprint_copy(L"true", 4, d, &d_len) < 0)
-				return -1;
-		} else {
-			if (doc_sprint_copy(L"false", 5, d, &d_len) < 0)
-				return -1;
-		}
-	} else if (v->is_string || v->is_pair) {
-		size_t e_len = doc->e_nitems;
-
-		if (asc) {
-			if (wctoascjsons(v->string, v->s_len, doc->esc,
-			    &e_len) < 0)
-				return -1;
-		} else {
-			if (wctowcjsons(v->string, v->s_len, doc->esc, &e_len) <
-			    0)
-				return -1;
-		}
-
-		if (e_len > SIZE_MAX - 2 || d_len < e_len + 2)
-			goto err_range;
-
-		*d++ = L'"';
-		d_len--;
-
-		if (doc_sprint_copy(doc->esc, e_len, d, &d_len) < 0)
-			return -1;
-
-		d += e_len;
-
-		*d++ = '"';
-		d_len--;
+	char b[DOC_BIND_NUMBER_NITEMS];
+	uint64_t m = 0;
+	size_t digits = 0;
+	long e = 0;
+	size_t i = 0;
+	const bool neg = s[0] == L'-';
 
-		if (v->is_pair) {
-			if (doc_sprint_copy(L":", 1, d, &d_len) < 0)
-				return -1;
+	if (neg)
+		i++;
 
-			d++;
-			size_t v_len = d_len;
+	for (; i < len && s[i] >= L'0' && s[i] <= L'9'; i++) {
+		if (m == 0 && s[i] == L'0')
+			continue;
 
-			if (doc_sprint(d, &v_len, asc, doc,
-			    wcjson_value_head(doc, v)) < 0)
-				return -1;
+		if (++digits <= 19)
+			m = m * 10 + (uint64_t)(s[i] - L'0');
+		else
+			e++;
+	}
 
-			d_len -= v_len;
+	if (i < len && s[i] == L'.') {
+		for (i++; i < len && s[i] >= L'0' && s[i] <= L'9'; i++) {
+			if (m == 0 && s[i] == L'0')
+				e--;
+			else if (++digits <= 19) {
+				m = m * 10 + (uint64_t)(s[i] - L'0');
+				e--;
+			}
 		}
-	} else if (v->is_number) {
-		if (doc_sprint_copy(v->string, v->s_len, d, &d_len) < 0)
-			return -1;
-	} else if (v->is_array) {
-		if (doc_sprint_copy(L"[", 1, d, &d_len) < 0)
-			return -1;
-
-		d++;
-
-		struct wcjson_value *n = wcjson_value_head(doc, v);
+	}
 
-		while (n != NULL) {
-			size_t v_len = d_len;
+	if (i < len && (s[i] == L'e' || s[i] == L'E')) {
+		const bool e_neg = s[++i] == L'-';
+		long x = 0;
 
-			if (doc_sprint(d, &v_len, asc, doc, n) < 0)
-				return -1;
+		if (s[i] == L'-' || s[i] == L'+')
+			i++;
 
-			d += v_len;
-			d_len -= v_len;
+		for (; i < len; i++)
+			if (x < 100000)
+				x = x * 10 + (long)(s[i] - L'0');
 
-			n = wcjson_value_next(doc, n);
+		e += e_neg ? -x : x;
+	}
 
-			if (n != NULL) {
-				if (doc_sprint_copy(L",", 1, d, &d_len) < 0)
-					return -1;
+	if (m == 0) {
+		*dp = neg ? -0.0 : 0.0;
+		return 0;
+	}
 
-				d++;
-			}
-		}
+	if (digits <= 15 && e >= -22 && e <= 22) {
+		const double d = (double)m;
 
-		if (doc_sprint_copy(L"]", 1, d, &d_len) < 0)
-			return -1;
-	} else if (v->is_object) {
-		if (doc_sprint_copy(L"{", 1, d, &d_len) < 0)
-			return -1;
+		*dp = e < 0 ? d / doc_pow10[-e] : d * doc_pow10[e];
 
-		d++;
+		if (neg)
+			*dp = -*dp;
 
-		struct wcjson_value *n = wcjson_value_head(doc, v);
+		return 0;
+	}
 
-		while (n != NULL) {
-			size_t v_len = d_len;
+	const char *dot = localeconv()->decimal_point;
+	const size_t dot_len = strlen(dot);
+	size_t b_len = 0;
 
-			if (doc_sprint(d, &v_len, asc, doc, n) < 0)
-				return -1;
+	for (i = 0; i < len; i++) {
+		if (b_len + dot_len >= sizeof(b))
+			goto err_range;
 
-			d += v_len;
-			d_len -= v_len;
+		if (s[i] == L'.') {
+			memcpy(&b[b_len], dot, dot_len);
+			b_len += dot_len;
+		} else
+			b[b_len++] = (char)s[i];
+	}
 
-			n = wcjson_value_next(doc, n);
+	b[b_len] = '\0';
 
-			if (n != NULL) {
-				if (doc_sprint_copy(L",", 1, d, &d_len) < 0)
-					return -1;
+	const int saved_errno = errno;
+	const double d = strtod(b, NULL);
 
-				d++;
-			}
-		}
+	errno = saved_errno;
 
-		if (doc_sprint_copy(L"}", 1, d, &d_len) < 0)
-			return -1;
-	} else
-		goto err_inval;
+	// Underflows are rounded, overflows have no JSON representation
+	if (d == HUGE_VAL || d == -HUGE_VAL)
+		goto err_range;
 
-	*d_lenp -= d_len;
+	*dp = d;
 	return 0;
-err_inval:
-	errno = EINVAL;
-	return -1;
 err_range:
 	errno = ERANGE;
 	return -1;
 }
 
-int
-wcjsondocvalues(struct wcjson *ctx, struct wcjson_document *doc,
-    const wchar_t *txt, const size_t len)
+static void *
+doc_bind_number_value(struct wcjson *ctx, void *doc, const wchar_t *num,
+    const size_t len)
 {
-	doc->v_nitems_cnt = 0;
-	doc->s_nitems_cnt = 0;
+	struct wcjson_binder *b = doc;
+	char *addr = NULL;
+	const struct wcjson_binding *field = doc_bind_target(ctx, b, &addr);
+	const int saved_errno = errno;
+	uint64_t m;
+	bool neg;
 
-	return wcjson(ctx, wcjson_document_ops, doc, txt, len);
-}
+	if (field == NULL)
+		return NULL;
 
-int
-wcjsondocstrings(struct wcjson *ctx, struct wcjson_document *doc)
-{
-	doc->mb_nitems_cnt = 0;
-	doc->e_nitems_cnt = 0;
+	switch (field->type) {
+	case WCJSON_BINDING_INT64: {
+		if (doc_bind_integer(num, len, &m, &neg) < 0)
+			goto err;
 
-	return doc_unesc(ctx, doc, doc->values);
-}
+		if (m > (neg ? UINT64_C(1) << 63 : (UINT64_C(1) << 63) - 1))
+			return doc_bind_err(ctx, ERANGE);
 
-int
-wcjsondocmbstrings(struct wcjson *ctx, struct wcjson_document *doc)
-{
-	return doc_mbstrings(ctx, doc, doc->values);
-}
+		const int64_t v = neg ? (int64_t)(UINT64_C(0) - m) : (int64_t)m;
 
-int
-wcjsondocfprint(FILE *f, const struct wcjson_document *doc,
-    const struct wcjson_value *value)
-{
-	return doc_fprint(f, false, doc, value);
-}
+		memcpy(addr, &v, sizeof(v));
+		break;
+	}
+	case WCJSON_BINDING_UINT64:
+		if (doc_bind_integer(num, len, &m, &neg) < 0)
+			goto err;
 
-int
-wcjsondocfprintasc(FILE *f, const struct wcjson_document *doc,
-    const struct wcjson_value *value)
-{
-	return doc_fprint(f, true, doc, value);
+		if (neg && m != 0)
+			return doc_bind_err(ctx, ERANGE);
+
+		memcpy(addr, &m, sizeof(m));
+		break;
+	case WCJSON_BINDING_DOUBLE: {
+		double d;
+
+		if (doc_bind_double(num, len, &d) < 0)
+			goto err;
+
+		memcpy(addr, &d, sizeof(d));
+		break;
+	}
+	default:
+		return doc_bind_err(ctx, EINVAL);
+	}
+
+	return NULL;
+err:
+	doc_bind_err(ctx, errno);
+	errno = saved_errno;
+	return NULL;
 }
 
-int
-wcjsondocsprint(wchar_t *s, size_t *lenp, const struct wcjson_document *doc,
-    const struct wcjson_value *value)
+static void *
+doc_bind_bool_value(struct wcjson *ctx, void *doc, const bool value)
 {
-	size_t s_len = *lenp;
-	size_t t_len = s_len;
-	int r = doc_sprint(s, &t_len, false, doc, value);
-
-	if (r < 0)
-		return -1;
+	struct wcjson_binder *b = doc;
+	char *addr = NULL;
+	const struct wcjson_binding *field = doc_bind_target(ctx, b, &addr);
 
-	s_len -= t_len;
+	if (field == NULL)
+		return NULL;
 
-	if (s_len < 1)
-		goto err_range;
+	if (field->type != WCJSON_BINDING_BOOL)
+		return doc_bind_err(ctx, EINVAL);
 
-	s[t_len] = L'\0';
-	*lenp -= s_len;
-	return 0;
-err_range:
-	errno = ERANGE;
-	return -1;
+	memcpy(addr, &value, sizeof(value));
+	return NULL;
 }
 
-int
-wcjsondocsprintasc(wchar_t *s, size_t *lenp,
-    const struct wcjson_document *doc,
-    const struct wcjson_value *value)
+static void *
+doc_bind_null_value(struct wcjson *ctx, void *doc)
 {
-	size_t s_len = *lenp;
-	size_t t_len = s_len;
-	int r = doc_sprint(s, &t_len, true, doc, value);
+	struct wcjson_binder *b = doc;
+	char *addr = NULL;
 
-	if (r < 0)
-		return -1;
+	// Leaves the target untouched
+	doc_bind_target(ctx, b, &addr);
+	return NULL;
+}
 
-	s_len -= t_len;
+const struct wcjson_ops *const wcjson_binder_ops = &(const struct wcjson_ops){
+    .object_start = doc_bind_object_start,
+    .object_add = doc_bind_object_add,
+    .object_end = doc_bind_end,
+    .array_start = doc_bind_array_start,
+    .array_add = doc_bind_array_add,
+    .array_end = doc_bind_end,
+    .string_value = doc_bind_string_value,
+    .number_value = doc_bind_number_value,
+    .bool_value = doc_bind_bool_value,
+    .null_value = doc_bind_null_value,
+};
 
-	if (s_len < 1)
-		goto err_range;
+int
+wcjsonbind(struct wcjson *ctx, struct wcjson_binder *binder,
+    const wchar_t *txt, const size_t len)
+{
+	if (binder->binding == NULL ||
+	    (binder->binding->type != WCJSON_BINDING_OBJECT &&
+	    binder->binding->type != WCJSON_BINDING_ARRAY))
+		goto err_inval;
 
-	s[t_len] = L'\0';
-	*lenp -= s_len;
-	return 0;
-err_range:
-	errno = ERANGE;
+	binder->depth = 0;
+	binder->field = NULL;
+	binder->key = false;
+
+	return wcjson(ctx, wcjson_binder_ops, binder, txt, len);
+err_inval:
+	ctx->status = WCJSON_ABORT_ERROR;
+	ctx->errnum = EINVAL;
 	return -1;
 }
 
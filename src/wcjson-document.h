@@ -21,12 +21,24 @@
 extern "C" {
 #endif
 
+#include <stdint.h>
 #include <stdio.h>
 
 #include <wcjson.h>
 
 extern const struct wcjson_ops *const wcjson_document_ops;
 
+extern const struct wcjson_ops *const wcjson_binder_ops;
+
+struct wcjson_allocator {
+	void *(*allocate)(void *ctx, size_t size);
+	void *(*reallocate)(void *ctx, void *p, size_t size);
+	void (*deallocate)(void *ctx, void *p);
+	void *ctx;
+};
+
+extern const struct wcjson_allocator *const wcjson_allocator_default;
+
 struct wcjson_value {
 	unsigned is_null:1;
 	unsigned is_boolean:1;
@@ -52,6 +64,7 @@ struct wcjson_document {
 	size_t v_nitems;
 	size_t v_nitems_cnt;
 	size_t v_next;
+	size_t v_free;
 	wchar_t *strings;
 	size_t s_nitems;
 	size_t s_nitems_cnt;
@@ -60,9 +73,8 @@ struct wcjson_document {
 	size_t mb_nitems;
 	size_t mb_nitems_cnt;
 	size_t mb_next;
-	wchar_t *esc;
-	size_t e_nitems;
-	size_t e_nitems_cnt;
+	bool mb_utf8;
+	const struct wcjson_allocator *allocator;
 };
 
 #define WCJSON_DOCUMENT_INITIALIZER					\
@@ -71,6 +83,7 @@ struct wcjson_document {
       .v_nitems = 0,							\
       .v_nitems_cnt = 0,						\
       .v_next = 0,							\
+      .v_free = 0,							\
       .strings = NULL,							\
       .s_nitems = 0,							\
       .s_nitems_cnt = 0,						\
@@ -79,9 +92,127 @@ struct wcjson_document {
       .mb_nitems = 0,							\
       .mb_nitems_cnt = 0,						\
       .mb_next = 0,							\
-      .esc = NULL,							\
-      .e_nitems = 0,							\
-      .e_nitems_cnt = 0,						\
+      .mb_utf8 = false,							\
+      .allocator = NULL,						\
+  }
+
+struct wcjson_arena {
+	char *base;
+	size_t size;
+	size_t next;
+	bool mapped;
+};
+
+#define WCJSON_ARENA_INITIALIZER					\
+  {									\
+      .base = NULL,							\
+      .size = 0,							\
+      .next = 0,							\
+      .mapped = false,							\
+  }
+
+struct wcjson_writer {
+	wchar_t *buf;
+	size_t nitems;
+	size_t pos;
+	int (*sink)(void *ctx, const wchar_t *s, size_t len);
+	void *sink_ctx;
+	unsigned char *stack;
+	size_t st_nitems;
+	size_t depth;
+	size_t skip;
+	bool asc;
+	bool done;
+};
+
+#define WCJSON_WRITER_INITIALIZER					\
+  {									\
+      .buf = NULL,							\
+      .nitems = 0,							\
+      .pos = 0,								\
+      .sink = NULL,							\
+      .sink_ctx = NULL,							\
+      .stack = NULL,							\
+      .st_nitems = 0,							\
+      .depth = 0,							\
+      .skip = 0,							\
+      .asc = false,							\
+      .done = false,							\
+  }
+
+enum wcjson_binding_type {
+	WCJSON_BINDING_BOOL,
+	WCJSON_BINDING_INT64,
+	WCJSON_BINDING_UINT64,
+	WCJSON_BINDING_DOUBLE,
+	WCJSON_BINDING_STRING,
+	WCJSON_BINDING_OBJECT,
+	WCJSON_BINDING_ARRAY,
+};
+
+struct wcjson_keyset;
+
+struct wcjson_binding {
+	const wchar_t *key;
+	size_t key_len;
+	enum wcjson_binding_type type;
+	size_t offset;
+	size_t nitems;
+	size_t size;
+	size_t count;
+	const struct wcjson_binding *bindings;
+	size_t b_nitems;
+	const struct wcjson_keyset *keyset;
+};
+
+struct wcjson_keyset {
+	size_t *table;
+	size_t t_nitems;
+	const wchar_t *const *keys;
+	const size_t *lens;
+	const struct wcjson_binding *bindings;
+	size_t k_nitems;
+	size_t b_nitems;
+	size_t s_nitems;
+};
+
+#define WCJSON_KEYSET_INITIALIZER					\
+  {									\
+      .table = NULL,							\
+      .t_nitems = 0,							\
+      .keys = NULL,							\
+      .lens = NULL,							\
+      .bindings = NULL,							\
+      .k_nitems = 0,							\
+      .b_nitems = 0,							\
+      .s_nitems = 0,							\
+  }
+
+struct wcjson_binder_frame {
+	const struct wcjson_binding *binding;
+	char *base;
+	size_t *count;
+};
+
+struct wcjson_binder {
+	const struct wcjson_binding *binding;
+	void *base;
+	struct wcjson_binder_frame *stack;
+	size_t st_nitems;
+	size_t depth;
+	const struct wcjson_binding *field;
+	bool key;
+};
+
+#define WCJSON_BINDER_INITIALIZER					\
+  {									\
+      .binding = NULL,							\
+      .base = NULL,							\
+      .stack = NULL,							\
+      .st_nitems = 0,							\
+      .depth = 0,							\
+      .field = NULL,							\
+      .key = false,							\
   }
 
 WCJSON_EXPORT struct wcjson_value *wcjson_value_null(
@@ -98,6 +229,15 @@ WCJSON_EXPORT struct wcjson_value *wcjson_value_number(
     struct wcjson_document *doc, const wchar_t *val,
     const size_t len);
 
+WCJSON_EXPORT struct wcjson_value *wcjson_value_double(
+    struct wcjson_document *doc, const double val);
+
+WCJSON_EXPORT struct wcjson_value *wcjson_value_int64(
+    struct wcjson_document *doc, const int64_t val);
+
+WCJSON_EXPORT struct wcjson_value *wcjson_value_uint64(
+    struct wcjson_document *doc, const uint64_t val);
+
 WCJSON_EXPORT struct wcjson_value *wcjson_value_object(
     struct wcjson_document *doc);
 
@@ -147,7 +287,7 @@ WCJSON_EXPORT int wcjson_object_add_tail(struct wcjson_document *doc,
     const struct wcjson_value *val);
 
 WCJSON_EXPORT struct wcjson_value *wcjson_object_remove(
-    const struct wcjson_document *doc,
+    struct wcjson_document *doc,
     struct wcjson_value *obj, const wchar_t *key,
     const size_t len);
 
@@ -156,6 +296,41 @@ WCJSON_EXPORT struct wcjson_value *wcjson_object_get(
     const struct wcjson_value *obj, const wchar_t *key,
     const size_t len);
 
+WCJSON_EXPORT int wcjson_object_index(const struct wcjson_document *doc,
+    const struct wcjson_value *obj, size_t *index, size_t *nitemsp);
+
+WCJSON_EXPORT struct wcjson_value *wcjson_object_find(
+    const struct wcjson_document *doc, const size_t *index,
+    const size_t nitems, const wchar_t *key, const size_t len);
+
+WCJSON_EXPORT int wcjson_object_join(const struct wcjson_document *doc,
+    const size_t *index, const size_t nitems,
+    const struct wcjson_document *other_doc, const size_t *other_index,
+    const size_t other_nitems,
+    int (*join)(void *ctx, const struct wcjson_value *pair,
+    const struct wcjson_value *other_pair), void *ctx);
+
+WCJSON_EXPORT int wcjson_keyset_init(struct wcjson_keyset *set,
+    const wchar_t *const *keys, const size_t *lens, const size_t nitems);
+
+WCJSON_EXPORT int wcjson_keyset_bindings(struct wcjson_keyset *set,
+    const struct wcjson_binding *bindings, const size_t nitems);
+
+WCJSON_EXPORT size_t wcjson_keyset_find(const struct wcjson_keyset *set,
+    const wchar_t *key, const size_t len);
+
+WCJSON_EXPORT int wcjson_object_match(const struct wcjson_document *doc,
+    const struct wcjson_value *obj, const struct wcjson_keyset *set,
+    struct wcjson_value **values);
+
+WCJSON_EXPORT uint64_t wcjson_value_hash(const struct wcjson_document *doc,
+    const struct wcjson_value *value, uint64_t *hashes);
+
+WCJSON_EXPORT bool wcjson_value_equal(const struct wcjson_document *doc,
+    const struct wcjson_value *value, const uint64_t *hashes,
+    const struct wcjson_document *other_doc,
+    const struct wcjson_value *other, const uint64_t *other_hashes);
+
 WCJSON_EXPORT wchar_t *wcjson_document_string(struct wcjson_document *doc,
     const wchar_t *s,
     const size_t len);
@@ -163,6 +338,55 @@ WCJSON_EXPORT wchar_t *wcjson_document_string(struct wcjson_document *doc,
 WCJSON_EXPORT char *wcjson_document_mbstring(struct wcjson_document *doc,
     const char *s, const size_t len);
 
+WCJSON_EXPORT const char *wcjson_value_mbstring(struct wcjson_document *doc,
+    struct wcjson_value *value);
+
+WCJSON_EXPORT int wcjson_value_free(struct wcjson_document *doc,
+    struct wcjson_value *value);
+
+WCJSON_EXPORT int wcjson_document_compact(struct wcjson_document *doc,
+    const struct wcjson_value *value, size_t *map);
+
+WCJSON_EXPORT void wcjson_document_reset(struct wcjson_document *doc);
+
+struct wcjson_document_pool;
+
+WCJSON_EXPORT int wcjson_document_grow(struct wcjson_document *doc);
+
+WCJSON_EXPORT void wcjson_document_free(struct wcjson_document *doc);
+
+WCJSON_EXPORT struct wcjson_document_pool *wcjson_document_pool_create(
+    const struct wcjson_allocator *allocator, const size_t v_nitems,
+    const size_t s_nitems, const size_t mb_nitems);
+
+WCJSON_EXPORT struct wcjson_document *wcjson_document_pool_get(
+    struct wcjson_document_pool *pool);
+
+WCJSON_EXPORT void wcjson_document_pool_put(struct wcjson_document_pool *pool,
+    struct wcjson_document *doc);
+
+WCJSON_EXPORT void wcjson_document_pool_destroy(
+    struct wcjson_document_pool *pool);
+
+WCJSON_EXPORT int wcjson_arena_init(struct wcjson_arena *arena, void *block,
+    const size_t size);
+
+WCJSON_EXPORT int wcjson_arena_map(struct wcjson_arena *arena,
+    const size_t size);
+
+WCJSON_EXPORT int wcjson_arena_unmap(struct wcjson_arena *arena);
+
+WCJSON_EXPORT void *wcjson_arena_alloc(struct wcjson_arena *arena,
+    const size_t nitems, const size_t size);
+
+WCJSON_EXPORT void *wcjson_arena_tail(struct wcjson_arena *arena,
+    const size_t size, size_t *nitemsp);
+
+WCJSON_EXPORT int wcjson_arena_shrink(struct wcjson_arena *arena, void *p,
+    const size_t nitems, const size_t size);
+
+WCJSON_EXPORT size_t wcjson_arena_remaining(const struct wcjson_arena *arena);
+
 WCJSON_EXPORT int wcjsondocvalues(struct wcjson *ctx,
     struct wcjson_document *doc,
     const wchar_t *txt, const size_t len);
@@ -173,12 +397,48 @@ WCJSON_EXPORT int wcjsondocstrings(struct wcjson *ctx,
 WCJSON_EXPORT int wcjsondocmbstrings(struct wcjson *ctx,
     struct wcjson_document *doc);
 
+WCJSON_EXPORT int wcjsondocmtstrings(struct wcjson *ctx,
+    struct wcjson_document *doc, const size_t nthreads);
+
+WCJSON_EXPORT int wcjsondocmtmbstrings(struct wcjson *ctx,
+    struct wcjson_document *doc, const size_t nthreads);
+
+WCJSON_EXPORT int wcjsondocarenavalues(struct wcjson *ctx,
+    struct wcjson_arena *arena, struct wcjson_document *doc,
+    const wchar_t *txt, const size_t len);
+
+WCJSON_EXPORT int wcjsondocarenastrings(struct wcjson *ctx,
+    struct wcjson_arena *arena, struct wcjson_document *doc);
+
+WCJSON_EXPORT int wcjsondocarenambstrings(struct wcjson *ctx,
+    struct wcjson_arena *arena, struct wcjson_document *doc);
+
+WCJSON_EXPORT int wcjsonbind(struct wcjson *ctx,
+    struct wcjson_binder *binder, const wchar_t *txt, const size_t len);
+
 WCJSON_EXPORT int wcjsondocfprint(FILE *f, const struct wcjson_document *doc,
     const struct wcjson_value *value);
 
 WCJSON_EXPORT int wcjsondocfprintasc(FILE *f, const struct wcjson_document *doc,
     const struct wcjson_value *value);
 
+WCJSON_EXPORT int wcjsondocwrite(int fd, const struct wcjson_document *doc,
+    const struct wcjson_value *value);
+
+WCJSON_EXPORT int wcjsondocwriteasc(int fd,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *value);
+
+WCJSON_EXPORT int wcjsondocserialize(const struct wcjson_document *doc,
+    const struct wcjson_value *value,
+    int (*sink)(void *ctx, const wchar_t *s, size_t len), void *sink_ctx,
+    wchar_t *chunk, size_t chunk_len);
+
+WCJSON_EXPORT int wcjsondocserializeasc(const struct wcjson_document *doc,
+    const struct wcjson_value *value,
+    int (*sink)(void *ctx, const wchar_t *s, size_t len), void *sink_ctx,
+    wchar_t *chunk, size_t chunk_len);
+
 WCJSON_EXPORT int wcjsondocsprint(wchar_t *s, size_t *lenp,
     const struct wcjson_document *doc,
     const struct wcjson_value *value);
@@ -187,6 +447,60 @@ WCJSON_EXPORT int wcjsondocsprintasc(wchar_t *s, size_t *lenp,
     const struct wcjson_document *doc,
     const struct wcjson_value *value);
 
+WCJSON_EXPORT int wcjsondocmtsprint(wchar_t *s, size_t *lenp,
+    const struct wcjson_document *doc, const struct wcjson_value *value,
+    const size_t nthreads);
+
+WCJSON_EXPORT int wcjsondocmtsprintasc(wchar_t *s, size_t *lenp,
+    const struct wcjson_document *doc, const struct wcjson_value *value,
+    const size_t nthreads);
+
+WCJSON_EXPORT int wcjsondocsprintmb(char *s, size_t *lenp,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *value);
+
+WCJSON_EXPORT int wcjsondocsprintmbasc(char *s, size_t *lenp,
+    const struct wcjson_document *doc,
+    const struct wcjson_value *value);
+
+WCJSON_EXPORT int wcjson_writer_begin_object(struct wcjson_writer *w);
+
+WCJSON_EXPORT int wcjson_writer_end_object(struct wcjson_writer *w);
+
+WCJSON_EXPORT int wcjson_writer_begin_array(struct wcjson_writer *w);
+
+WCJSON_EXPORT int wcjson_writer_end_array(struct wcjson_writer *w);
+
+WCJSON_EXPORT int wcjson_writer_key(struct wcjson_writer *w,
+    const wchar_t *key, const size_t len);
+
+WCJSON_EXPORT int wcjson_writer_string(struct wcjson_writer *w,
+    const wchar_t *val, const size_t len);
+
+WCJSON_EXPORT int wcjson_writer_number(struct wcjson_writer *w,
+    const wchar_t *val, const size_t len);
+
+WCJSON_EXPORT int wcjson_writer_double(struct wcjson_writer *w,
+    const double val);
+
+WCJSON_EXPORT int wcjson_writer_int64(struct wcjson_writer *w,
+    const int64_t val);
+
+WCJSON_EXPORT int wcjson_writer_uint64(struct wcjson_writer *w,
+    const uint64_t val);
+
+WCJSON_EXPORT int wcjson_writer_bool(struct wcjson_writer *w, const bool val);
+
+WCJSON_EXPORT int wcjson_writer_null(struct wcjson_writer *w);
+
+WCJSON_EXPORT int wcjson_writer_flush(struct wcjson_writer *w);
+
+WCJSON_EXPORT int wcjsondocsave(int fd, const struct wcjson_document *doc);
+
+WCJSON_EXPORT int wcjsondocload(int fd, struct wcjson_document *doc);
+
+WCJSON_EXPORT int wcjsondocunload(struct wcjson_document *doc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,902 @@
+/*
+ * Copyright (c) 2025-2026 Christian Schulte <cs@schulte.it>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef WCJSON_PARSE_H
+#define WCJSON_PARSE_H
+
+/*
+ * Parser core instantiated once per code unit type by the translation unit
+ * including it, which defines
+ *
+ *   PARSE_CHAR              code unit type of the text
+ *   PARSE_UNIT              type code units are compared as
+ *   PARSE_UNIT_IN_RANGE(c)  whether unit c is within the encoding
+ *   PARSE_LIT(s)            string literal s made of code units
+ *   PARSE_OPS               callbacks taking strings of code units
+ *   PARSE_ENTRY             name of the exported entry point
+ */
+
+enum token {
+	T_OBJ_START,
+	T_OBJ_END,
+	T_ARR_START,
+	T_ARR_END,
+	T_COMMA,
+	T_COLON,
+	T_QUOTE,
+	T_TRUE,
+	T_FALSE,
+	T_NULL,
+	T_NUMBER,
+	T_UNKNOWN,
+};
+
+struct scan_state {
+	size_t pos;
+	size_t len;
+	const PARSE_CHAR *txt;
+	bool escaped;
+};
+
+static void *parse_array(struct scan_state *, struct wcjson *,
+    const PARSE_OPS *, void *, void *);
+static void *parse_object(struct scan_state *, struct wcjson *,
+    const PARSE_OPS *, void *, void *);
+
+static enum token
+scan(struct scan_state *ss)
+{
+	switch (ss->txt[ss->pos]) {
+	case L'{':
+		return T_OBJ_START;
+	case L'}':
+		return T_OBJ_END;
+	case L'[':
+		return T_ARR_START;
+	case L']':
+		return T_ARR_END;
+	case L',':
+		return T_COMMA;
+	case L':':
+		return T_COLON;
+	case L'"':
+		return T_QUOTE;
+	case L't':
+		return T_TRUE;
+	case L'f':
+		return T_FALSE;
+	case L'n':
+		return T_NULL;
+	case L'-':
+		return T_NUMBER;
+	default:
+		return (ss->txt[ss->pos] >= L'0' && ss->txt[ss->pos] <= L'9') ?
+		    T_NUMBER : T_UNKNOWN;
+	}
+}
+
+static inline enum wcjson_status
+scan_ws(struct scan_state *ss)
+{
+	for (; ss->pos < ss->len; ss->pos++)
+		switch (ss->txt[ss->pos]) {
+		case L'\t':
+		case L'\n':
+		case L'\r':
+		case L' ':
+			break;
+		default:
+			return WCJSON_OK;
+		}
+
+	return WCJSON_OK;
+}
+
+static inline enum wcjson_status
+scan_literal(struct scan_state *ss, const PARSE_CHAR *lit,
+    const size_t lit_len)
+{
+	size_t i = 0;
+
+	for (; ss->pos < ss->len && i < lit_len; ss->pos++, i++)
+		if (ss->txt[ss->pos] != lit[i])
+			return WCJSON_ABORT_INVALID;
+
+	if (i < lit_len)
+		return WCJSON_ABORT_END_OF_INPUT;
+
+	return WCJSON_OK;
+}
+
+static void *
+parse_null(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc)
+{
+	ctx->status = scan_literal(ss, PARSE_LIT("null"), 4);
+	return ctx->status == WCJSON_OK && ops != NULL ? ops->null_value(ctx,
+	    doc) : NULL;
+}
+
+static void *
+parse_true(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc)
+{
+	ctx->status = scan_literal(ss, PARSE_LIT("true"), 4);
+	return ctx->status == WCJSON_OK && ops != NULL ?
+	    ops->bool_value(ctx, doc, true) :
+	    NULL;
+}
+
+static void *
+parse_false(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc)
+{
+	ctx->status = scan_literal(ss, PARSE_LIT("false"), 5);
+	return ctx->status == WCJSON_OK && ops != NULL ?
+	    ops->bool_value(ctx, doc, false) :
+	    NULL;
+}
+
+static inline enum wcjson_status
+scan_int(struct scan_state *ss)
+{
+	bool digits = false;
+	bool zero = false;
+	const size_t start = ss->pos;
+
+	for (; ss->pos < ss->len; ss->pos++) {
+		switch (ss->txt[ss->pos]) {
+		case L'0':
+			if (zero)
+				return WCJSON_ABORT_INVALID;
+
+			zero = ss->pos == start;
+			digits = true;
+			break;
+		default:
+			if (ss->txt[ss->pos] >= L'1' &&
+			    ss->txt[ss->pos] <= L'9') {
+				if (zero)
+					return WCJSON_ABORT_INVALID;
+
+				zero = false;
+				digits = true;
+			} else
+				goto out;
+			break;
+		}
+	}
+
+out:
+	return digits ? WCJSON_OK : WCJSON_ABORT_INVALID;
+}
+
+static inline enum wcjson_status
+scan_frac(struct scan_state *ss)
+{
+	if (ss->txt[ss->pos] != L'.')
+		return WCJSON_OK;
+
+	if (++ss->pos == ss->len)
+		return WCJSON_ABORT_END_OF_INPUT;
+
+	bool digits = false;
+
+	for (; ss->pos < ss->len; ss->pos++)
+		if (ss->txt[ss->pos] >= L'0' && ss->txt[ss->pos] <= L'9')
+			digits = true;
+		else
+			goto out;
+
+out:
+	return digits ? WCJSON_OK : WCJSON_ABORT_INVALID;
+}
+
+static inline enum wcjson_status
+scan_exp(struct scan_state *ss)
+{
+	if (ss->txt[ss->pos] != L'e' && ss->txt[ss->pos] != L'E')
+		return WCJSON_OK;
+
+	if (++ss->pos == ss->len)
+		return WCJSON_ABORT_END_OF_INPUT;
+
+	bool op = false;
+	bool digits = false;
+
+	for (; ss->pos < ss->len; ss->pos++)
+		switch (ss->txt[ss->pos]) {
+		case L'-':
+		case L'+':
+			if (op)
+				return WCJSON_ABORT_INVALID;
+
+			op = true;
+			break;
+		default:
+			if (ss->txt[ss->pos] >= L'0' &&
+			    ss->txt[ss->pos] <= L'9')
+				digits = true;
+			else
+				goto out;
+			break;
+		}
+
+out:
+	if (op)
+		return digits ? WCJSON_OK : WCJSON_ABORT_END_OF_INPUT;
+	else
+		return digits ? WCJSON_OK : WCJSON_ABORT_INVALID;
+}
+
+static void *
+parse_number(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc)
+{
+	const size_t start = ss->pos;
+
+	if (ss->txt[ss->pos] == L'-' && ++ss->pos == ss->len) {
+		ctx->status = WCJSON_ABORT_END_OF_INPUT;
+		return NULL;
+	}
+
+	ctx->status = scan_int(ss);
+
+	if (ctx->status != WCJSON_OK)
+		return NULL;
+
+	if (ss->pos < ss->len) {
+		ctx->status = scan_frac(ss);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+	}
+
+	if (ss->pos < ss->len) {
+		ctx->status = scan_exp(ss);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+	}
+
+	return ops != NULL ?
+	    ops->number_value(ctx, doc, &ss->txt[start], ss->pos - start) :
+	    NULL;
+}
+
+static inline enum wcjson_status
+scan_unescaped(struct scan_state *ss)
+{
+	for (; ss->pos < ss->len; ss->pos++) {
+		const PARSE_UNIT c = (PARSE_UNIT)ss->txt[ss->pos];
+
+		if (!((c >= 0x20 && c <= 0x21) || (c >= 0x23 && c <= 0x5b) ||
+		    (c >= 0x5d && PARSE_UNIT_IN_RANGE(c))))
+			break;
+	}
+
+	return WCJSON_OK;
+}
+
+static inline enum wcjson_status
+scan_hex4(uint16_t *r, struct scan_state *ss)
+{
+	*r = 0;
+
+	for (int e = 3; ss->pos < ss->len && e >= 0; ss->pos++, e--)
+		if (ss->txt[ss->pos] >= L'0' && ss->txt[ss->pos] <= L'9')
+			*r += (uint16_t)((ss->txt[ss->pos] - L'0') *
+			    (1 << (e << 2)));
+		else if (ss->txt[ss->pos] >= L'a' && ss->txt[ss->pos] <= L'f')
+			*r += (uint16_t)((ss->txt[ss->pos] - L'a' + 10) *
+			    (1 << (e << 2)));
+		else if (ss->txt[ss->pos] >= L'A' && ss->txt[ss->pos] <= L'F')
+			*r += (uint16_t)((ss->txt[ss->pos] - L'A' + 10) *
+			    (1 << (e << 2)));
+		else
+			return WCJSON_ABORT_INVALID;
+
+	return ss->pos < ss->len ? WCJSON_OK : WCJSON_ABORT_END_OF_INPUT;
+}
+
+static inline enum wcjson_status
+scan_escaped(struct scan_state *ss)
+{
+	uint16_t unescaped;
+	enum wcjson_status status;
+
+	if (++ss->pos == ss->len)
+		return WCJSON_ABORT_END_OF_INPUT;
+
+	switch (ss->txt[ss->pos]) {
+	case L'"':
+	case L'\\':
+	case L'/':
+	case L'b':
+	case L'f':
+	case L'n':
+	case L'r':
+	case L't':
+		if (++ss->pos == ss->len)
+			return WCJSON_ABORT_END_OF_INPUT;
+
+		ss->escaped = true;
+		return WCJSON_OK;
+	case L'u':
+		if (++ss->pos == ss->len)
+			return WCJSON_ABORT_END_OF_INPUT;
+
+		status = scan_hex4(&unescaped, ss);
+
+		if (status != WCJSON_OK)
+			return status;
+
+		if (unescaped < 0x20)
+			return WCJSON_ABORT_INVALID;
+
+		if (unescaped >= 0xd800 && unescaped <= 0xdfff) {
+			// UTF 16 surrogates
+			if (unescaped > 0xdbff || ss->txt[ss->pos] != L'\\')
+				return WCJSON_ABORT_INVALID;
+
+			if (++ss->pos == ss->len)
+				return WCJSON_ABORT_END_OF_INPUT;
+
+			if (ss->txt[ss->pos] != L'u')
+				return WCJSON_ABORT_INVALID;
+
+			if (++ss->pos == ss->len)
+				return WCJSON_ABORT_END_OF_INPUT;
+
+			status = scan_hex4(&unescaped, ss);
+
+			if (status != WCJSON_OK)
+				return status;
+
+			if (unescaped < 0xdc00 || unescaped > 0xdfff)
+				return WCJSON_ABORT_INVALID;
+		}
+
+		ss->escaped = true;
+		return WCJSON_OK;
+	default:
+		return WCJSON_ABORT_INVALID;
+	}
+}
+
+static void *
+parse_string(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc)
+{
+	ss->escaped = false;
+
+	if (++ss->pos == ss->len) {
+		ctx->status = WCJSON_ABORT_END_OF_INPUT;
+		return NULL;
+	}
+
+	size_t start = ss->pos;
+
+next_part:
+	ctx->status = scan_unescaped(ss);
+
+	if (ctx->status != WCJSON_OK)
+		return NULL;
+
+	if (ss->pos == ss->len) {
+		ctx->status = WCJSON_ABORT_END_OF_INPUT;
+		return NULL;
+	}
+
+	switch (ss->txt[ss->pos]) {
+	case L'"':
+		if (ss->pos < ss->len)
+			ss->pos++;
+
+		return ops != NULL ?
+		    ss->pos == start ?
+		    ops->string_value(ctx, doc, PARSE_LIT(""), 0, false) :
+		    ops->string_value(ctx, doc, &ss->txt[start],
+		    ss->pos - start - 1, ss->escaped) :
+		    NULL;
+
+	case L'\\':
+		ctx->status = scan_escaped(ss);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		goto next_part;
+	default:
+		ctx->status = WCJSON_ABORT_INVALID;
+		return NULL;
+	}
+}
+
+static void *
+parse_object(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc,
+    void *parent)
+{
+	void *obj = ops != NULL ? ops->object_start(ctx, doc, parent) : NULL;
+	void *key = NULL;
+	bool key_seen = false;
+	bool value_seen = false;
+
+	if (ctx->status != WCJSON_OK)
+		return NULL;
+
+	// Scans a skipped object without calling back
+	if (obj == WCJSON_SKIP)
+		ops = NULL;
+
+	if (++ss->pos == ss->len) {
+		ctx->status = WCJSON_ABORT_END_OF_INPUT;
+		return NULL;
+	}
+
+next_token:
+	ctx->status = scan_ws(ss);
+
+	if (ctx->status != WCJSON_OK)
+		return NULL;
+
+	if (ss->pos == ss->len) {
+		ctx->status = WCJSON_ABORT_END_OF_INPUT;
+		return NULL;
+	}
+
+	switch (scan(ss)) {
+	case T_OBJ_END: {
+		if (key_seen) {
+			ctx->status = WCJSON_ABORT_INVALID;
+			return NULL;
+		}
+
+		if (ops != NULL)
+			ops->object_end(ctx, doc, obj);
+
+		if (ss->pos < ss->len)
+			ss->pos++;
+
+		return obj;
+	}
+	case T_QUOTE: {
+		if (key_seen) {
+			ctx->status = WCJSON_ABORT_INVALID;
+			return NULL;
+		}
+
+		key = parse_string(ss, ctx, ops, doc);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		key_seen = true;
+		goto next_token;
+	}
+	case T_COLON: {
+		if (!key_seen) {
+			ctx->status = WCJSON_ABORT_INVALID;
+			return NULL;
+		}
+
+		if (++ss->pos == ss->len) {
+			ctx->status = WCJSON_ABORT_END_OF_INPUT;
+			return NULL;
+		}
+
+		ctx->status = scan_ws(ss);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ss->pos == ss->len) {
+			ctx->status = WCJSON_ABORT_END_OF_INPUT;
+			return NULL;
+		}
+
+		switch (scan(ss)) {
+		case T_TRUE: {
+			void *value = parse_true(ss, ctx, ops, doc);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+
+			if (ops != NULL) {
+				ops->object_add(ctx, doc, obj, key, value);
+
+				if (ctx->status != WCJSON_OK)
+					return NULL;
+			}
+
+			key_seen = false;
+			value_seen = true;
+			break;
+		}
+		case T_FALSE: {
+			void *value = parse_false(ss, ctx, ops, doc);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+
+			if (ops != NULL) {
+				ops->object_add(ctx, doc, obj, key, value);
+
+				if (ctx->status != WCJSON_OK)
+					return NULL;
+			}
+
+			key_seen = false;
+			value_seen = true;
+			break;
+		}
+		case T_NULL: {
+			void *value = parse_null(ss, ctx, ops, doc);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+
+			if (ops != NULL) {
+				ops->object_add(ctx, doc, obj, key, value);
+
+				if (ctx->status != WCJSON_OK)
+					return NULL;
+			}
+
+			key_seen = false;
+			value_seen = true;
+			break;
+		}
+		case T_NUMBER: {
+			void *value = parse_number(ss, ctx, ops, doc);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+
+			if (ops != NULL) {
+				ops->object_add(ctx, doc, obj, key, value);
+
+				if (ctx->status != WCJSON_OK)
+					return NULL;
+			}
+
+			key_seen = false;
+			value_seen = true;
+			break;
+		}
+		case T_QUOTE: {
+			void *value = parse_string(ss, ctx, ops, doc);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+
+			if (ops != NULL) {
+				ops->object_add(ctx, doc, obj, key, value);
+
+				if (ctx->status != WCJSON_OK)
+					return NULL;
+			}
+
+			key_seen = false;
+			value_seen = true;
+			break;
+		}
+		case T_OBJ_START: {
+			void *value = parse_object(ss, ctx, ops, doc, obj);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+
+			if (ops != NULL) {
+				ops->object_add(ctx, doc, obj, key, value);
+
+				if (ctx->status != WCJSON_OK)
+					return NULL;
+			}
+
+			key_seen = false;
+			value_seen = true;
+			break;
+		}
+		case T_ARR_START: {
+			void *value = parse_array(ss, ctx, ops, doc, obj);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+
+			if (ops != NULL) {
+				ops->object_add(ctx, doc, obj, key, value);
+
+				if (ctx->status != WCJSON_OK)
+					return NULL;
+			}
+
+			key_seen = false;
+			value_seen = true;
+			break;
+		}
+		default:
+			ctx->status = WCJSON_ABORT_INVALID;
+			return NULL;
+		}
+		goto next_token;
+	}
+	case T_COMMA: {
+		if (!value_seen) {
+			ctx->status = WCJSON_ABORT_INVALID;
+			return NULL;
+		}
+		value_seen = false;
+
+		if (++ss->pos == ss->len) {
+			ctx->status = WCJSON_ABORT_END_OF_INPUT;
+			return NULL;
+		}
+
+		goto next_token;
+	}
+	default:
+		ctx->status = WCJSON_ABORT_INVALID;
+		return NULL;
+	}
+}
+
+static void *
+parse_array(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc,
+    void *parent)
+{
+	void *arr = ops != NULL ? ops->array_start(ctx, doc, parent) : NULL;
+	bool value_seen = false;
+
+	if (ctx->status != WCJSON_OK)
+		return NULL;
+
+	// Scans a skipped array without calling back
+	if (arr == WCJSON_SKIP)
+		ops = NULL;
+
+	if (++ss->pos == ss->len) {
+		ctx->status = WCJSON_ABORT_END_OF_INPUT;
+		return NULL;
+	}
+
+next_token:
+	ctx->status = scan_ws(ss);
+
+	if (ctx->status != WCJSON_OK)
+		return NULL;
+
+	if (ss->pos == ss->len) {
+		ctx->status = WCJSON_ABORT_END_OF_INPUT;
+		return NULL;
+	}
+
+	switch (scan(ss)) {
+	case T_ARR_END: {
+		if (ss->pos < ss->len) {
+			ss->pos++;
+		}
+
+		if (ops != NULL)
+			ops->array_end(ctx, doc, arr);
+
+		return arr;
+	}
+	case T_COMMA: {
+		if (!value_seen) {
+			ctx->status = WCJSON_ABORT_INVALID;
+			return NULL;
+		}
+		value_seen = false;
+
+		if (++ss->pos == ss->len) {
+			ctx->status = WCJSON_ABORT_END_OF_INPUT;
+			return NULL;
+		}
+
+		goto next_token;
+	}
+	case T_TRUE: {
+		void *value = parse_true(ss, ctx, ops, doc);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ops != NULL) {
+			ops->array_add(ctx, doc, arr, value);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+		}
+
+		value_seen = true;
+		goto next_token;
+	}
+	case T_FALSE: {
+		void *value = parse_false(ss, ctx, ops, doc);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ops != NULL) {
+			ops->array_add(ctx, doc, arr, value);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+		}
+
+		value_seen = true;
+		goto next_token;
+	}
+	case T_NULL: {
+		void *value = parse_null(ss, ctx, ops, doc);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ops != NULL) {
+			ops->array_add(ctx, doc, arr, value);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+		}
+
+		value_seen = true;
+		goto next_token;
+	}
+	case T_NUMBER: {
+		void *value = parse_number(ss, ctx, ops, doc);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ops != NULL) {
+			ops->array_add(ctx, doc, arr, value);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+		}
+
+		value_seen = true;
+		goto next_token;
+	}
+	case T_QUOTE: {
+		void *value = parse_string(ss, ctx, ops, doc);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ops != NULL) {
+			ops->array_add(ctx, doc, arr, value);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+		}
+
+		value_seen = true;
+		goto next_token;
+	}
+	case T_OBJ_START: {
+		void *value = parse_object(ss, ctx, ops, doc, arr);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ops != NULL) {
+			ops->array_add(ctx, doc, arr, value);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+		}
+
+		value_seen = true;
+		goto next_token;
+	}
+	case T_ARR_START: {
+		void *value = parse_array(ss, ctx, ops, doc, arr);
+
+		if (ctx->status != WCJSON_OK)
+			return NULL;
+
+		if (ops != NULL) {
+			ops->array_add(ctx, doc, arr, value);
+
+			if (ctx->status != WCJSON_OK)
+				return NULL;
+		}
+
+		value_seen = true;
+		goto next_token;
+	}
+	default:
+		ctx->status = WCJSON_ABORT_INVALID;
+		return NULL;
+	}
+}
+
+static void
+parse_json_text(struct scan_state *ss, struct wcjson *ctx,
+    const PARSE_OPS *ops, void *doc)
+{
+	ctx->status = scan_ws(ss);
+
+	if (ctx->status != WCJSON_OK)
+		return;
+
+	if (ss->pos == ss->len)
+		return;
+
+	switch (scan(ss)) {
+	case T_TRUE:
+		parse_true(ss, ctx, ops, doc);
+		break;
+	case T_FALSE:
+		parse_false(ss, ctx, ops, doc);
+		break;
+	case T_NULL:
+		parse_null(ss, ctx, ops, doc);
+		break;
+	case T_NUMBER:
+		parse_number(ss, ctx, ops, doc);
+		break;
+	case T_QUOTE:
+		parse_string(ss, ctx, ops, doc);
+		break;
+	case T_OBJ_START:
+		parse_object(ss, ctx, ops, doc, NULL);
+		break;
+	case T_ARR_START:
+		parse_array(ss, ctx, ops, doc, NULL);
+		break;
+	default:
+		ctx->status = WCJSON_ABORT_INVALID;
+		return;
+	}
+
+	if (ctx->status != WCJSON_OK)
+		return;
+
+	ctx->status = scan_ws(ss);
+
+	if (ctx->status == WCJSON_OK && ss->pos != ss->len)
+		ctx->status = WCJSON_ABORT_INVALID;
+}
+
+int
+PARSE_ENTRY(struct wcjson *ctx, const PARSE_OPS *ops, void *doc,
+    const PARSE_CHAR *txt, const size_t len)
+{
+	ctx->status = WCJSON_OK;
+	ctx->errnum = 0;
+
+	if (txt != NULL && len > 0 && len < SIZE_MAX) {
+		struct scan_state ss = {
+			.pos = 0,
+			.len = len,
+			.txt = txt,
+			.escaped = false,
+		};
+
+		parse_json_text(&ss, ctx, ops, doc);
+	} else
+		ctx->status = WCJSON_ABORT_INVALID;
+
+	return ctx->status == WCJSON_OK ? 0 : -1;
+}
+
+#endif
@@ -46,879 +46,31 @@ extern "C" {
 
 static const wchar_t *const hex_digits = L"0123456789abcdef";
 
-enum token {
-	T_OBJ_START,
-	T_OBJ_END,
-	T_ARR_START,
-	T_ARR_END,
-	T_COMMA,
-	T_COLON,
-	T_QUOTE,
-	T_TRUE,
-	T_FALSE,
-	T_NULL,
-	T_NUMBER,
-	T_UNKNOWN,
-};
-
-struct scan_state {
-	size_t pos;
-	size_t len;
-	const wchar_t *txt;
-	bool escaped;
-};
-
-static void *parse_array(struct scan_state *, struct wcjson *,
-    const struct wcjson_ops *, void *, void *);
-static void *parse_object(struct scan_state *, struct wcjson *,
-    const struct wcjson_ops *, void *, void *);
-
-static enum token
-scan(struct scan_state *ss)
-{
-	switch (ss->txt[ss->pos]) {
-	case L'{':
-		return T_OBJ_START;
-	case L'}':
-		return T_OBJ_END;
-	case L'[':
-		return T_ARR_START;
-	case L']':
-		return T_ARR_END;
-	case L',':
-		return T_COMMA;
-	case L':':
-		return T_COLON;
-	case L'"':
-		return T_QUOTE;
-	case L't':
-		return T_TRUE;
-	case L'f':
-		return T_FALSE;
-	case L'n':
-		return T_NULL;
-	case L'-':
-		return T_NUMBER;
-	default:
-		return (ss->txt[ss->pos] >= L'0' && ss->txt[ss->pos] <= L'9') ?
-		    T_NUMBER : T_UNKNOWN;
-	}
-}
-
-static inline enum wcjson_status
-scan_ws(struct scan_state *ss)
-{
-	for (; ss->pos < ss->len; ss->pos++)
-		switch (ss->txt[ss->pos]) {
-		case L'\t':
-		case L'\n':
-		case L'\r':
-		case L' ':
-			break;
-		default:
-			return WCJSON_OK;
-		}
-
-	return WCJSON_OK;
-}
-
-static inline enum wcjson_status
-scan_literal(struct scan_state *ss, const wchar_t *lit, const size_t lit_len)
-{
-	size_t i = 0;
-
-	for (; ss->pos < ss->len && i < lit_len; ss->pos++, i++)
-		if (ss->txt[ss->pos] != lit[i])
-			return WCJSON_ABORT_INVALID;
-
-	if (i < lit_len)
-		return WCJSON_ABORT_END_OF_INPUT;
-
-	return WCJSON_OK;
-}
-
-static void *
-parse_null(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc)
-{
-	ctx->status = scan_literal(ss, L"null", 4);
-	return ctx->status == WCJSON_OK && ops != NULL ? ops->null_value(ctx,
-	    doc) : NULL;
-}
-
-static void *
-parse_true(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc)
-{
-	ctx->status = scan_literal(ss, L"true", 4);
-	return ctx->status == WCJSON_OK && ops != NULL ?
-	    ops->bool_value(ctx, doc, true) :
-	    NULL;
-}
-
-static void *
-parse_false(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc)
-{
-	ctx->status = scan_literal(ss, L"false", 5);
-	return ctx->status == WCJSON_OK && ops != NULL ?
-	    ops->bool_value(ctx, doc, false) :
-	    NULL;
-}
-
-static inline enum wcjson_status
-scan_int(struct scan_state *ss)
-{
-	bool digits = false;
-	bool zero = false;
-	const size_t start = ss->pos;
-
-	for (; ss->pos < ss->len; ss->pos++) {
-		switch (ss->txt[ss->pos]) {
-		case L'0':
-			if (zero)
-				return WCJSON_ABORT_INVALID;
-
-			zero = ss->pos == start;
-			digits = true;
-			break;
-		default:
-			if (ss->txt[ss->pos] >= L'1' &&
-			    ss->txt[ss->pos] <= L'9') {
-				if (zero)
-					return WCJSON_ABORT_INVALID;
-
-				zero = false;
-				digits = true;
-			} else
-				goto out;
-			break;
-		}
-	}
-
-out:
-	return digits ? WCJSON_OK : WCJSON_ABORT_INVALID;
-}
-
-static inline enum wcjson_status
-scan_frac(struct scan_state *ss)
-{
-	if (ss->txt[ss->pos] != L'.')
-		return WCJSON_OK;
-
-	if (++ss->pos == ss->len)
-		return WCJSON_ABORT_END_OF_INPUT;
-
-	bool digits = false;
-
-	for (; ss->pos < ss->len; ss->pos++)
-		if (ss->txt[ss->pos] >= L'0' && ss->txt[ss->pos] <= L'9')
-			digits = true;
-		else
-			goto out;
-
-out:
-	return digits ? WCJSON_OK : WCJSON_ABORT_INVALID;
-}
-
-static inline enum wcjson_status
-scan_exp(struct scan_state *ss)
-{
-	if (ss->txt[ss->pos] != L'e' && ss->txt[ss->pos] != L'E')
-		return WCJSON_OK;
-
-	if (++ss->pos == ss->len)
-		return WCJSON_ABORT_END_OF_INPUT;
-
-	bool op = false;
-	bool digits = false;
-
-	for (; ss->pos < ss->len; ss->pos++)
-		switch (ss->txt[ss->pos]) {
-		case L'-':
-		case L'+':
-			if (op)
-				return WCJSON_ABORT_INVALID;
-
-			op = true;
-			break;
-		default:
-			if (ss->txt[ss->pos] >= L'0' &&
-			    ss->txt[ss->pos] <= L'9')
-				digits = true;
-			else
-				goto out;
-			break;
-		}
-
-out:
-	if (op)
-		return digits ? WCJSON_OK : WCJSON_ABORT_END_OF_INPUT;
-	else
-		return digits ? WCJSON_OK : WCJSON_ABORT_INVALID;
-}
-
-static void *
-parse_number(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc)
-{
-	const size_t start = ss->pos;
-
-	if (ss->txt[ss->pos] == L'-' && ++ss->pos == ss->len) {
-		ctx->status = WCJSON_ABORT_END_OF_INPUT;
-		return NULL;
-	}
-
-	ctx->status = scan_int(ss);
-
-	if (ctx->status != WCJSON_OK)
-		return NULL;
-
-	if (ss->pos < ss->len) {
-		ctx->status = scan_frac(ss);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-	}
-
-	if (ss->pos < ss->len) {
-		ctx->status = scan_exp(ss);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-	}
-
-	return ops != NULL ?
-	    ops->number_value(ctx, doc, &ss->txt[start], ss->pos - start) :
-	    NULL;
-}
-
-static inline enum wcjson_status
-scan_unescaped(struct scan_state *ss)
-{
-	for (; ss->pos < ss->len; ss->pos++)
-		if (!((ss->txt[ss->pos] >= (wchar_t)0x20 &&
-		    ss->txt[ss->pos] <= (wchar_t)0x21) ||
-		    (ss->txt[ss->pos] >= (wchar_t)0x23 &&
-		     ss->txt[ss->pos] <= (wchar_t)0x5b) ||
-		    (ss->txt[ss->pos] >= (wchar_t)0x5d &&
 #if defined(WCHAR_T_UTF32)
-		     ss->txt[ss->pos] <= (wchar_t)0x10ffff)))
+#define PARSE_UNIT_IN_RANGE(c) ((c) <= (wchar_t)0x10ffff)
 #elif defined(WCHAR_T_UTF16)
 #if SIZEOF_WCHAR_T == 2
-		    true)))
+#define PARSE_UNIT_IN_RANGE(c) true
 #else
-           ss->txt[ss->pos] <= (wchar_t)0xffff)))
+#define PARSE_UNIT_IN_RANGE(c) ((c) <= (wchar_t)0xffff)
 #endif
 #elif defined(WCHAR_T_UTF8)
 #if SIZEOF_WCHAR_T == 1
-		    true)))
+#define PARSE_UNIT_IN_RANGE(c) true
 #else
-		    ss->txt[ss->pos] <= (wchar_t)0xff)))
+#define PARSE_UNIT_IN_RANGE(c) ((c) <= (wchar_t)0xff)
 #endif
 #else
 #error "Wide character literal encoding not defined"
 #endif
-			break;
-
-	return WCJSON_OK;
-#undef __limit
-}
-
-static inline enum wcjson_status
-scan_hex4(uint16_t *r, struct scan_state *ss)
-{
-	*r = 0;
-
-	for (int e = 3; ss->pos < ss->len && e >= 0; ss->pos++, e--)
-		if (ss->txt[ss->pos] >= L'0' && ss->txt[ss->pos] <= L'9')
-			*r += (uint16_t)((ss->txt[ss->pos] - L'0') *
-			    (1 << (e << 2)));
-		else if (ss->txt[ss->pos] >= L'a' && ss->txt[ss->pos] <= L'f')
-			*r += (uint16_t)((ss->txt[ss->pos] - L'a' + 10) *
-			    (1 << (e << 2)));
-		else if (ss->txt[ss->pos] >= L'A' && ss->txt[ss->pos] <= L'F')
-			*r += (uint16_t)((ss->txt[ss->pos] - L'A' + 10) *
-			    (1 << (e << 2)));
-		else
-			return WCJSON_ABORT_INVALID;
-
-	return ss->pos < ss->len ? WCJSON_OK : WCJSON_ABORT_END_OF_INPUT;
-}
-
-static inline enum wcjson_status
-scan_escaped(struct scan_state *ss)
-{
-	uint16_t unescaped;
-	enum wcjson_status status;
-
-	if (++ss->pos == ss->len)
-		return WCJSON_ABORT_END_OF_INPUT;
-
-	switch (ss->txt[ss->pos]) {
-	case L'"':
-	case L'\\':
-	case L'/':
-	case L'b':
-	case L'f':
-	case L'n':
-	case L'r':
-	case L't':
-		if (++ss->pos == ss->len)
-			return WCJSON_ABORT_END_OF_INPUT;
-
-		ss->escaped = true;
-		return WCJSON_OK;
-	case L'u':
-		if (++ss->pos == ss->len)
-			return WCJSON_ABORT_END_OF_INPUT;
-
-		status = scan_hex4(&unescaped, ss);
-
-		if (status != WCJSON_OK)
-			return status;
-
-		if (unescaped < 0x20)
-			return WCJSON_ABORT_INVALID;
-
-		if (unescaped >= 0xd800 && unescaped <= 0xdfff) {
-			// UTF 16 surrogates
-			if (unescaped > 0xdbff || ss->txt[ss->pos] != L'\\')
-				return WCJSON_ABORT_INVALID;
-
-			if (++ss->pos == ss->len)
-				return WCJSON_ABORT_END_OF_INPUT;
-
-			if (ss->txt[ss->pos] != L'u')
-				return WCJSON_ABORT_INVALID;
-
-			if (++ss->pos == ss->len)
-				return WCJSON_ABORT_END_OF_INPUT;
-
-			status = scan_hex4(&unescaped, ss);
-
-			if (status != WCJSON_OK)
-				return status;
-
-			if (unescaped < 0xdc00 || unescaped > 0xdfff)
-				return WCJSON_ABORT_INVALID;
-
-			ss->escaped = true;
-		}
-
-		return WCJSON_OK;
-	default:
-		return WCJSON_ABORT_INVALID;
-	}
-}
-
-static void *
-parse_string(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc)
-{
-	ss->escaped = false;
-
-	if (++ss->pos == ss->len) {
-		ctx->status = WCJSON_ABORT_END_OF_INPUT;
-		return NULL;
-	}
-
-	size_t start = ss->pos;
-
-next_part:
-	ctx->status = scan_unescaped(ss);
-
-	if (ctx->status != WCJSON_OK)
-		return NULL;
-
-	if (ss->pos == ss->len) {
-		ctx->status = WCJSON_ABORT_END_OF_INPUT;
-		return NULL;
-	}
-
-	switch (ss->txt[ss->pos]) {
-	case L'"':
-		if (ss->pos < ss->len)
-			ss->pos++;
-
-		return ops != NULL ?
-		    ss->pos == start ?
-		    ops->string_value(ctx, doc, L"", 0, false) :
-		    ops->string_value(ctx, doc, &ss->txt[start],
-		    ss->pos - start - 1, ss->escaped) :
-		    NULL;
-
-	case L'\\':
-		ctx->status = scan_escaped(ss);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		goto next_part;
-	default:
-		ctx->status = WCJSON_ABORT_INVALID;
-		return NULL;
-	}
-}
-
-static void *
-parse_object(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc,
-    void *parent)
-{
-	void *obj = ops != NULL ? ops->object_start(ctx, doc, parent) : NULL;
-	void *key = NULL;
-	bool key_seen = false;
-	bool value_seen = false;
-
-	if (++ss->pos == ss->len) {
-		ctx->status = WCJSON_ABORT_END_OF_INPUT;
-		return NULL;
-	}
-
-next_token:
-	ctx->status = scan_ws(ss);
-
-	if (ctx->status != WCJSON_OK)
-		return NULL;
-
-	if (ss->pos == ss->len) {
-		ctx->status = WCJSON_ABORT_END_OF_INPUT;
-		return NULL;
-	}
-
-	switch (scan(ss)) {
-	case T_OBJ_END: {
-		if (key_seen) {
-			ctx->status = WCJSON_ABORT_INVALID;
-			return NULL;
-		}
-
-		if (ops != NULL)
-			ops->object_end(ctx, doc, obj);
-
-		if (ss->pos < ss->len)
-			ss->pos++;
-
-		return obj;
-	}
-	case T_QUOTE: {
-		if (key_seen) {
-			ctx->status = WCJSON_ABORT_INVALID;
-			return NULL;
-		}
-
-		key = parse_string(ss, ctx, ops, doc);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		key_seen = true;
-		goto next_token;
-	}
-	case T_COLON: {
-		if (!key_seen) {
-			ctx->status = WCJSON_ABORT_INVALID;
-			return NULL;
-		}
-
-		if (++ss->pos == ss->len) {
-			ctx->status = WCJSON_ABORT_END_OF_INPUT;
-			return NULL;
-		}
-
-		ctx->status = scan_ws(ss);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ss->pos == ss->len) {
-			ctx->status = WCJSON_ABORT_END_OF_INPUT;
-			return NULL;
-		}
-
-		switch (scan(ss)) {
-		case T_TRUE: {
-			void *value = parse_true(ss, ctx, ops, doc);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-
-			if (ops != NULL) {
-				ops->object_add(ctx, doc, obj, key, value);
-
-				if (ctx->status != WCJSON_OK)
-					return NULL;
-			}
-
-			key_seen = false;
-			value_seen = true;
-			break;
-		}
-		case T_FALSE: {
-			void *value = parse_false(ss, ctx, ops, doc);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-
-			if (ops != NULL) {
-				ops->object_add(ctx, doc, obj, key, value);
-
-				if (ctx->status != WCJSON_OK)
-					return NULL;
-			}
-
-			key_seen = false;
-			value_seen = true;
-			break;
-		}
-		case T_NULL: {
-			void *value = parse_null(ss, ctx, ops, doc);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-
-			if (ops != NULL) {
-				ops->object_add(ctx, doc, obj, key, value);
-
-				if (ctx->status != WCJSON_OK)
-					return NULL;
-			}
-
-			key_seen = false;
-			value_seen = true;
-			break;
-		}
-		case T_NUMBER: {
-			void *value = parse_number(ss, ctx, ops, doc);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-
-			if (ops != NULL) {
-				ops->object_add(ctx, doc, obj, key, value);
-
-				if (ctx->status != WCJSON_OK)
-					return NULL;
-			}
-
-			key_seen = false;
-			value_seen = true;
-			break;
-		}
-		case T_QUOTE: {
-			void *value = parse_string(ss, ctx, ops, doc);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-
-			if (ops != NULL) {
-				ops->object_add(ctx, doc, obj, key, value);
-
-				if (ctx->status != WCJSON_OK)
-					return NULL;
-			}
-
-			key_seen = false;
-			value_seen = true;
-			break;
-		}
-		case T_OBJ_START: {
-			void *value = parse_object(ss, ctx, ops, doc, obj);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-
-			if (ops != NULL) {
-				ops->object_add(ctx, doc, obj, key, value);
-
-				if (ctx->status != WCJSON_OK)
-					return NULL;
-			}
-
-			key_seen = false;
-			value_seen = true;
-			break;
-		}
-		case T_ARR_START: {
-			void *value = parse_array(ss, ctx, ops, doc, obj);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-
-			if (ops != NULL) {
-				ops->object_add(ctx, doc, obj, key, value);
-
-				if (ctx->status != WCJSON_OK)
-					return NULL;
-			}
-
-			key_seen = false;
-			value_seen = true;
-			break;
-		}
-		default:
-			ctx->status = WCJSON_ABORT_INVALID;
-			return NULL;
-		}
-		goto next_token;
-	}
-	case T_COMMA: {
-		if (!value_seen) {
-			ctx->status = WCJSON_ABORT_INVALID;
-			return NULL;
-		}
-		value_seen = false;
-
-		if (++ss->pos == ss->len) {
-			ctx->status = WCJSON_ABORT_END_OF_INPUT;
-			return NULL;
-		}
-
-		goto next_token;
-	}
-	default:
-		ctx->status = WCJSON_ABORT_INVALID;
-		return NULL;
-	}
-}
-
-static void *
-parse_array(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc,
-    void *parent)
-{
-	void *arr = ops != NULL ? ops->array_start(ctx, doc, parent) : NULL;
-	bool value_seen = false;
-
-	if (++ss->pos == ss->len) {
-		ctx->status = WCJSON_ABORT_END_OF_INPUT;
-		return NULL;
-	}
-
-next_token:
-	ctx->status = scan_ws(ss);
-
-	if (ctx->status != WCJSON_OK)
-		return NULL;
-
-	if (ss->pos == ss->len) {
-		ctx->status = WCJSON_ABORT_END_OF_INPUT;
-		return NULL;
-	}
-
-	switch (scan(ss)) {
-	case T_ARR_END: {
-		if (ss->pos < ss->len) {
-			ss->pos++;
-		}
-
-		if (ops != NULL)
-			ops->array_end(ctx, doc, arr);
-
-		return arr;
-	}
-	case T_COMMA: {
-		if (!value_seen) {
-			ctx->status = WCJSON_ABORT_INVALID;
-			return NULL;
-		}
-		value_seen = false;
-
-		if (++ss->pos == ss->len) {
-			ctx->status = WCJSON_ABORT_END_OF_INPUT;
-			return NULL;
-		}
-
-		goto next_token;
-	}
-	case T_TRUE: {
-		void *value = parse_true(ss, ctx, ops, doc);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ops != NULL) {
-			ops->array_add(ctx, doc, arr, value);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-		}
-
-		value_seen = true;
-		goto next_token;
-	}
-	case T_FALSE: {
-		void *value = parse_false(ss, ctx, ops, doc);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ops != NULL) {
-			ops->array_add(ctx, doc, arr, value);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-		}
-
-		value_seen = true;
-		goto next_token;
-	}
-	case T_NULL: {
-		void *value = parse_null(ss, ctx, ops, doc);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ops != NULL) {
-			ops->array_add(ctx, doc, arr, value);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-		}
-
-		value_seen = true;
-		goto next_token;
-	}
-	case T_NUMBER: {
-		void *value = parse_number(ss, ctx, ops, doc);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ops != NULL) {
-			ops->array_add(ctx, doc, arr, value);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-		}
-
-		value_seen = true;
-		goto next_token;
-	}
-	case T_QUOTE: {
-		void *value = parse_string(ss, ctx, ops, doc);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ops != NULL) {
-			ops->array_add(ctx, doc, arr, value);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-		}
-
-		value_seen = true;
-		goto next_token;
-	}
-	case T_OBJ_START: {
-		void *value = parse_object(ss, ctx, ops, doc, arr);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ops != NULL) {
-			ops->array_add(ctx, doc, arr, value);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-		}
-
-		value_seen = true;
-		goto next_token;
-	}
-	case T_ARR_START: {
-		void *value = parse_array(ss, ctx, ops, doc, arr);
-
-		if (ctx->status != WCJSON_OK)
-			return NULL;
-
-		if (ops != NULL) {
-			ops->array_add(ctx, doc, arr, value);
-
-			if (ctx->status != WCJSON_OK)
-				return NULL;
-		}
-
-		value_seen = true;
-		goto next_token;
-	}
-	default:
-		ctx->status = WCJSON_ABORT_INVALID;
-		return NULL;
-	}
-}
-
-static void
-parse_json_text(struct scan_state *ss, struct wcjson *ctx,
-    const struct wcjson_ops *ops, void *doc)
-{
-	ctx->status = scan_ws(ss);
-
-	if (ctx->status != WCJSON_OK)
-		return;
-
-	if (ss->pos == ss->len)
-		return;
-
-	switch (scan(ss)) {
-	case T_TRUE:
-		parse_true(ss, ctx, ops, doc);
-		break;
-	case T_FALSE:
-		parse_false(ss, ctx, ops, doc);
-		break;
-	case T_NULL:
-		parse_null(ss, ctx, ops, doc);
-		break;
-	case T_NUMBER:
-		parse_number(ss, ctx, ops, doc);
-		break;
-	case T_QUOTE:
-		parse_string(ss, ctx, ops, doc);
-		break;
-	case T_OBJ_START:
-		parse_object(ss, ctx, ops, doc, NULL);
-		break;
-	case T_ARR_START:
-		parse_array(ss, ctx, ops, doc, NULL);
-		break;
-	default:
-		ctx->status = WCJSON_ABORT_INVALID;
-		return;
-	}
-
-	if (ctx->status != WCJSON_OK)
-		return;
-
-	ctx->status = scan_ws(ss);
-
-	if (ctx->status == WCJSON_OK && ss->pos != ss->len)
-		ctx->status = WCJSON_ABORT_INVALID;
-}
 
-int
-wcjson(struct wcjson *ctx, const struct wcjson_ops *ops, void *doc,
-    const wchar_t *txt, const size_t len)
-{
-	ctx->status = WCJSON_OK;
-	ctx->errnum = 0;
-
-	if (txt != NULL && len > 0 && len < SIZE_MAX) {
-		struct scan_state ss = {
-			.pos = 0,
-			.len = len,
-			.txt = txt,
-			.escaped = false,
-		};
-
-		parse_json_text(&ss, ctx, ops, doc);
-	} else
-		ctx->status = WCJSON_ABORT_INVALID;
+#define PARSE_CHAR wchar_t
+#define PARSE_UNIT wchar_t
+#define PARSE_LIT(s) L##s
+#define PARSE_OPS struct wcjson_ops
+#define PARSE_ENTRY wcjson
 
-	return ctx->status == WCJSON_OK ? 0 : -1;
-}
+#include "wcjson-parse.h"
 
 static int
 wctojsons_json(const wchar_t c, wchar_t *d, size_t *d_lenp)
@@ -1200,6 +352,150 @@ wctoascjsons(const wchar_t *s, size_t s_len, wchar_t *d, size_t *d_lenp)
 	return wctojsons(s, s_len, d, d_lenp, true);
 }
 
+static inline int
+wctoutf8s_cp(const wchar_t *s, size_t *s_lenp, uint32_t *cpp)
+{
+#if defined(WCHAR_T_UTF32)
+	if ((uint32_t)*s > 0x10ffff ||
+	    ((uint32_t)*s >= 0xd800 && (uint32_t)*s <= 0xdfff))
+		goto err_ilseq;
+
+	*cpp = (uint32_t)*s;
+	*s_lenp = 1;
+	return 0;
+#elif defined(WCHAR_T_UTF16)
+	const uint32_t hs = (uint32_t)*s & 0xffff;
+
+	if (hs >= 0xd800 && hs <= 0xdfff) {
+		// UTF 16 surrogates
+		if (hs > 0xdbff || *s_lenp < 2)
+			goto err_ilseq;
+
+		const uint32_t ls = (uint32_t)s[1] & 0xffff;
+
+		if (ls < 0xdc00 || ls > 0xdfff)
+			goto err_ilseq;
+
+		*cpp = (((hs & B1111111111) << 10) | (ls & B1111111111)) +
+		    (uint32_t)0x10000;
+
+		*s_lenp = 2;
+	} else {
+		*cpp = hs;
+		*s_lenp = 1;
+	}
+	return 0;
+#elif defined(WCHAR_T_UTF8)
+	// Already UTF 8, units are copied as is
+	*cpp = (uint32_t)*s & 0xff;
+	*s_lenp = 1;
+	return 0;
+#else
+#error "Wide character literal encoding not defined"
+#endif
+err_ilseq:
+	errno = EILSEQ;
+	return -1;
+}
+
+static inline size_t
+wctoutf8s_len(const uint32_t cp)
+{
+#if defined(WCHAR_T_UTF8)
+	return 1;
+#else
+	return cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+#endif
+}
+
+static inline void
+wctoutf8s_enc(const uint32_t cp, char *d)
+{
+	unsigned char *u = (unsigned char *)d;
+
+#if defined(WCHAR_T_UTF8)
+	*u = (unsigned char)cp;
+#else
+	if (cp < 0x80)
+		*u = (unsigned char)cp;
+	else if (cp < 0x800) {
+		*u++ = (unsigned char)(B11000000 | (cp >> 6));
+		*u = (unsigned char)(B10000000 | (cp & B111111));
+	} else if (cp < 0x10000) {
+		*u++ = (unsigned char)(B11100000 | (cp >> 12));
+		*u++ = (unsigned char)(B10000000 | ((cp >> 6) & B111111));
+		*u = (unsigned char)(B10000000 | (cp & B111111));
+	} else {
+		*u++ = (unsigned char)(B11110000 | (cp >> 18));
+		*u++ = (unsigned char)(B10000000 | ((cp >> 12) & B111111));
+		*u++ = (unsigned char)(B10000000 | ((cp >> 6) & B111111));
+		*u = (unsigned char)(B10000000 | (cp & B111111));
+	}
+#endif
+}
+
+/* Number of characters tested and copied at once for runs of 7bit ASCII */
+#define UTF8_ASCII_RUN 16
+
+int
+wctoutf8s(const wchar_t *s, size_t s_len, char *d, size_t *d_lenp)
+{
+	size_t d_len = *d_lenp;
+	size_t read, written = 0;
+	uint32_t cp;
+
+	while (s_len != 0) {
+		// Runs of 7bit ASCII characters, branch free for vectorization
+		while (s_len >= UTF8_ASCII_RUN &&
+		    (d != NULL ? d_len - written >= UTF8_ASCII_RUN :
+		    written <= SIZE_MAX - UTF8_ASCII_RUN)) {
+			uint32_t m = 0;
+
+			for (size_t i = 0; i < UTF8_ASCII_RUN; i++)
+				m |= (uint32_t)s[i];
+
+			if (m > 0x7f)
+				break;
+
+			if (d != NULL)
+				for (size_t i = 0; i < UTF8_ASCII_RUN; i++)
+					d[written + i] = (char)s[i];
+
+			s += UTF8_ASCII_RUN;
+			s_len -= UTF8_ASCII_RUN;
+			written += UTF8_ASCII_RUN;
+		}
+
+		if (s_len == 0)
+			break;
+
+		read = s_len;
+
+		if (wctoutf8s_cp(s, &read, &cp) < 0)
+			return -1;
+
+		const size_t n = wctoutf8s_len(cp);
+
+		if (d != NULL) {
+			if (d_len - written < n)
+				goto err_range;
+
+			wctoutf8s_enc(cp, &d[written]);
+		} else if (written > SIZE_MAX - n)
+			goto err_range;
+
+		s += read;
+		s_len -= read;
+		written += n;
+	}
+
+	*d_lenp = written;
+	return 0;
+err_range:
+	errno = ERANGE;
+	return -1;
+}
+
 static int
 wcjsonstowc_backslash_u(const wchar_t *s, size_t *s_lenp, wchar_t *d,
     size_t *d_lenp)
@@ -1216,13 +512,18 @@ wcjsonstowc_backslash_u(const wchar_t *s, size_t *s_lenp, wchar_t *d,
 
 	s++;
 
+	if (4 > s_len)
+		goto err_ilseq;
+
 	ss.pos = 0;
 	ss.txt = s;
 	ss.len = s_len;
 
+	// An escape sequence may end the string
 	status = scan_hex4(&hs, &ss);
 
-	if (status != WCJSON_OK || hs < 0x20)
+	if ((status != WCJSON_OK && status != WCJSON_ABORT_END_OF_INPUT) ||
+	    hs < 0x20)
 		goto err_ilseq;
 
 	s += 4;
@@ -1243,7 +544,7 @@ wcjsonstowc_backslash_u(const wchar_t *s, size_t *s_lenp, wchar_t *d,
 
 		status = scan_hex4(&ls, &ss);
 
-		if (status != WCJSON_OK)
+		if (status != WCJSON_OK && status != WCJSON_ABORT_END_OF_INPUT)
 			goto err_ilseq;
 
 		s_len -= 4;
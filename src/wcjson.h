@@ -23,6 +23,7 @@ extern "C" {
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <uchar.h>
 #include <wchar.h>
 
 #ifdef HAVE_WCJSON_HOST_H
@@ -51,6 +52,9 @@ extern "C" {
 
 #define WCJSON_ESCAPE_MAX 12
 
+/* Returned by object_start or array_start to skip the content */
+#define WCJSON_SKIP ((void *)-1)
+
 enum wcjson_status {
 	WCJSON_OK,
 	WCJSON_ABORT_ERROR,
@@ -85,15 +89,78 @@ struct wcjson_ops {
 	void *(*null_value)(struct wcjson *ctx, void *doc);
 };
 
+struct wcjson_utf8_ops {
+	void *(*object_start)(struct wcjson *ctx, void *doc, void *parent);
+	void (*object_add)(struct wcjson *ctx, void *doc, void *obj, void *key,
+	    void *value);
+	void (*object_end)(struct wcjson *ctx, void *doc, void *obj);
+	void *(*array_start)(struct wcjson *ctx, void *doc, void *parent);
+	void (*array_add)(struct wcjson *ctx, void *doc, void *arr, void *value);
+	void (*array_end)(struct wcjson *ctx, void *doc, void *arr);
+	void *(*string_value)(struct wcjson *ctx, void *doc, const char *str,
+	    const size_t len, const bool escaped);
+	void *(*number_value)(struct wcjson *ctx, void *doc, const char *num,
+	    const size_t len);
+	void *(*bool_value)(struct wcjson *ctx, void *doc, const bool value);
+	void *(*null_value)(struct wcjson *ctx, void *doc);
+};
+
+struct wcjson_utf16_ops {
+	void *(*object_start)(struct wcjson *ctx, void *doc, void *parent);
+	void (*object_add)(struct wcjson *ctx, void *doc, void *obj, void *key,
+	    void *value);
+	void (*object_end)(struct wcjson *ctx, void *doc, void *obj);
+	void *(*array_start)(struct wcjson *ctx, void *doc, void *parent);
+	void (*array_add)(struct wcjson *ctx, void *doc, void *arr, void *value);
+	void (*array_end)(struct wcjson *ctx, void *doc, void *arr);
+	void *(*string_value)(struct wcjson *ctx, void *doc, const char16_t *str,
+	    const size_t len, const bool escaped);
+	void *(*number_value)(struct wcjson *ctx, void *doc, const char16_t *num,
+	    const size_t len);
+	void *(*bool_value)(struct wcjson *ctx, void *doc, const bool value);
+	void *(*null_value)(struct wcjson *ctx, void *doc);
+};
+
+struct wcjson_utf32_ops {
+	void *(*object_start)(struct wcjson *ctx, void *doc, void *parent);
+	void (*object_add)(struct wcjson *ctx, void *doc, void *obj, void *key,
+	    void *value);
+	void (*object_end)(struct wcjson *ctx, void *doc, void *obj);
+	void *(*array_start)(struct wcjson *ctx, void *doc, void *parent);
+	void (*array_add)(struct wcjson *ctx, void *doc, void *arr, void *value);
+	void (*array_end)(struct wcjson *ctx, void *doc, void *arr);
+	void *(*string_value)(struct wcjson *ctx, void *doc, const char32_t *str,
+	    const size_t len, const bool escaped);
+	void *(*number_value)(struct wcjson *ctx, void *doc, const char32_t *num,
+	    const size_t len);
+	void *(*bool_value)(struct wcjson *ctx, void *doc, const bool value);
+	void *(*null_value)(struct wcjson *ctx, void *doc);
+};
+
 WCJSON_EXPORT int wcjson(struct wcjson *ctx, const struct wcjson_ops *ops,
     void *doc, const wchar_t *txt, const size_t len);
 
+WCJSON_EXPORT int wcjsonutf8(struct wcjson *ctx,
+    const struct wcjson_utf8_ops *ops, void *doc, const char *txt,
+    const size_t len);
+
+WCJSON_EXPORT int wcjsonutf16(struct wcjson *ctx,
+    const struct wcjson_utf16_ops *ops, void *doc, const char16_t *txt,
+    const size_t len);
+
+WCJSON_EXPORT int wcjsonutf32(struct wcjson *ctx,
+    const struct wcjson_utf32_ops *ops, void *doc, const char32_t *txt,
+    const size_t len);
+
 WCJSON_EXPORT int wctowcjsons(const wchar_t *s, size_t s_len, wchar_t *d,
     size_t *d_lenp);
 
 WCJSON_EXPORT int wctoascjsons(const wchar_t *s, size_t s_len, wchar_t *d,
     size_t *d_lenp);
 
+WCJSON_EXPORT int wctoutf8s(const wchar_t *s, size_t s_len, char *d,
+    size_t *d_lenp);
+
 WCJSON_EXPORT int wcjsonstowc(const wchar_t *s, size_t s_len, wchar_t *d,
     size_t *d_lenp);
 
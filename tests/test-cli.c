@@ -23,9 +23,14 @@
 #include <config.h>
 #endif
 
+#include <errno.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <uchar.h>
 #include <wchar.h>
 
 #include <wcjson-document.h>
@@ -33,6 +38,25 @@
 static int test_create(int argc, char *argv[]);
 static int test_add(int argc, char *argv[]);
 static int test_remove(int argc, char *argv[]);
+static int test_compact(int argc, char *argv[]);
+static int test_equal(int argc, char *argv[]);
+static int test_index(int argc, char *argv[]);
+static int test_number(int argc, char *argv[]);
+static int test_writer(int argc, char *argv[]);
+static int test_keyset(int argc, char *argv[]);
+static int test_bind(int argc, char *argv[]);
+static int test_mbstring(int argc, char *argv[]);
+static int test_threads(int argc, char *argv[]);
+static int test_utf8(int argc, char *argv[]);
+static int test_units(int argc, char *argv[]);
+static int test_write(int argc, char *argv[]);
+static int test_serialize(int argc, char *argv[]);
+static int test_sprintmb(int argc, char *argv[]);
+static int test_mtsprint(int argc, char *argv[]);
+static int test_snapshot(int argc, char *argv[]);
+static int test_pool(int argc, char *argv[]);
+static int test_arena(int argc, char *argv[]);
+static int test_allocator(int argc, char *argv[]);
 
 #define nitems(a) (sizeof((a)) / sizeof((a)[0]))
 
@@ -52,6 +76,82 @@ struct {
         .name = "remove",
         .test = test_remove,
     },
+    {
+        .name = "compact",
+        .test = test_compact,
+    },
+    {
+        .name = "equal",
+        .test = test_equal,
+    },
+    {
+        .name = "index",
+        .test = test_index,
+    },
+    {
+        .name = "number",
+        .test = test_number,
+    },
+    {
+        .name = "writer",
+        .test = test_writer,
+    },
+    {
+        .name = "keyset",
+        .test = test_keyset,
+    },
+    {
+        .name = "bind",
+        .test = test_bind,
+    },
+    {
+        .name = "mbstring",
+        .test = test_mbstring,
+    },
+    {
+        .name = "threads",
+        .test = test_threads,
+    },
+    {
+        .name = "utf8",
+        .test = test_utf8,
+    },
+    {
+        .name = "units",
+        .test = test_units,
+    },
+    {
+        .name = "write",
+        .test = test_write,
+    },
+    {
+        .name = "serialize",
+        .test = test_serialize,
+    },
+    {
+        .name = "sprintmb",
+        .test = test_sprintmb,
+    },
+    {
+        .name = "mtsprint",
+        .test = test_mtsprint,
+    },
+    {
+        .name = "snapshot",
+        .test = test_snapshot,
+    },
+    {
+        .name = "pool",
+        .test = test_pool,
+    },
+    {
+        .name = "arena",
+        .test = test_arena,
+    },
+    {
+        .name = "allocator",
+        .test = test_allocator,
+    },
 };
 
 static int doc_create(struct wcjson_document *doc) {
@@ -118,7 +218,6 @@ static int doc_add(struct wcjson_document *doc) {
 static int test_create(int argc, char *argv[]) {
   struct wcjson_value values[4];
   wchar_t strings[4];
-  wchar_t esc[4 * WCJSON_ESCAPE_MAX];
   struct wcjson_document doc = {
       .values = values,
       .v_nitems = nitems(values),
@@ -126,8 +225,6 @@ static int test_create(int argc, char *argv[]) {
       .strings = strings,
       .s_nitems = nitems(strings),
       .s_next = 0,
-      .esc = esc,
-      .e_nitems = nitems(esc),
   };
 
   struct wcjson ctx = WCJSON_INITIALIZER;
@@ -147,7 +244,6 @@ static int test_create(int argc, char *argv[]) {
 static int test_add(int argc, char *argv[]) {
   struct wcjson_value values[10];
   wchar_t strings[30];
-  wchar_t esc[5 * WCJSON_ESCAPE_MAX];
   struct wcjson_document doc = {
       .values = values,
       .v_nitems = nitems(values),
@@ -155,8 +251,6 @@ static int test_add(int argc, char *argv[]) {
       .strings = strings,
       .s_nitems = nitems(strings),
       .s_next = 0,
-      .esc = esc,
-      .e_nitems = nitems(esc),
   };
 
   struct wcjson ctx = WCJSON_INITIALIZER;
@@ -176,7 +270,6 @@ static int test_add(int argc, char *argv[]) {
 static int test_remove(int argc, char *argv[]) {
   struct wcjson_value values[10];
   wchar_t strings[30];
-  wchar_t esc[5 * WCJSON_ESCAPE_MAX];
   struct wcjson_document doc = {
       .values = values,
       .v_nitems = nitems(values),
@@ -184,8 +277,6 @@ static int test_remove(int argc, char *argv[]) {
       .strings = strings,
       .s_nitems = nitems(strings),
       .s_next = 0,
-      .esc = esc,
-      .e_nitems = nitems(esc),
   };
 
   struct wcjson ctx = WCJSON_INITIALIZER;
@@ -212,6 +303,1339 @@ static int test_remove(int argc, char *argv[]) {
   return 0;
 }
 
+static int test_compact(int argc, char *argv[]) {
+  struct wcjson_value values[10];
+  wchar_t strings[30];
+  size_t map[10];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (doc_add(&doc) < 0)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  struct wcjson_value *arr = wcjson_object_get(&doc, doc.values, L"key", 3);
+  if (arr == NULL)
+    return -1;
+
+  if (wcjson_value_free(&doc, wcjson_array_remove(&doc, arr, 1)) < 0)
+    return -1;
+
+  if (wcjson_value_free(&doc,
+                        wcjson_object_remove(&doc, doc.values, L"key2", 4)) < 0)
+    return -1;
+
+  // All values are in use so this needs a released slot
+  if (wcjson_array_add_tail(&doc, arr, wcjson_value_bool(&doc, true)) < 0)
+    return -1;
+
+  if (wcjson_document_compact(&doc, doc.values, map) < 0)
+    return -1;
+
+  if (doc.v_next != 8 || doc.s_next != 21 || map[0] != 0 || map[1] != 4 ||
+      map[2] != SIZE_MAX || map[8] != 1 || map[9] != SIZE_MAX)
+    return -1;
+
+  if (wcjsondocfprint(stdout, &doc, doc.values) < 0)
+    return -1;
+
+  return 0;
+}
+
+/* Compares objects with more members than compared without sorting */
+static int equal_members(void) {
+  wchar_t txt[3][512];
+  struct wcjson_value values[3][64];
+  wchar_t strings[3][512];
+  struct wcjson_document docs[3];
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  for (int t = 0; t < 3; t++) {
+    size_t len = 0;
+
+    len += swprintf(&txt[t][len], 512 - len, L"{");
+    for (int i = 0; i < 24; i++) {
+      const int k = t == 0 ? i : 23 - i;
+      len += swprintf(&txt[t][len], 512 - len, L"\"k%d\":%d,", k, k);
+    }
+    len += swprintf(&txt[t][len], 512 - len, L"\"d\":1,\"%ls\":1}",
+                    t == 2 ? L"e" : L"d");
+
+    docs[t] = (struct wcjson_document)WCJSON_DOCUMENT_INITIALIZER;
+    docs[t].values = values[t];
+    docs[t].v_nitems = nitems(values[t]);
+    docs[t].strings = strings[t];
+    docs[t].s_nitems = nitems(strings[t]);
+
+    if (wcjsondocvalues(&ctx, &docs[t], txt[t], len) < 0)
+      return -1;
+  }
+
+  if (!wcjson_value_equal(&docs[0], docs[0].values, NULL, &docs[1],
+                          docs[1].values, NULL) ||
+      wcjson_value_equal(&docs[0], docs[0].values, NULL, &docs[2],
+                         docs[2].values, NULL) ||
+      wcjson_value_equal(&docs[2], docs[2].values, NULL, &docs[0],
+                         docs[0].values, NULL))
+    return -1;
+
+  return 0;
+}
+
+static int test_equal(int argc, char *argv[]) {
+  const wchar_t *txt =
+      L"{\"key2\":456,\"key\":[\"abc\",null,123],\"key1\":\"d\\u0065f\"}";
+  struct wcjson_value values[10], parsed[10];
+  wchar_t strings[30], parsed_strings[30];
+  uint64_t hashes[10] = {0}, parsed_hashes[10] = {0};
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+  struct wcjson_document other = {
+      .values = parsed,
+      .v_nitems = nitems(parsed),
+      .v_next = 0,
+      .strings = parsed_strings,
+      .s_nitems = nitems(parsed_strings),
+      .s_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (doc_add(&doc) < 0 || wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocvalues(&ctx, &other, txt, wcslen(txt)) < 0 ||
+      wcjsondocstrings(&ctx, &other) < 0)
+    return -1;
+
+  // Member order does not matter
+  uint64_t h = wcjson_value_hash(&doc, doc.values, hashes);
+  if (h == 0 || h != wcjson_value_hash(&other, other.values, parsed_hashes))
+    return -1;
+
+  if (!wcjson_value_equal(&doc, doc.values, hashes, &other, other.values,
+                          parsed_hashes))
+    return -1;
+
+  // Array order does
+  struct wcjson_value *arr = wcjson_object_get(&other, other.values, L"key", 3);
+  if (arr == NULL)
+    return -1;
+
+  struct wcjson_value *v = wcjson_array_remove(&other, arr, 0);
+  if (v == NULL || wcjson_array_add_tail(&other, arr, v) < 0)
+    return -1;
+
+  if (wcjson_value_hash(&other, other.values, NULL) == h ||
+      wcjson_value_equal(&doc, doc.values, NULL, &other, other.values, NULL))
+    return -1;
+
+  // Repeated keys need to repeat equally often
+  const wchar_t *dup = L"{\"a\":1,\"a\":1,\"b\":2}";
+  const wchar_t *dup_other = L"{\"a\":1,\"b\":2,\"b\":2}";
+  const wchar_t *dup_reordered = L"{\"b\":2,\"a\":1,\"a\":1}";
+
+  wcjson_document_reset(&doc);
+  wcjson_document_reset(&other);
+  if (wcjsondocvalues(&ctx, &doc, dup, wcslen(dup)) < 0 ||
+      wcjsondocvalues(&ctx, &other, dup_other, wcslen(dup_other)) < 0)
+    return -1;
+
+  if (wcjson_value_equal(&doc, doc.values, NULL, &other, other.values, NULL) ||
+      wcjson_value_equal(&other, other.values, NULL, &doc, doc.values, NULL))
+    return -1;
+
+  wcjson_document_reset(&other);
+  if (wcjsondocvalues(&ctx, &other, dup_reordered, wcslen(dup_reordered)) < 0)
+    return -1;
+
+  memset(hashes, 0, sizeof(hashes));
+  memset(parsed_hashes, 0, sizeof(parsed_hashes));
+  h = wcjson_value_hash(&doc, doc.values, hashes);
+  if (h == 0 || h != wcjson_value_hash(&other, other.values, parsed_hashes) ||
+      !wcjson_value_equal(&doc, doc.values, NULL, &other, other.values, NULL) ||
+      !wcjson_value_equal(&doc, doc.values, hashes, &other, other.values,
+                          parsed_hashes))
+    return -1;
+
+  return equal_members();
+}
+
+struct index_join {
+  const struct wcjson_document *doc;
+  const struct wcjson_document *other;
+};
+
+static int index_join(void *ctx, const struct wcjson_value *pair,
+                      const struct wcjson_value *other_pair) {
+  const struct index_join *j = ctx;
+  const struct wcjson_value *p = pair != NULL ? pair : other_pair;
+  char c;
+
+  if (pair == NULL)
+    c = '+';
+  else if (other_pair == NULL)
+    c = '-';
+  else
+    c = wcjson_value_equal(j->doc, pair, NULL, j->other, other_pair, NULL)
+            ? '='
+            : '!';
+
+  printf("%.*ls%c", (int)p->s_len, p->string, c);
+  return 0;
+}
+
+static int test_index(int argc, char *argv[]) {
+  const wchar_t *txt =
+      L"{\"key3\":1,\"key\":[\"abc\",null,123],\"key1\":\"xyz\"}";
+  struct wcjson_value values[10], parsed[10];
+  wchar_t strings[30], parsed_strings[30];
+  size_t index[4], parsed_index[4];
+  size_t nitems = nitems(index), parsed_nitems = nitems(parsed_index);
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+  struct wcjson_document other = {
+      .values = parsed,
+      .v_nitems = nitems(parsed),
+      .v_next = 0,
+      .strings = parsed_strings,
+      .s_nitems = nitems(parsed_strings),
+      .s_next = 0,
+  };
+  struct index_join j = {
+      .doc = &doc,
+      .other = &other,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (doc_add(&doc) < 0 || wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocvalues(&ctx, &other, txt, wcslen(txt)) < 0 ||
+      wcjsondocstrings(&ctx, &other) < 0)
+    return -1;
+
+  if (wcjson_object_index(&doc, doc.values, index, &nitems) < 0 ||
+      nitems != 3)
+    return -1;
+
+  struct wcjson_value *v = wcjson_object_find(&doc, index, nitems, L"key1", 4);
+  if (v == NULL || !v->is_string || wcsncmp(v->string, L"def", 3) != 0)
+    return -1;
+
+  if (wcjson_object_find(&doc, index, nitems, L"key0", 4) != NULL)
+    return -1;
+
+  if (wcjson_object_index(&other, other.values, parsed_index,
+                          &parsed_nitems) < 0)
+    return -1;
+
+  return wcjson_object_join(&doc, index, nitems, &other, parsed_index,
+                            parsed_nitems, index_join, &j);
+}
+
+static int test_number(int argc, char *argv[]) {
+  const double doubles[] = {0.1, -2.5, 1e21, 1.5e-7, 5e-324, 0.3 - 0.1};
+  struct wcjson_value values[10];
+  wchar_t strings[200];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  struct wcjson_value *arr = wcjson_value_array(&doc);
+  if (arr == NULL)
+    return -1;
+
+  for (size_t i = 0; i < nitems(doubles); i++)
+    if (wcjson_array_add_tail(&doc, arr,
+                              wcjson_value_double(&doc, doubles[i])) < 0)
+      return -1;
+
+  if (wcjson_array_add_tail(&doc, arr, wcjson_value_int64(&doc, INT64_MIN)) <
+          0 ||
+      wcjson_array_add_tail(&doc, arr, wcjson_value_uint64(&doc, UINT64_MAX)) <
+          0)
+    return -1;
+
+  // No JSON representation
+  if (wcjson_value_double(&doc, HUGE_VAL) != NULL)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocfprint(stdout, &doc, arr) < 0)
+    return -1;
+
+  return 0;
+}
+
+static int writer_drain(struct wcjson_writer *w) {
+  for (size_t i = 0; i < w->pos; i++)
+    putchar((int)w->buf[i]);
+
+  w->pos = 0;
+  return 0;
+}
+
+/* Repeats a writer call after draining the buffer it filled up. */
+#define writer_call(w, call)                                                   \
+  while ((call) < 0)                                                           \
+    if (errno != ERANGE || writer_drain((w)) < 0)                              \
+      return -1;
+
+static int test_writer(int argc, char *argv[]) {
+  wchar_t buf[5];
+  unsigned char stack[2];
+  struct wcjson_writer w = WCJSON_WRITER_INITIALIZER;
+
+  w.buf = buf;
+  w.nitems = nitems(buf);
+  w.stack = stack;
+  w.st_nitems = nitems(stack);
+  w.asc = true;
+
+  writer_call(&w, wcjson_writer_begin_object(&w));
+  writer_call(&w, wcjson_writer_key(&w, L"a", 1));
+  writer_call(&w, wcjson_writer_begin_array(&w));
+
+  if (wcjson_writer_key(&w, L"b", 1) == 0 || errno != EINVAL)
+    return -1;
+
+  if (wcjson_writer_begin_array(&w) == 0 || errno != EOVERFLOW)
+    return -1;
+
+  if (wcjson_writer_number(&w, L"01", 2) == 0 || errno != EINVAL)
+    return -1;
+
+  writer_call(&w, wcjson_writer_int64(&w, 1));
+  writer_call(&w, wcjson_writer_double(&w, 2.5));
+  writer_call(&w, wcjson_writer_string(&w, L"x\"y", 3));
+  writer_call(&w, wcjson_writer_bool(&w, true));
+  writer_call(&w, wcjson_writer_null(&w));
+  writer_call(&w, wcjson_writer_number(&w, L"-3e2", 4));
+
+  if (wcjson_writer_end_object(&w) == 0 || errno != EINVAL)
+    return -1;
+
+  writer_call(&w, wcjson_writer_end_array(&w));
+  writer_call(&w, wcjson_writer_key(&w, L"b", 1));
+  writer_call(&w, wcjson_writer_begin_object(&w));
+  writer_call(&w, wcjson_writer_end_object(&w));
+  writer_call(&w, wcjson_writer_key(&w, L"c", 1));
+  writer_call(&w, wcjson_writer_string(&w, L"\u00e4", 1));
+  writer_call(&w, wcjson_writer_end_object(&w));
+
+  if (!w.done || wcjson_writer_null(&w) == 0 || errno != EINVAL)
+    return -1;
+
+  return writer_drain(&w);
+}
+
+static int test_keyset(int argc, char *argv[]) {
+  const wchar_t *txt = L"{\"name\":\"n\",\"x\":1,\"other\":2,\"id\":3}";
+  const wchar_t *keys[] = {L"id", L"name", L"tags", L"x"};
+  const size_t lens[] = {2, 4, 4, 1};
+  struct wcjson_value *matched[nitems(keys)] = {NULL};
+  struct wcjson_value values[10];
+  size_t table[12];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+  };
+  struct wcjson_keyset set = WCJSON_KEYSET_INITIALIZER;
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  set.table = table;
+  set.t_nitems = nitems(table);
+
+  if (wcjson_keyset_init(&set, keys, lens, nitems(keys)) < 0)
+    return -1;
+
+  for (size_t i = 0; i < nitems(keys); i++)
+    if (wcjson_keyset_find(&set, keys[i], lens[i]) != i)
+      return -1;
+
+  if (wcjson_keyset_find(&set, L"other", 5) != SIZE_MAX)
+    return -1;
+
+  if (wcjsondocvalues(&ctx, &doc, txt, wcslen(txt)) < 0)
+    return -1;
+
+  if (wcjson_object_match(&doc, doc.values, &set, matched) < 0)
+    return -1;
+
+  for (size_t i = 0; i < nitems(keys); i++) {
+    if (matched[i] == NULL)
+      printf("%s-", i > 0 ? " " : "");
+    else
+      printf("%s%.*ls", i > 0 ? " " : "", (int)matched[i]->s_len,
+             matched[i]->string);
+  }
+
+  return 0;
+}
+
+struct bind_point {
+  int64_t x;
+  double y;
+};
+
+struct bind_record {
+  wchar_t name[8];
+  bool ok;
+  uint64_t id;
+  struct bind_point origin;
+  struct bind_point points[2];
+  size_t npoints;
+};
+
+static const struct wcjson_binding bind_point_fields[] = {
+    {
+        .key = L"x",
+        .key_len = 1,
+        .type = WCJSON_BINDING_INT64,
+        .offset = offsetof(struct bind_point, x),
+    },
+    {
+        .key = L"y",
+        .key_len = 1,
+        .type = WCJSON_BINDING_DOUBLE,
+        .offset = offsetof(struct bind_point, y),
+    },
+};
+
+static const struct wcjson_binding bind_point = {
+    .type = WCJSON_BINDING_OBJECT,
+    .bindings = bind_point_fields,
+    .b_nitems = nitems(bind_point_fields),
+};
+
+static struct wcjson_keyset bind_record_keys = WCJSON_KEYSET_INITIALIZER;
+
+static const struct wcjson_binding bind_record_fields[] = {
+    {
+        .key = L"name",
+        .key_len = 4,
+        .type = WCJSON_BINDING_STRING,
+        .offset = offsetof(struct bind_record, name),
+        .nitems = nitems(((struct bind_record *)0)->name),
+    },
+    {
+        .key = L"ok",
+        .key_len = 2,
+        .type = WCJSON_BINDING_BOOL,
+        .offset = offsetof(struct bind_record, ok),
+    },
+    {
+        .key = L"id",
+        .key_len = 2,
+        .type = WCJSON_BINDING_UINT64,
+        .offset = offsetof(struct bind_record, id),
+    },
+    {
+        .key = L"origin",
+        .key_len = 6,
+        .type = WCJSON_BINDING_OBJECT,
+        .offset = offsetof(struct bind_record, origin),
+        .bindings = bind_point_fields,
+        .b_nitems = nitems(bind_point_fields),
+    },
+    {
+        .key = L"points",
+        .key_len = 6,
+        .type = WCJSON_BINDING_ARRAY,
+        .offset = offsetof(struct bind_record, points),
+        .nitems = nitems(((struct bind_record *)0)->points),
+        .size = sizeof(struct bind_point),
+        .count = offsetof(struct bind_record, npoints),
+        .bindings = &bind_point,
+        .b_nitems = 1,
+    },
+};
+
+static const struct wcjson_binding bind_record = {
+    .type = WCJSON_BINDING_OBJECT,
+    .bindings = bind_record_fields,
+    .b_nitems = nitems(bind_record_fields),
+    .keyset = &bind_record_keys,
+};
+
+static int test_bind(int argc, char *argv[]) {
+  const wchar_t *txt =
+      L"{\"skip\":{\"x\":[1,{\"y\":2}]},\"na\\u006de\":\"a\\\"b\","
+      L"\"id\":18446744073709551615,\"ok\":true,"
+      L"\"origin\":{\"x\":-7,\"y\":0.5,\"z\":null},"
+      L"\"points\":[{\"x\":1,\"y\":1e2},{\"x\":2,\"y\":-0.1e-400}]}";
+  struct bind_record rec = {0};
+  struct wcjson_binder_frame stack[3];
+  size_t table[24];
+  struct wcjson_binder binder = WCJSON_BINDER_INITIALIZER;
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  bind_record_keys.table = table;
+  bind_record_keys.t_nitems = nitems(table);
+
+  if (wcjson_keyset_bindings(&bind_record_keys, bind_record_fields,
+                             nitems(bind_record_fields)) < 0)
+    return -1;
+
+  binder.binding = &bind_record;
+  binder.base = &rec;
+  binder.stack = stack;
+  binder.st_nitems = nitems(stack);
+
+  if (wcjsonbind(&ctx, &binder, txt, wcslen(txt)) < 0)
+    return -1;
+
+  printf("%c%c%c %d %llu %lld %g %zu %lld %g %lld %g", (int)rec.name[0],
+         (int)rec.name[1], (int)rec.name[2], rec.ok,
+         (unsigned long long)rec.id, (long long)rec.origin.x, rec.origin.y,
+         rec.npoints, (long long)rec.points[0].x, rec.points[0].y,
+         (long long)rec.points[1].x, rec.points[1].y);
+
+  // Type mismatch
+  txt = L"{\"ok\":1}";
+  if (wcjsonbind(&ctx, &binder, txt, wcslen(txt)) == 0 || ctx.errnum != EINVAL)
+    return -1;
+
+  // Array and integer capacity
+  txt = L"{\"points\":[{},{},{}]}";
+  if (wcjsonbind(&ctx, &binder, txt, wcslen(txt)) == 0 || ctx.errnum != ERANGE)
+    return -1;
+
+  txt = L"{\"origin\":{\"x\":9223372036854775808}}";
+  if (wcjsonbind(&ctx, &binder, txt, wcslen(txt)) == 0 || ctx.errnum != ERANGE)
+    return -1;
+
+  return 0;
+}
+
+static int test_mbstring(int argc, char *argv[]) {
+  struct wcjson_value values[10];
+  wchar_t strings[30];
+  char mbstrings[8];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+      .mbstrings = mbstrings,
+      .mb_nitems = nitems(mbstrings),
+      .mb_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (doc_add(&doc) < 0)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  struct wcjson_value *arr = wcjson_object_get(&doc, doc.values, L"key", 3);
+  if (arr == NULL)
+    return -1;
+
+  struct wcjson_value *v = wcjson_array_get(&doc, arr, 0);
+  if (v == NULL)
+    return -1;
+
+  const char *mb = wcjson_value_mbstring(&doc, v);
+  if (mb == NULL)
+    return -1;
+
+  if (wcjson_value_mbstring(&doc, v) != mb || doc.mb_next != 4)
+    return -1;
+
+  v = wcjson_object_get(&doc, doc.values, L"key2", 4);
+  if (v == NULL || wcjson_value_mbstring(&doc, v) == NULL)
+    return -1;
+
+  v = wcjson_object_get(&doc, doc.values, L"key1", 4);
+  if (v == NULL || wcjson_value_mbstring(&doc, v) != NULL)
+    return -1;
+
+  printf("%s%s", mb, doc.values[doc.values->tail_idx].mbstring == NULL ?
+      "" : "!");
+  return 0;
+}
+
+static int test_threads(int argc, char *argv[]) {
+  const wchar_t *txt = L"{\"a\":\"x\\ty\",\"b\":[1,\"\\u0041\",true,2.5],"
+                       L"\"c\\\"d\":null,\"e\":{\"f\":\"g\"}}";
+  struct wcjson_value values[16];
+  wchar_t strings[64];
+  char mbstrings[64];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+      .mb_utf8 = true,
+  };
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (wcjsondocvalues(&ctx, &doc, txt, wcslen(txt)) < 0)
+    return -1;
+
+  if (wcjsondocmtstrings(&ctx, &doc, 3) < 0 || doc.s_next != doc.s_nitems_cnt)
+    return -1;
+
+  if (wcjsondocmtmbstrings(&ctx, &doc, 3) < 0)
+    return -1;
+
+  const size_t mb_nitems_cnt = doc.mb_nitems_cnt;
+
+  doc.mbstrings = mbstrings;
+  doc.mb_nitems = mb_nitems_cnt;
+  doc.mb_next = 0;
+
+  if (wcjsondocmtmbstrings(&ctx, &doc, 4) < 0 || doc.mb_next != mb_nitems_cnt)
+    return -1;
+
+  if (wcjsondocmtstrings(&ctx, &doc, 0) == 0 || ctx.errnum != EINVAL)
+    return -1;
+
+  if (wcjsondocfprint(stdout, &doc, doc.values) < 0)
+    return -1;
+
+  // The stream has been oriented wide
+  for (size_t i = 0; i < doc.v_next; i++)
+    if (doc.values[i].mbstring != NULL)
+      wprintf(L" %s", doc.values[i].mbstring);
+
+  return 0;
+}
+
+static int test_utf8(int argc, char *argv[]) {
+  struct wcjson_value values[2];
+  wchar_t strings[40];
+  char mbstrings[40];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+      .mb_utf8 = true,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  struct wcjson_value *arr = wcjson_value_array(&doc);
+  if (arr == NULL)
+    return -1;
+
+  const wchar_t *s = L"ABCDEFGHIJKLMNOPQRS\u00e4\u20ac\U0001f600";
+  struct wcjson_value *v = wcjson_value_string(&doc, s, wcslen(s));
+  if (v == NULL)
+    return -1;
+
+  if (wcjson_array_add_tail(&doc, arr, v) < 0)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocmbstrings(&ctx, &doc) < 0 || doc.mb_nitems_cnt != 29)
+    return -1;
+
+  doc.mbstrings = mbstrings;
+  doc.mb_nitems = doc.mb_nitems_cnt;
+
+  if (wcjsondocmbstrings(&ctx, &doc) < 0)
+    return -1;
+
+  for (size_t i = 0; i < v->mb_len; i++)
+    printf("%02x", (unsigned char)v->mbstring[i]);
+
+  return 0;
+}
+
+static void *units_object_start(struct wcjson *ctx, void *doc, void *parent) {
+  printf("{");
+  return doc;
+}
+
+static void *units_array_start(struct wcjson *ctx, void *doc, void *parent) {
+  printf("[");
+  return doc;
+}
+
+static void units_add(struct wcjson *ctx, void *doc, void *obj, void *key,
+                      void *value) {}
+
+static void units_array_add(struct wcjson *ctx, void *doc, void *arr,
+                            void *value) {}
+
+static void units_object_end(struct wcjson *ctx, void *doc, void *obj) {
+  printf("}");
+}
+
+static void units_array_end(struct wcjson *ctx, void *doc, void *arr) {
+  printf("]");
+}
+
+static void *units_bool(struct wcjson *ctx, void *doc, const bool value) {
+  printf("b");
+  return doc;
+}
+
+static void *units_null(struct wcjson *ctx, void *doc) {
+  printf("0");
+  return doc;
+}
+
+static void *units_string8(struct wcjson *ctx, void *doc, const char *str,
+                           const size_t len, const bool escaped) {
+  printf("s%zu", len);
+  return doc;
+}
+
+static void *units_number8(struct wcjson *ctx, void *doc, const char *num,
+                           const size_t len) {
+  printf("d%zu", len);
+  return doc;
+}
+
+static void *units_string16(struct wcjson *ctx, void *doc, const char16_t *str,
+                            const size_t len, const bool escaped) {
+  printf("s%zu", len);
+  return doc;
+}
+
+static void *units_number16(struct wcjson *ctx, void *doc, const char16_t *num,
+                            const size_t len) {
+  printf("d%zu", len);
+  return doc;
+}
+
+static void *units_string32(struct wcjson *ctx, void *doc, const char32_t *str,
+                            const size_t len, const bool escaped) {
+  printf("s%zu", len);
+  return doc;
+}
+
+static void *units_number32(struct wcjson *ctx, void *doc, const char32_t *num,
+                            const size_t len) {
+  printf("d%zu", len);
+  return doc;
+}
+
+static int test_units(int argc, char *argv[]) {
+  const struct wcjson_utf8_ops ops8 = {
+      .object_start = units_object_start,
+      .object_add = units_add,
+      .object_end = units_object_end,
+      .array_start = units_array_start,
+      .array_add = units_array_add,
+      .array_end = units_array_end,
+      .string_value = units_string8,
+      .number_value = units_number8,
+      .bool_value = units_bool,
+      .null_value = units_null,
+  };
+  const struct wcjson_utf16_ops ops16 = {
+      .object_start = units_object_start,
+      .object_add = units_add,
+      .object_end = units_object_end,
+      .array_start = units_array_start,
+      .array_add = units_array_add,
+      .array_end = units_array_end,
+      .string_value = units_string16,
+      .number_value = units_number16,
+      .bool_value = units_bool,
+      .null_value = units_null,
+  };
+  const struct wcjson_utf32_ops ops32 = {
+      .object_start = units_object_start,
+      .object_add = units_add,
+      .object_end = units_object_end,
+      .array_start = units_array_start,
+      .array_add = units_array_add,
+      .array_end = units_array_end,
+      .string_value = units_string32,
+      .number_value = units_number32,
+      .bool_value = units_bool,
+      .null_value = units_null,
+  };
+  const char txt8[] =
+      u8"{\"k\":[\"x\\u00e4\",-1.5e3,true,null],\"\\u00e4\":\"\u00e4\"}";
+  const char16_t txt16[] =
+      u"{\"k\":[\"x\\u00e4\",-1.5e3,true,null],\"\\u00e4\":\"\u00e4\"}";
+  const char32_t txt32[] =
+      U"{\"k\":[\"x\\u00e4\",-1.5e3,true,null],\"\\u00e4\":\"\u00e4\"}";
+  struct wcjson ctx = WCJSON_INITIALIZER;
+  int doc;
+
+  if (wcjsonutf8(&ctx, &ops8, &doc, txt8, nitems(txt8) - 1) < 0)
+    return -1;
+
+  printf(" ");
+
+  if (wcjsonutf16(&ctx, &ops16, &doc, txt16, nitems(txt16) - 1) < 0)
+    return -1;
+
+  printf(" ");
+
+  if (wcjsonutf32(&ctx, &ops32, &doc, txt32, nitems(txt32) - 1) < 0)
+    return -1;
+
+  // Control characters are not allowed in strings
+  if (wcjsonutf8(&ctx, NULL, NULL, "\"\x01\"", 3) == 0 ||
+      ctx.status != WCJSON_ABORT_INVALID)
+    return -1;
+
+  return 0;
+}
+
+static int test_write(int argc, char *argv[]) {
+  struct wcjson_value values[10];
+  wchar_t strings[30];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (doc_add(&doc) < 0)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocwrite(fileno(stdout), &doc, doc.values) < 0)
+    return -1;
+
+  return 0;
+}
+
+static int serialize_sink(void *ctx, const wchar_t *s, size_t len) {
+  if (len > *(size_t *)ctx)
+    return -1;
+
+  for (size_t i = 0; i < len; i++)
+    putchar((int)s[i]);
+
+  return 0;
+}
+
+static int test_serialize(int argc, char *argv[]) {
+  struct wcjson_value values[12];
+  wchar_t strings[40];
+  wchar_t chunk[WCJSON_ESCAPE_MAX];
+  size_t chunk_len = nitems(chunk);
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (doc_add(&doc) < 0)
+    return -1;
+
+  const wchar_t *s = L"a\"\u00e4\U0001f600";
+  struct wcjson_value *v = wcjson_value_string(&doc, s, wcslen(s));
+  if (v == NULL)
+    return -1;
+
+  if (wcjson_object_add_tail(&doc, doc.values, L"key3", 4, v) < 0)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocserializeasc(&doc, doc.values, serialize_sink, &chunk_len,
+                            chunk, WCJSON_ESCAPE_MAX - 1) == 0)
+    return -1;
+
+  if (wcjsondocserializeasc(&doc, doc.values, serialize_sink, &chunk_len,
+                            chunk, chunk_len) < 0)
+    return -1;
+
+  return 0;
+}
+
+static int test_sprintmb(int argc, char *argv[]) {
+  struct wcjson_value values[4];
+  wchar_t strings[20];
+  char s[32];
+  size_t s_len = 8;
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  struct wcjson_value *arr = wcjson_value_array(&doc);
+  if (arr == NULL)
+    return -1;
+
+  const wchar_t *w = L"a\"\u00e4\U0001f600";
+  struct wcjson_value *v = wcjson_value_string(&doc, w, wcslen(w));
+  if (v == NULL)
+    return -1;
+
+  if (wcjson_array_add_tail(&doc, arr, v) < 0)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocsprintmb(s, &s_len, &doc, arr) == 0)
+    return -1;
+
+  s_len = sizeof(s);
+  if (wcjsondocsprintmb(s, &s_len, &doc, arr) < 0 || s_len != strlen(s))
+    return -1;
+
+  for (size_t i = 0; i < s_len; i++)
+    printf("%02x", (unsigned char)s[i]);
+
+  s_len = sizeof(s);
+  if (wcjsondocsprintmbasc(s, &s_len, &doc, arr) < 0)
+    return -1;
+
+  printf(" %s", s);
+  return 0;
+}
+
+static int test_mtsprint(int argc, char *argv[]) {
+  struct wcjson_value values[12];
+  wchar_t strings[40];
+  wchar_t s[80];
+  size_t s_len = 16;
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+  };
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (doc_add(&doc) < 0)
+    return -1;
+
+  struct wcjson_value *v = wcjson_value_string(&doc, L"\u00e4", 1);
+  if (v == NULL)
+    return -1;
+
+  if (wcjson_object_add_tail(&doc, doc.values, L"key3", 4, v) < 0)
+    return -1;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0)
+    return -1;
+
+  if (wcjsondocmtsprintasc(s, &s_len, &doc, doc.values, 3) == 0 ||
+      errno != ERANGE)
+    return -1;
+
+  s_len = nitems(s);
+
+  if (wcjsondocmtsprintasc(s, &s_len, &doc, doc.values, 3) < 0 ||
+      s_len != wcslen(s))
+    return -1;
+
+  printf("%ls", s);
+
+  s_len = nitems(s);
+
+  if (wcjsondocmtsprint(s, &s_len, &doc, v, 2) < 0)
+    return -1;
+
+  printf(" %zu", s_len);
+  return 0;
+}
+
+/*
+ * Loads a copy of the first len bytes of a snapshot, or all of them if
+ * negative, patched at off and expects it to be rejected.
+ */
+static int snapshot_reject(FILE *f, long len, long off, const void *patch,
+                           size_t patch_len) {
+  struct wcjson_document loaded = WCJSON_DOCUMENT_INITIALIZER;
+  char buf[4096];
+  size_t n;
+  int r = -1;
+
+  if (fseek(f, 0, SEEK_SET) != 0 ||
+      (n = fread(buf, 1, sizeof(buf), f)) == 0 || n == sizeof(buf))
+    return -1;
+
+  if (len >= 0 && (size_t)len < n)
+    n = (size_t)len;
+
+  if (patch != NULL)
+    memcpy(&buf[off], patch, patch_len);
+
+  FILE *c = tmpfile();
+  if (c == NULL)
+    return -1;
+
+  if (fwrite(buf, 1, n, c) != n || fflush(c) != 0)
+    goto out;
+
+  if (wcjsondocload(fileno(c), &loaded) == 0) {
+    wcjsondocunload(&loaded);
+    goto out;
+  }
+
+  if (errno == EINVAL)
+    r = 0;
+out:
+  fclose(c);
+  return r;
+}
+
+static int test_snapshot(int argc, char *argv[]) {
+  struct wcjson_value values[10];
+  wchar_t strings[30];
+  char mbstrings[30];
+  struct wcjson_document doc = {
+      .values = values,
+      .v_nitems = nitems(values),
+      .v_next = 0,
+      .strings = strings,
+      .s_nitems = nitems(strings),
+      .s_next = 0,
+      .mbstrings = mbstrings,
+      .mb_nitems = nitems(mbstrings),
+      .mb_next = 0,
+      .mb_utf8 = true,
+  };
+  struct wcjson_document loaded = WCJSON_DOCUMENT_INITIALIZER;
+  struct wcjson ctx = WCJSON_INITIALIZER;
+  FILE *f = tmpfile();
+  int r = -1;
+
+  if (f == NULL)
+    return -1;
+
+  if (doc_add(&doc) < 0)
+    goto out;
+
+  // Strings still referenced from elsewhere cannot be saved
+  if (wcjsondocsave(fileno(f), &doc) == 0)
+    goto out;
+
+  if (wcjsondocstrings(&ctx, &doc) < 0 || wcjsondocmbstrings(&ctx, &doc) < 0)
+    goto out;
+
+  if (wcjsondocsave(fileno(f), &doc) < 0 || fflush(f) != 0)
+    goto out;
+
+  if (wcjsondocload(fileno(f), &loaded) < 0)
+    goto out;
+
+  struct wcjson_value *v = wcjson_object_get(&loaded, loaded.values, L"key1", 4);
+  if (v == NULL || v->mbstring == NULL || strcmp(v->mbstring, "def") != 0)
+    goto out;
+
+  if (wcjsondocwrite(fileno(stdout), &loaded, loaded.values) < 0)
+    goto out;
+
+  if (wcjsondocunload(&loaded) < 0)
+    goto out;
+
+  if (fseek(f, 0, SEEK_END) != 0)
+    goto out;
+
+  // Item counts and offsets follow the magic and six 32 bit header fields
+  const uint64_t size = (uint64_t)ftell(f);
+  const uint64_t overlapping[5] = {1000000, 0, size, 0, 0};
+  const uint64_t v_nitems = 1000000;
+
+  // Values follow the 80 byte header, linking the last member to the first
+  const size_t tail = doc.values[0].tail_idx;
+  const size_t head = doc.values[0].head_idx;
+  const long next_off = 80 + (long)(tail * sizeof(struct wcjson_value) +
+                                    offsetof(struct wcjson_value, next_idx));
+
+  if (snapshot_reject(f, -1, 32, overlapping, sizeof(overlapping)) < 0 ||
+      snapshot_reject(f, -1, 32, &v_nitems, sizeof(v_nitems)) < 0 ||
+      snapshot_reject(f, 64, 0, NULL, 0) < 0 ||
+      snapshot_reject(f, -1, next_off, &head, sizeof(head)) < 0)
+    goto out;
+
+  r = 0;
+out:
+  fclose(f);
+  return r;
+}
+
+static int pool_parse(struct wcjson_document_pool *pool, const wchar_t *txt) {
+  struct wcjson_document *doc;
+  int r = -1;
+
+  for (int i = 0; i < 8; i++) {
+    struct wcjson ctx = WCJSON_INITIALIZER;
+
+    if ((doc = wcjson_document_pool_get(pool)) == NULL)
+      return -1;
+
+    if (wcjsondocvalues(&ctx, doc, txt, wcslen(txt)) == 0 &&
+        wcjsondocstrings(&ctx, doc) == 0) {
+      r = wcjsondocfprint(stdout, doc, doc->values);
+      break;
+    }
+
+    wcjson_document_pool_put(pool, doc);
+    doc = NULL;
+  }
+
+  if (doc != NULL)
+    wcjson_document_pool_put(pool, doc);
+
+  return r;
+}
+
+static int pool_grow_parse(struct wcjson_document *doc, const wchar_t *txt) {
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  // Pooled documents grow like any other until the text fits
+  while (wcjsondocvalues(&ctx, doc, txt, wcslen(txt)) < 0) {
+    if (errno != ERANGE || wcjson_document_grow(doc) < 0)
+      return -1;
+
+    wcjson_document_reset(doc);
+  }
+
+  if (wcjson_document_grow(doc) < 0 || wcjsondocstrings(&ctx, doc) < 0 ||
+      wcjsondocmbstrings(&ctx, doc) < 0 || wcjson_document_grow(doc) < 0 ||
+      wcjsondocmbstrings(&ctx, doc) < 0)
+    return -1;
+
+  return wcjsondocfprint(stdout, doc, doc->values);
+}
+
+static int pool_grow(const wchar_t *txt) {
+  struct wcjson_document_pool *pool = wcjson_document_pool_create(NULL, 1, 1, 0);
+  int r = -1;
+
+  if (pool == NULL)
+    return -1;
+
+  struct wcjson_document *doc = wcjson_document_pool_get(pool);
+  if (doc == NULL)
+    goto out;
+
+  if (pool_grow_parse(doc, txt) < 0) {
+    wcjson_document_pool_put(pool, doc);
+    goto out;
+  }
+
+  // And may be freed before they are returned
+  wcjson_document_free(doc);
+  wcjson_document_pool_put(pool, doc);
+
+  if ((doc = wcjson_document_pool_get(pool)) == NULL)
+    goto out;
+
+  r = pool_grow_parse(doc, txt);
+  wcjson_document_pool_put(pool, doc);
+out:
+  wcjson_document_pool_destroy(pool);
+  return r;
+}
+
+static int test_pool(int argc, char *argv[]) {
+  const wchar_t *txt = L"{\"key\":[\"abc\",null,123]}";
+  struct wcjson_document_pool *pool = wcjson_document_pool_create(NULL, 1, 1, 0);
+  int r = -1;
+
+  if (pool == NULL)
+    return -1;
+
+  if (pool_parse(pool, txt) < 0)
+    goto out;
+
+  struct wcjson_document *doc = wcjson_document_pool_get(pool);
+  if (doc == NULL)
+    goto out;
+
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  // Steady state, the pooled document has been sized by the first parse
+  if (wcjsondocvalues(&ctx, doc, txt, wcslen(txt)) < 0 ||
+      wcjsondocstrings(&ctx, doc) < 0) {
+    wcjson_document_pool_put(pool, doc);
+    goto out;
+  }
+
+  wcjson_document_reset(doc);
+
+  if (doc->v_next != 0 || doc->s_next != 0 ||
+      wcjsondocvalues(&ctx, doc, txt, wcslen(txt)) < 0 ||
+      wcjsondocstrings(&ctx, doc) < 0 ||
+      wcjsondocfprint(stdout, doc, doc->values) < 0) {
+    wcjson_document_pool_put(pool, doc);
+    goto out;
+  }
+
+  wcjson_document_pool_put(pool, doc);
+  r = pool_grow(txt);
+out:
+  wcjson_document_pool_destroy(pool);
+  return r;
+}
+
+static int test_arena(int argc, char *argv[]) {
+  const wchar_t *txt = L"{\"key\":[\"abc\",null,123]}";
+  struct wcjson_value block[16];
+  struct wcjson_arena arena = WCJSON_ARENA_INITIALIZER;
+  struct wcjson_document doc = WCJSON_DOCUMENT_INITIALIZER;
+  struct wcjson ctx = WCJSON_INITIALIZER;
+
+  if (wcjson_arena_init(&arena, block, sizeof(block)) < 0)
+    return -1;
+
+  if (wcjsondocarenavalues(&ctx, &arena, &doc, txt, wcslen(txt)) < 0)
+    return -1;
+
+  if (wcjsondocarenastrings(&ctx, &arena, &doc) < 0)
+    return -1;
+
+  if (wcjsondocarenambstrings(&ctx, &arena, &doc) < 0)
+    return -1;
+
+  const size_t used = sizeof(struct wcjson_value) * doc.v_nitems +
+                      sizeof(wchar_t) * doc.s_nitems + doc.mb_nitems;
+
+  if (sizeof(block) - wcjson_arena_remaining(&arena) < used)
+    return -1;
+
+  if (wcjsondocfprint(stdout, &doc, doc.values) < 0)
+    return -1;
+
+  return wcjson_arena_unmap(&arena);
+}
+
+static void *counting_allocate(void *ctx, size_t size) {
+  void *p = malloc(size);
+
+  if (p != NULL)
+    (*(long *)ctx)++;
+
+  return p;
+}
+
+static void *counting_reallocate(void *ctx, void *p, size_t size) {
+  void *n = realloc(p, size);
+
+  if (n != NULL && p == NULL)
+    (*(long *)ctx)++;
+
+  return n;
+}
+
+static void counting_deallocate(void *ctx, void *p) {
+  if (p != NULL)
+    (*(long *)ctx)--;
+
+  free(p);
+}
+
+static int test_allocator(int argc, char *argv[]) {
+  const wchar_t *txt = L"{\"key\":[\"abc\",null,123]}";
+  long live = 0;
+  const struct wcjson_allocator allocator = {
+      .allocate = counting_allocate,
+      .reallocate = counting_reallocate,
+      .deallocate = counting_deallocate,
+      .ctx = &live,
+  };
+  struct wcjson_document doc = WCJSON_DOCUMENT_INITIALIZER;
+  struct wcjson ctx = WCJSON_INITIALIZER;
+  int r = -1;
+
+  doc.allocator = &allocator;
+
+  // Counting pass, then parse into grown arrays
+  if (wcjsondocvalues(&ctx, &doc, txt, wcslen(txt)) < 0 ||
+      wcjson_document_grow(&doc) < 0 ||
+      wcjsondocvalues(&ctx, &doc, txt, wcslen(txt)) < 0 ||
+      wcjson_document_grow(&doc) < 0 || wcjsondocstrings(&ctx, &doc) < 0 ||
+      wcjsondocmbstrings(&ctx, &doc) < 0 ||
+      wcjson_document_grow(&doc) < 0 || wcjsondocmbstrings(&ctx, &doc) < 0)
+    goto out;
+
+  // Moves the strings array and rebases the values
+  doc.s_nitems_cnt *= 64;
+
+  if (wcjson_document_grow(&doc) < 0)
+    goto out;
+
+  struct wcjson_value *v = wcjson_array_get(
+      &doc, wcjson_object_get(&doc, doc.values, L"key", 3), 0);
+
+  if (v == NULL || wcscmp(v->string, L"abc") != 0 ||
+      strcmp(v->mbstring, "abc") != 0)
+    goto out;
+
+  if (wcjsondocfprint(stdout, &doc, doc.values) < 0)
+    goto out;
+
+  r = 0;
+out:
+  wcjson_document_free(&doc);
+  return r == 0 && live == 0 ? 0 : -1;
+}
+
 int main(int argc, char *argv[]) {
   if (argc < 2)
     return EXIT_FAILURE;